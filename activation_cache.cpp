@@ -0,0 +1,196 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trainer.cpp"
+
+/*
+ * Outputs of a network's frozen prefix for every sample of a data set, filled
+ * lazily during the first epoch and replayed afterwards, so later epochs run
+ * only the trainable suffix. Pixels are scaled by inputScale on the way in. Rows live in memory, or in a file mapped with
+ * mmap when path is given, for caches larger than RAM. The file keeps a
+ * header with key (see activationCacheKey) and the filled flags next to the
+ * rows, so a later run with the same key reuses the rows already stored; a
+ * file with another key, shape or element type is cleared. Key 0 is never
+ * reused.
+ */
+template <class S>
+class ActivationCache {
+  struct Header {
+    char magic[4];
+    uint32_t elementBytes;
+    uint64_t key, numSamples, width;
+  };
+  static constexpr size_t headerBytes = 64;
+  size_t _numSamples;
+  size_t _width;
+  S _inputScale;
+  std::string _path;
+  std::vector<S> _memory;
+  std::vector<uint8_t> _filledMemory;
+  S *_rows;
+  uint8_t *_filled; /* size: numSamples */
+  void *_mapped;
+  size_t _mappedBytes;
+public:
+  ActivationCache(size_t numSamples, size_t width, const std::string &path = "", uint64_t key = 0, S inputScale = static_cast<S>(1.0 / 256)) :
+    _numSamples(numSamples),
+    _width(width),
+    _inputScale(inputScale),
+    _path(path),
+    _rows(nullptr),
+    _filled(nullptr),
+    _mapped(nullptr),
+    _mappedBytes(0)
+  {
+    if(_path.empty() || !map(key)) {
+      _memory.resize(_numSamples * _width);
+      _filledMemory.assign(_numSamples, 0);
+      _rows = _memory.data();
+      _filled = _filledMemory.data();
+    }
+  }
+
+  ActivationCache(const ActivationCache &) = delete;
+
+  ~ActivationCache() {
+    if(_mapped) munmap(_mapped, _mappedBytes);
+  }
+
+  /* rows and filled flags, in memory or mapped */
+  size_t memoryBytes() const {
+    return _memory.capacity() * sizeof(S) + _filledMemory.capacity() + _mappedBytes;
+  }
+
+  size_t getWidth() const {
+    return _width;
+  }
+
+  S getInputScale() const {
+    return _inputScale;
+  }
+
+  bool isFilled(uint32_t sample) const {
+    return _filled[sample] != 0;
+  }
+
+  size_t getNumFilled() const {
+    return std::count(_filled, _filled + _numSamples, 1);
+  }
+
+  void store(uint32_t sample, TensorView<const S> row) {
+    std::memcpy(_rows + sample * _width, row.data(), _width * sizeof(S));
+    _filled[sample] = 1;
+  }
+
+  /* a view of the cached row, which the trainable suffix reads in place */
+  TensorView<const S> load(uint32_t sample) const {
+    return TensorView<const S>(_rows + sample * _width, _width);
+  }
+
+  /* forgets all rows, e.g. after the frozen weights changed */
+  void invalidate() {
+    std::fill(_filled, _filled + _numSamples, 0);
+  }
+
+private:
+  /* [header][filled flags, padded to 64 bytes][rows]; false if the file cannot be used */
+  bool map(uint64_t key) {
+    const size_t filledBytes = (_numSamples + 63) / 64 * 64;
+    const size_t bytes = headerBytes + filledBytes + _numSamples * _width * sizeof(S);
+    int fd = open(_path.c_str(), O_RDWR|O_CREAT, 0644);
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st) != 0) {
+      std::cerr << "cannot open " << _path << ", caching in memory" << std::endl;
+      if(fd >= 0) close(fd);
+      return false;
+    }
+    Header expected = {{'N', 'N', 'A', 'C'}, sizeof(S), key, _numSamples, _width};
+    Header header;
+    const bool reuse = key != 0 && static_cast<size_t>(st.st_size) == bytes
+      && pread(fd, &header, sizeof(header), 0) == sizeof(header) && std::memcmp(&header, &expected, sizeof(header)) == 0;
+    /* truncating to 0 first zeroes the filled flags of a file that is not reused */
+    if(!reuse && (ftruncate(fd, 0) != 0 || ftruncate(fd, bytes) != 0)) {
+      std::cerr << "cannot resize " << _path << ", caching in memory" << std::endl;
+      close(fd);
+      return false;
+    }
+    void *mapped = mmap(nullptr, bytes, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mapped == MAP_FAILED) {
+      std::cerr << "cannot map " << _path << ", caching in memory" << std::endl;
+      return false;
+    }
+    _mapped = mapped;
+    _mappedBytes = bytes;
+    if(!reuse) std::memcpy(_mapped, &expected, sizeof(expected));
+    _filled = static_cast<uint8_t *>(_mapped) + headerBytes;
+    _rows = reinterpret_cast<S *>(_filled + filledBytes);
+    return true;
+  }
+};
+
+/*
+ * FNV-1a over the weights of the frozen prefix of net, the input scale and
+ * the images and labels of set, for reusing an ActivationCache file only with
+ * the same frozen layers and data; 0 if the prefix holds layers other than dense ones, whose
+ * weights are not visible here.
+ */
+template <class S>
+uint64_t activationCacheKey(const Network<S> &net, MNistDataSet &set, S inputScale) {
+  uint64_t hash = 14695981039346656037ull;
+  auto add = [&hash](const void *data, size_t bytes) {
+    for(size_t k = 0; k < bytes; k++) {
+      hash = (hash ^ static_cast<const uint8_t *>(data)[k]) * 1099511628211ull;
+    }
+  };
+  for(size_t l = 0; l < net.getNumFrozen(); l++) {
+    std::shared_ptr<Layer<S>> layer = std::dynamic_pointer_cast<Layer<S>>(net.getLayer(l));
+    if(!layer) return 0;
+    const int activation = static_cast<int>(layer->_activationType);
+    add(&activation, sizeof(activation));
+    for(const auto &row : layer->_w) add(row.data(), row.size() * sizeof(S));
+  }
+  add(&inputScale, sizeof(S));
+  TensorView<const uint8_t> images = set.getImages();
+  add(images.data(), images.size());
+  for(uint32_t sample = 0; sample < set.getNumImages(); sample++) {
+    const uint8_t label = set.getLabel(sample);
+    add(&label, 1);
+  }
+  return hash == 0 ? 1 : hash;
+}
+
+/*
+ * Forward function for runEpoch that runs the frozen prefix of net on the raw
+ * image only the first time a sample is seen and the trainable suffix always.
+ */
+template <class S>
+ForwardFunctionT<S> cachedForward(ActivationCache<S> &cache) {
+  return [&cache](Network<S> &net, MNistDataSet &set, uint32_t sample) {
+    const size_t numFrozen = net.getNumFrozen();
+    if(numFrozen == 0) {
+      return net.forward(set.getImage(sample), cache.getInputScale());
+    }
+    if(!cache.isFilled(sample)) {
+      cache.store(sample, net.forward(set.getImage(sample), cache.getInputScale(), numFrozen));
+    }
+    return net.forward(cache.load(sample), numFrozen, net.getNumLayers());
+  };
+}
+
+/* cache sized for the output of the frozen prefix of net on every sample of set, reusing the rows in path if it was filled for the same prefix and set */
+template <class S>
+std::shared_ptr<ActivationCache<S>> makeActivationCache(const Network<S> &net, MNistDataSet &set, const std::string &path = "", S inputScale = static_cast<S>(1.0 / 256)) {
+  const size_t numFrozen = net.getNumFrozen();
+  const size_t width = numFrozen > 0 ? net.getLayer(numFrozen - 1)->_outSize : set.getNumRows() * set.getNumColumns();
+  return std::make_shared<ActivationCache<S> >(set.getNumImages(), width, path, path.empty() ? 0 : activationCacheKey(net, set, inputScale), inputScale);
+}
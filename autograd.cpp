@@ -0,0 +1,751 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <utility>
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#include <numeric>
+#include <cmath>
+
+#include "neural_net.cpp"
+#include "mnist.cpp"
+#include "trainer.cpp"
+
+/* trainable tensor of a Graph, row-major rows x cols */
+template <class S>
+struct GraphParam {
+  size_t _rows, _cols;
+  std::vector<S> _value, _grad;
+
+  GraphParam(size_t rows, size_t cols, S limit) :
+    _rows(rows),
+    _cols(cols),
+    _value(rows * cols, 0),
+    _grad(rows * cols, 0)
+  {
+    if(limit == 0) return;
+    RandomGenerator<S> rg(-limit, limit);
+    for(S &w : _value) w = rg.rand();
+  }
+};
+
+/* result of Graph::compile */
+struct MemoryPlan {
+  size_t numBuffers; /* intermediate values and gradients */
+  size_t numSlots; /* arena slots they were assigned to */
+  size_t arenaElements;
+  size_t unplannedElements; /* one buffer each */
+};
+
+/*
+ * Reverse-mode autograd over a static graph. The ops are recorded once, in
+ * topological order, by the builder functions, which return node ids;
+ * compile() then plans memory for the forward values and backward gradients
+ * of one training step. With N nodes, node k runs forward at time k and
+ * backward at time 2N - 1 - k; every buffer lives from its first write to
+ * its last read, and buffers whose lifetimes do not overlap share an arena
+ * slot, so the inputs have to be set again before every forward. forward()
+ * and backward() work on the arena and the parameters only, on the calling
+ * thread, so a step allocates nothing.
+ *
+ * Values are vectors; parameters are matrices (matmul) or vectors (add).
+ * Any DAG works: a value may feed several ops, whose gradients add up.
+ */
+template <class S>
+class Graph {
+public:
+  enum class Op {
+    INPUT,
+    PARAM,
+    MATMUL, /* a: vector of size rows, b: rows x cols param */
+    ADD,
+    RELU,
+    SIGMOID,
+    SOFTMAX,
+    CROSS_ENTROPY, /* a: probabilities, b: target input, scalar loss */
+    DROPOUT, /* identity unless training */
+    BATCHNORM, /* inference form, b: 4 x size param of gamma, beta, mean, var rows */
+    DENSE, /* fused matmul(a, b) + bias c (-1: none), epilogue and dropout */
+    SOFTMAX_CROSS_ENTROPY /* a: logits, b: target input, value: probabilities */
+  };
+
+  enum class Epilogue {
+    NONE,
+    RELU,
+    SIGMOID
+  };
+
+  struct Node {
+    Op _op;
+    int _a, _b, _c;
+    size_t _size;
+    int _param; /* index into _params for PARAM */
+    Epilogue _epilogue; /* DENSE */
+    float _rate; /* dropout rate of DROPOUT and DENSE */
+    uint64_t _seed; /* dropout mask seed, kept by the graph optimizer */
+    bool _requiresGrad; /* a parameter is upstream */
+    int _value, _grad; /* buffer ids, -1 if none */
+  };
+
+  static bool isLoss(Op op) {
+    return op == Op::CROSS_ENTROPY || op == Op::SOFTMAX_CROSS_ENTROPY;
+  }
+
+  /* whether the gradient of consumer flows back into its operand n */
+  static bool flowsTo(const Node &consumer, int n) {
+    return consumer._a == n || (consumer._b == n && !isLoss(consumer._op)) || consumer._c == n;
+  }
+
+  static S batchNormEpsilon() {
+    return static_cast<S>(1e-5);
+  }
+private:
+  struct Buffer {
+    size_t _size;
+    int _def, _lastUse;
+    int _slot;
+    size_t _offset;
+  };
+
+  std::vector<Node> _nodes;
+  std::vector<GraphParam<S> > _params;
+  std::vector<int> _outputs;
+  int _loss;
+  bool _valid;
+  std::vector<Buffer> _buffers;
+  std::vector<std::vector<int> > _zeroAt; /* per node: gradient buffers first written by its backward */
+  std::vector<S> _arena;
+  MemoryPlan _plan;
+  size_t _sampleCount;
+  bool _training; /* dropout on */
+  uint64_t _step; /* forward count, part of the dropout masks */
+  S _lossValue;
+
+  int addNode(Op op, int a, int b, size_t size, int param = -1, int c = -1) {
+    Node node{op, a, b, c, size, param, Epilogue::NONE, 0, _nodes.size(), op == Op::PARAM, -1, -1};
+    for(int operand : {a, b, c}) {
+      if(operand >= 0 && flowsTo(node, operand)) node._requiresGrad = node._requiresGrad || _nodes[operand]._requiresGrad;
+    }
+    _nodes.push_back(node);
+    return _nodes.size() - 1;
+  }
+
+  bool dropoutKeep(const Node &node, size_t i) const {
+    uint64_t h = node._seed * 0x9e3779b97f4a7c15ull ^ (_step << 32) ^ i;
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+    h ^= h >> 31;
+    return (h >> 11) * (1.0 / 9007199254740992.0) >= node._rate;
+  }
+
+  bool check(bool ok, const std::string &what) {
+    if(!ok) {
+      std::cerr << "Graph: " << what << std::endl;
+      _valid = false;
+    }
+    return ok;
+  }
+
+  bool isNode(int n) const {
+    return n >= 0 && n < static_cast<int>(_nodes.size());
+  }
+
+  int backwardTime(int n) const {
+    return 2 * _nodes.size() - 1 - n;
+  }
+
+  int newBuffer(size_t size, int def) {
+    _buffers.push_back(Buffer{size, def, def, -1, 0});
+    return _buffers.size() - 1;
+  }
+
+  void use(int buffer, int time) {
+    if(buffer >= 0) _buffers[buffer]._lastUse = std::max(_buffers[buffer]._lastUse, time);
+  }
+
+  /* greedy interval assignment in order of first write, best fit among the free slots */
+  void assignSlots() {
+    std::vector<int> order(_buffers.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [this](int x, int y) {return _buffers[x]._def < _buffers[y]._def;});
+    std::vector<size_t> slotSizes;
+    std::vector<int> slotLastUse; /* -1: never used */
+    for(int b : order) {
+      Buffer &buffer = _buffers[b];
+      int best = -1;
+      for(size_t s = 0; s < slotSizes.size(); s++) {
+	if(slotLastUse[s] >= buffer._def) continue;
+	if(best < 0) {
+	  best = s;
+	  continue;
+	}
+	const bool fits = slotSizes[s] >= buffer._size, bestFits = slotSizes[best] >= buffer._size;
+	if((fits && (!bestFits || slotSizes[s] < slotSizes[best])) || (!fits && !bestFits && slotSizes[s] > slotSizes[best])) best = s;
+      }
+      if(best < 0) {
+	best = slotSizes.size();
+	slotSizes.push_back(0);
+	slotLastUse.push_back(-1);
+      }
+      slotSizes[best] = std::max(slotSizes[best], buffer._size);
+      slotLastUse[best] = buffer._lastUse;
+      buffer._slot = best;
+    }
+    std::vector<size_t> slotOffsets(slotSizes.size(), 0);
+    size_t offset = 0;
+    for(size_t s = 0; s < slotSizes.size(); s++) {
+      slotOffsets[s] = offset;
+      offset += (slotSizes[s] + 15) / 16 * 16;
+    }
+    _plan = MemoryPlan{_buffers.size(), slotSizes.size(), offset, 0};
+    for(Buffer &buffer : _buffers) {
+      buffer._offset = slotOffsets[buffer._slot];
+      _plan.unplannedElements += buffer._size;
+    }
+  }
+
+  S *grad(int n) {
+    const Node &node = _nodes[n];
+    if(node._op == Op::PARAM) return _params[node._param]._grad.data();
+    return node._grad >= 0 ? _arena.data() + _buffers[node._grad]._offset : nullptr;
+  }
+public:
+  Graph() :
+    _loss(-1),
+    _valid(true),
+    _sampleCount(0),
+    _training(true),
+    _step(0),
+    _lossValue(0)
+  {
+  }
+
+  int input(size_t size) {
+    return addNode(Op::INPUT, -1, -1, size);
+  }
+
+  /* parameter initialized uniformly in [-limit, limit], zero for limit 0 */
+  int param(size_t rows, size_t cols, S limit = 0) {
+    _params.push_back(GraphParam<S>(rows, cols, limit));
+    return addNode(Op::PARAM, -1, -1, rows * cols, _params.size() - 1);
+  }
+
+  int matmul(int x, int w) {
+    if(!check(isNode(x) && isNode(w) && _nodes[w]._op == Op::PARAM, "matmul needs a value and a parameter")) return -1;
+    const GraphParam<S> &p = _params[_nodes[w]._param];
+    if(!check(_nodes[x]._size == p._rows, "matmul size mismatch")) return -1;
+    return addNode(Op::MATMUL, x, w, p._cols);
+  }
+
+  int add(int a, int b) {
+    if(!check(isNode(a) && isNode(b) && _nodes[a]._size == _nodes[b]._size, "add size mismatch")) return -1;
+    return addNode(Op::ADD, a, b, _nodes[a]._size);
+  }
+
+  int relu(int a) {
+    return check(isNode(a), "relu of unknown node") ? addNode(Op::RELU, a, -1, _nodes[a]._size) : -1;
+  }
+
+  int sigmoid(int a) {
+    return check(isNode(a), "sigmoid of unknown node") ? addNode(Op::SIGMOID, a, -1, _nodes[a]._size) : -1;
+  }
+
+  int softmax(int a) {
+    return check(isNode(a), "softmax of unknown node") ? addNode(Op::SOFTMAX, a, -1, _nodes[a]._size) : -1;
+  }
+
+  /* the graph's loss; target must be an input */
+  int crossEntropy(int p, int target) {
+    if(!check(isNode(p) && isNode(target) && _nodes[target]._op == Op::INPUT && _nodes[p]._size == _nodes[target]._size, "cross entropy needs probabilities and a target input of the same size")) return -1;
+    if(!check(_loss < 0, "only one loss per graph")) return -1;
+    _loss = addNode(Op::CROSS_ENTROPY, p, target, 1);
+    return _loss;
+  }
+
+  /* zeroes each element with probability rate while training and scales the rest by 1 / (1 - rate) */
+  int dropout(int a, float rate) {
+    if(!check(isNode(a) && rate >= 0 && rate < 1, "dropout needs a node and a rate in [0, 1)")) return -1;
+    int n = addNode(Op::DROPOUT, a, -1, _nodes[a]._size);
+    _nodes[n]._rate = rate;
+    return n;
+  }
+
+  /* gamma * (a - mean) / sqrt(var + eps) + beta with the rows of p */
+  int batchNorm(int a, int p) {
+    if(!check(isNode(a) && isNode(p) && _nodes[p]._op == Op::PARAM && _params[_nodes[p]._param]._rows == 4 && _params[_nodes[p]._param]._cols == _nodes[a]._size, "batch norm needs a value and a 4 x size parameter")) return -1;
+    return addNode(Op::BATCHNORM, a, p, _nodes[a]._size);
+  }
+
+  /* the fused forms produced by graph_optimizer.cpp */
+  int dense(int x, int w, int bias, Epilogue epilogue, float rate, uint64_t seed) {
+    int n = matmul(x, w);
+    if(n < 0 || !check(bias < 0 || (isNode(bias) && _nodes[bias]._size == _nodes[n]._size), "dense bias size mismatch")) return -1;
+    Node &node = _nodes[n];
+    node._op = Op::DENSE;
+    node._c = bias;
+    node._epilogue = epilogue;
+    node._rate = rate;
+    node._seed = seed;
+    if(bias >= 0) node._requiresGrad = node._requiresGrad || _nodes[bias]._requiresGrad;
+    return n;
+  }
+
+  int softmaxCrossEntropy(int logits, int target) {
+    if(!check(isNode(logits) && isNode(target) && _nodes[target]._op == Op::INPUT && _nodes[logits]._size == _nodes[target]._size, "softmax cross entropy needs logits and a target input of the same size")) return -1;
+    if(!check(_loss < 0, "only one loss per graph")) return -1;
+    _loss = addNode(Op::SOFTMAX_CROSS_ENTROPY, logits, target, _nodes[logits]._size);
+    return _loss;
+  }
+
+  /* appends a PARAM node holding a copy of param */
+  int addParamCopy(const GraphParam<S> &param) {
+    _params.push_back(param);
+    return addNode(Op::PARAM, -1, -1, param._rows * param._cols, _params.size() - 1);
+  }
+
+  /* appends node, other than PARAM (see addParamCopy), with its attributes and new operands */
+  int addCopy(const Node &node, int a, int b, int c) {
+    if(!check(node._op != Op::PARAM, "parameters are copied with addParamCopy")) return -1;
+    int n = addNode(node._op, a, b, node._size, -1, c);
+    _nodes[n]._epilogue = node._epilogue;
+    _nodes[n]._rate = node._rate;
+    _nodes[n]._seed = node._seed;
+    if(isLoss(node._op)) _loss = n;
+    return n;
+  }
+
+  /* keeps node's value readable between forward and backward */
+  void markOutput(int n) {
+    if(check(isNode(n), "output of unknown node")) _outputs.push_back(n);
+  }
+
+  size_t getNumNodes() const {
+    return _nodes.size();
+  }
+
+  const Node &getNode(int n) const {
+    return _nodes[n];
+  }
+
+  GraphParam<S> &getParam(int n) {
+    return _params[_nodes[n]._param];
+  }
+
+  const GraphParam<S> &getParam(int n) const {
+    return _params[_nodes[n]._param];
+  }
+
+  const std::vector<int> &getOutputs() const {
+    return _outputs;
+  }
+
+  int getLoss() const {
+    return _loss;
+  }
+
+  bool isTraining() const {
+    return _training;
+  }
+
+  void setTraining(bool training) {
+    _training = training;
+  }
+
+  uint64_t getStep() const {
+    return _step;
+  }
+
+  void setStep(uint64_t step) {
+    _step = step;
+  }
+
+  const MemoryPlan &getMemoryPlan() const {
+    return _plan;
+  }
+
+  /* plans the buffers and allocates the arena; false if the recorded graph is invalid */
+  bool compile() {
+    if(!_valid) return false;
+    const int numNodes = _nodes.size();
+    _buffers.clear();
+    _zeroAt.assign(numNodes, std::vector<int>());
+
+    /* a gradient is needed where a parameter is upstream and the loss downstream */
+    std::vector<bool> reachesLoss(numNodes, false);
+    if(_loss >= 0) reachesLoss[_loss] = true;
+    for(int n = numNodes - 1; n >= 0; n--) {
+      const Node &node = _nodes[n];
+      if(!reachesLoss[n]) continue;
+      for(int operand : {node._a, node._b, node._c}) {
+	if(operand >= 0 && flowsTo(node, operand)) reachesLoss[operand] = true;
+      }
+    }
+
+    for(int n = 0; n < numNodes; n++) {
+      Node &node = _nodes[n];
+      node._value = node._grad = -1;
+      if(node._op != Op::PARAM) node._value = newBuffer(node._size, node._op == Op::INPUT ? 0 : n);
+    }
+    for(int n = 0; n < numNodes; n++) {
+      const Node &node = _nodes[n];
+      for(int operand : {node._a, node._b, node._c}) {
+	use(operand >= 0 ? _nodes[operand]._value : -1, n);
+      }
+    }
+    for(int n : _outputs) {
+      use(_nodes[n]._value, numNodes);
+    }
+    for(int n = numNodes - 1; n >= 0; n--) {
+      Node &node = _nodes[n];
+      if(node._op == Op::PARAM || !node._requiresGrad || !reachesLoss[n] || isLoss(node._op)) continue;
+      /* first written by the backward of the last consumer, read by its own backward */
+      int lastConsumer = -1;
+      for(int c = numNodes - 1; c > n && lastConsumer < 0; c--) {
+	if(reachesLoss[c] && flowsTo(_nodes[c], n)) lastConsumer = c;
+      }
+      node._grad = newBuffer(node._size, backwardTime(lastConsumer));
+      use(node._grad, backwardTime(n));
+      _zeroAt[lastConsumer].push_back(node._grad);
+    }
+    /* values read by backward */
+    for(int n = 0; n < numNodes; n++) {
+      const Node &node = _nodes[n];
+      if(!reachesLoss[n] || !node._requiresGrad) continue;
+      switch(node._op) {
+      case Op::MATMUL:
+      case Op::BATCHNORM:
+	use(_nodes[node._a]._value, backwardTime(n));
+	break;
+      case Op::DENSE:
+	use(_nodes[node._a]._value, backwardTime(n));
+	use(node._value, backwardTime(n));
+	break;
+      case Op::RELU:
+      case Op::SIGMOID:
+      case Op::SOFTMAX:
+	use(node._value, backwardTime(n));
+	break;
+      case Op::CROSS_ENTROPY:
+	use(_nodes[node._a]._value, backwardTime(n));
+	use(_nodes[node._b]._value, backwardTime(n));
+	break;
+      case Op::SOFTMAX_CROSS_ENTROPY:
+	use(node._value, backwardTime(n));
+	use(_nodes[node._b]._value, backwardTime(n));
+	break;
+      default:
+	break;
+      }
+    }
+    assignSlots();
+    _arena.assign(_plan.arenaElements, 0);
+    return true;
+  }
+
+  S *value(int n) {
+    const Node &node = _nodes[n];
+    if(node._op == Op::PARAM) return _params[node._param]._value.data();
+    return _arena.data() + _buffers[node._value]._offset;
+  }
+
+  void setInput(int n, const std::vector<S> &data) {
+    std::copy(data.begin(), data.end(), value(n));
+  }
+
+  void setInput(int n, TensorView<const uint8_t> data, S scale) {
+    S *x = value(n);
+    for(size_t i = 0; i < data.size(); i++) {
+      x[i] = static_cast<S>(data[i]) * scale;
+    }
+  }
+
+  void setOneHot(int n, size_t label) {
+    S *x = value(n);
+    std::fill(x, x + _nodes[n]._size, static_cast<S>(0));
+    x[label] = 1;
+  }
+
+  /* runs every node after the inputs are set; returns the loss, 0 without one */
+  S forward() {
+    using std::exp;
+    using std::log;
+    using std::sqrt;
+    if(_training) _step++;
+    for(size_t n = 0; n < _nodes.size(); n++) {
+      const Node &node = _nodes[n];
+      if(node._op == Op::INPUT || node._op == Op::PARAM) continue;
+      S *y = value(n);
+      const S *a = value(node._a);
+      const size_t size = node._size;
+      switch(node._op) {
+      case Op::MATMUL:
+      case Op::DENSE: {
+	const GraphParam<S> &w = _params[_nodes[node._b]._param];
+	std::fill(y, y + size, static_cast<S>(0));
+	for(size_t i = 0; i < w._rows; i++) {
+	  const S x = a[i];
+	  if(x == 0) continue;
+	  const S *row = w._value.data() + i * w._cols;
+	  for(size_t j = 0; j < size; j++) y[j] += x * row[j];
+	}
+	if(node._op == Op::MATMUL) break;
+	/* epilogue on the accumulator while it is hot */
+	const S *bias = node._c >= 0 ? value(node._c) : nullptr;
+	const bool drop = _training && node._rate > 0;
+	const S keepScale = static_cast<S>(1 / (1 - node._rate));
+	for(size_t j = 0; j < size; j++) {
+	  S u = bias ? y[j] + bias[j] : y[j];
+	  if(node._epilogue == Epilogue::RELU) {
+	    u = u > 0 ? u : 0;
+	  }else if(node._epilogue == Epilogue::SIGMOID) {
+	    u = static_cast<S>(1) / (static_cast<S>(1) + exp(-u));
+	  }
+	  if(drop) u = dropoutKeep(node, j) ? u * keepScale : 0;
+	  y[j] = u;
+	}
+	break;
+      }
+      case Op::DROPOUT: {
+	const bool drop = _training && node._rate > 0;
+	const S keepScale = static_cast<S>(1 / (1 - node._rate));
+	for(size_t i = 0; i < size; i++) y[i] = !drop ? a[i] : dropoutKeep(node, i) ? a[i] * keepScale : 0;
+	break;
+      }
+      case Op::BATCHNORM: {
+	const GraphParam<S> &p = _params[_nodes[node._b]._param];
+	const S *gamma = p._value.data(), *beta = gamma + size, *mean = beta + size, *var = mean + size;
+	for(size_t i = 0; i < size; i++) y[i] = gamma[i] * (a[i] - mean[i]) / sqrt(var[i] + batchNormEpsilon()) + beta[i];
+	break;
+      }
+      case Op::ADD: {
+	const S *b = value(node._b);
+	for(size_t i = 0; i < size; i++) y[i] = a[i] + b[i];
+	break;
+      }
+      case Op::RELU:
+	for(size_t i = 0; i < size; i++) y[i] = a[i] > 0 ? a[i] : 0;
+	break;
+      case Op::SIGMOID:
+	for(size_t i = 0; i < size; i++) y[i] = static_cast<S>(1) / (static_cast<S>(1) + exp(-a[i]));
+	break;
+      case Op::SOFTMAX: {
+	const S max = *std::max_element(a, a + size);
+	S sum = 0;
+	for(size_t i = 0; i < size; i++) sum += y[i] = exp(a[i] - max);
+	for(size_t i = 0; i < size; i++) y[i] /= sum;
+	break;
+      }
+      case Op::CROSS_ENTROPY: {
+	const S *t = value(node._b);
+	S loss = 0;
+	for(size_t i = 0; i < _nodes[node._a]._size; i++) {
+	  if(t[i] != 0) loss -= t[i] * log(a[i]);
+	}
+	y[0] = _lossValue = loss;
+	break;
+      }
+      case Op::SOFTMAX_CROSS_ENTROPY: {
+	const S *t = value(node._b);
+	const S max = *std::max_element(a, a + size);
+	S sum = 0;
+	for(size_t i = 0; i < size; i++) sum += y[i] = exp(a[i] - max);
+	S loss = 0;
+	for(size_t i = 0; i < size; i++) {
+	  y[i] /= sum;
+	  if(t[i] != 0) loss -= t[i] * log(y[i]);
+	}
+	_lossValue = loss;
+	break;
+      }
+      default:
+	break;
+      }
+    }
+    return _loss >= 0 ? _lossValue : 0;
+  }
+
+  /* accumulates the parameter gradients of the last forward, scaled by weight */
+  void backward(S weight = static_cast<S>(1)) {
+    using std::sqrt;
+    if(_loss < 0) return;
+    for(int n = _loss; n >= 0; n--) {
+      for(int buffer : _zeroAt[n]) {
+	S *g = _arena.data() + _buffers[buffer]._offset;
+	std::fill(g, g + _buffers[buffer]._size, static_cast<S>(0));
+      }
+      const Node &node = _nodes[n];
+      if(node._op == Op::INPUT || node._op == Op::PARAM || (n != _loss && node._grad < 0)) continue;
+      S *gy = n == _loss ? nullptr : grad(n);
+      S *ga = node._a >= 0 ? grad(node._a) : nullptr;
+      const size_t size = node._size;
+      if(!ga && node._op != Op::MATMUL && node._op != Op::ADD && node._op != Op::DENSE && node._op != Op::BATCHNORM) continue;
+      switch(node._op) {
+      case Op::DENSE: {
+	/* back through dropout and the epilogue in place: the gradient buffer is not read again */
+	const S *y = value(n);
+	const bool drop = _training && node._rate > 0;
+	const S keepScale = static_cast<S>(1 / (1 - node._rate));
+	for(size_t j = 0; j < size; j++) {
+	  if(drop && !dropoutKeep(node, j)) {
+	    gy[j] = 0;
+	    continue;
+	  }
+	  const S scale = drop ? keepScale : static_cast<S>(1);
+	  if(node._epilogue == Epilogue::RELU) {
+	    gy[j] = y[j] > 0 ? gy[j] * scale : 0;
+	  }else if(node._epilogue == Epilogue::SIGMOID) {
+	    const S u = y[j] / scale;
+	    gy[j] *= scale * u * (1 - u);
+	  }else {
+	    gy[j] *= scale;
+	  }
+	}
+	if(node._c >= 0) {
+	  S *gb = grad(node._c);
+	  if(gb) {
+	    for(size_t j = 0; j < size; j++) gb[j] += gy[j];
+	  }
+	}
+      }
+	/* fall through */
+      case Op::MATMUL: {
+	GraphParam<S> &w = _params[_nodes[node._b]._param];
+	const S *x = value(node._a);
+	for(size_t i = 0; i < w._rows; i++) {
+	  const S *row = w._value.data() + i * w._cols;
+	  S *growRow = w._grad.data() + i * w._cols;
+	  const S xi = x[i];
+	  if(ga) {
+	    S sum = 0;
+	    for(size_t j = 0; j < size; j++) sum += gy[j] * row[j];
+	    ga[i] += sum;
+	  }
+	  if(xi == 0) continue;
+	  for(size_t j = 0; j < size; j++) growRow[j] += xi * gy[j];
+	}
+	break;
+      }
+      case Op::ADD: {
+	S *gb = grad(node._b);
+	for(size_t i = 0; i < size; i++) {
+	  if(ga) ga[i] += gy[i];
+	  if(gb) gb[i] += gy[i];
+	}
+	break;
+      }
+      case Op::DROPOUT: {
+	const bool drop = _training && node._rate > 0;
+	const S keepScale = static_cast<S>(1 / (1 - node._rate));
+	for(size_t i = 0; i < size; i++) {
+	  if(!drop) {
+	    ga[i] += gy[i];
+	  }else if(dropoutKeep(node, i)) {
+	    ga[i] += gy[i] * keepScale;
+	  }
+	}
+	break;
+      }
+      case Op::BATCHNORM: {
+	GraphParam<S> &p = _params[_nodes[node._b]._param];
+	const S *gamma = p._value.data(), *mean = gamma + 2 * size, *var = gamma + 3 * size;
+	S *gGamma = p._grad.data(), *gBeta = gGamma + size;
+	const S *x = value(node._a);
+	for(size_t i = 0; i < size; i++) {
+	  const S invStd = 1 / sqrt(var[i] + batchNormEpsilon());
+	  gGamma[i] += gy[i] * (x[i] - mean[i]) * invStd;
+	  gBeta[i] += gy[i];
+	  if(ga) ga[i] += gy[i] * gamma[i] * invStd;
+	}
+	break;
+      }
+      case Op::RELU: {
+	const S *y = value(n);
+	for(size_t i = 0; i < size; i++) {
+	  if(y[i] > 0) ga[i] += gy[i];
+	}
+	break;
+      }
+      case Op::SIGMOID: {
+	const S *y = value(n);
+	for(size_t i = 0; i < size; i++) ga[i] += gy[i] * y[i] * (1 - y[i]);
+	break;
+      }
+      case Op::SOFTMAX: {
+	const S *y = value(n);
+	S dot = 0;
+	for(size_t i = 0; i < size; i++) dot += gy[i] * y[i];
+	for(size_t i = 0; i < size; i++) ga[i] += y[i] * (gy[i] - dot);
+	break;
+      }
+      case Op::CROSS_ENTROPY: {
+	const S *p = value(node._a), *t = value(node._b);
+	for(size_t i = 0; i < _nodes[node._a]._size; i++) {
+	  if(t[i] != 0) ga[i] -= weight * t[i] / p[i];
+	}
+	break;
+      }
+      case Op::SOFTMAX_CROSS_ENTROPY: {
+	/* the target sums to one */
+	const S *y = value(n), *t = value(node._b);
+	for(size_t i = 0; i < size; i++) ga[i] += weight * (y[i] - t[i]);
+	break;
+      }
+      default:
+	break;
+      }
+    }
+    _sampleCount++;
+  }
+
+  /* plain SGD on the mean gradient since the last update, as Layer::updateParam */
+  void updateParam(S learningRate) {
+    if(_sampleCount == 0) return;
+    for(GraphParam<S> &p : _params) {
+      for(size_t i = 0; i < p._value.size(); i++) {
+	p._value[i] -= p._grad[i] * learningRate / _sampleCount;
+	p._grad[i] = 0;
+      }
+    }
+    _sampleCount = 0;
+  }
+
+  size_t memoryBytes() const {
+    size_t bytes = vectorBytes(_arena);
+    for(const GraphParam<S> &p : _params) bytes += vectorBytes(p._value) + vectorBytes(p._grad);
+    return bytes;
+  }
+};
+
+/* runEpoch for a compiled graph: image bytes into input, one-hot label into target, prediction from output */
+template <class S>
+std::pair<double, double> runGraphEpoch(Graph<S> &graph, MNistDataSet &set, int input, int target, int output, bool train, double learningRate = 0.1, int batchSize = 100) {
+  int numWrong = 0;
+  double sumLoss = 0;
+  double batchLoss = 0;
+  int batchId = 0;
+  const size_t numClasses = graph.getNode(output)._size;
+  for(uint32_t sample = 0; sample < set.getNumImages(); sample++) {
+    graph.setInput(input, set.getImage(sample), static_cast<S>(1.0 / 256));
+    graph.setOneHot(target, set.getLabel(sample));
+    const double sampleLoss = static_cast<double>(graph.forward());
+    const S *out = graph.value(output);
+    numWrong += std::distance(out, std::max_element(out, out + numClasses)) != set.getLabel(sample);
+    sumLoss += sampleLoss;
+    batchLoss += sampleLoss;
+    if(train) {
+      graph.backward();
+      if(sample % batchSize == 0 || sample == set.getNumImages() - 1) {
+	if(progressEnabled()) {
+	  std::cout << std::fixed << std::setprecision(4) << "\rbatch loss[" << batchId << "]: " << batchLoss / batchSize;
+	  std::cout.flush();
+	}
+	batchLoss = 0;
+	batchId++;
+	graph.updateParam(static_cast<S>(learningRate));
+      }
+    }
+  }
+  return std::make_pair(sumLoss / set.getNumImages(), static_cast<double>(numWrong) / set.getNumImages());
+}
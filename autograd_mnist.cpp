@@ -0,0 +1,123 @@
+#define NN_TRACK_ALLOCATIONS
+#include <utility>
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+
+#include "autograd.cpp"
+#include "trainer.cpp"
+
+/* dense layer x W + b with the weights of layer (bias in its last row) */
+int addDense(Graph<float> &graph, int x, const Layer<float> &layer, int &w, int &b) {
+  const size_t in = layer._inSize - 1, out = layer._outSize;
+  w = graph.param(in, out);
+  b = graph.param(1, out);
+  for(size_t i = 0; i < in; i++) {
+    std::copy(layer._w[i].begin(), layer._w[i].end(), graph.getParam(w)._value.begin() + i * out);
+  }
+  std::copy(layer._w[in].begin(), layer._w[in].end(), graph.getParam(b)._value.begin());
+  return graph.add(graph.matmul(x, w), b);
+}
+
+float maxDifference(Graph<float> &graph, int w, int b, const Layer<float> &layer) {
+  const size_t in = layer._inSize - 1, out = layer._outSize;
+  float maxDiff = 0;
+  for(size_t i = 0; i <= in; i++) {
+    const float *row = i < in ? graph.getParam(w)._value.data() + i * out : graph.getParam(b)._value.data();
+    for(size_t j = 0; j < out; j++) maxDiff = std::max(maxDiff, std::abs(row[j] - layer._w[i][j]));
+  }
+  return maxDiff;
+}
+
+/* largest difference between backward and central differences on a small DAG with fan-out */
+double gradientCheck() {
+  Graph<double> graph;
+  int x = graph.input(5), t = graph.input(3);
+  int w1 = graph.param(5, 4, 1.0), w2 = graph.param(4, 4, 1.0), w3 = graph.param(4, 3, 1.0), b = graph.param(1, 4, 1.0);
+  int h = graph.sigmoid(graph.add(graph.matmul(x, w1), b));
+  int k = graph.relu(graph.matmul(h, w2));
+  graph.crossEntropy(graph.softmax(graph.matmul(graph.add(h, k), w3)), t);
+  if(!graph.compile()) return 1;
+  auto forward = [&]() {
+    graph.setInput(x, std::vector<double>{0.5, -1, 0.25, 2, -0.75});
+    graph.setOneHot(t, 1);
+    return graph.forward();
+  };
+  forward();
+  graph.backward();
+  double maxDiff = 0;
+  for(int p : {w1, w2, w3, b}) {
+    GraphParam<double> &param = graph.getParam(p);
+    for(size_t i = 0; i < param._value.size(); i++) {
+      const double saved = param._value[i], eps = 1e-6;
+      param._value[i] = saved + eps;
+      const double plus = forward();
+      param._value[i] = saved - eps;
+      const double minus = forward();
+      param._value[i] = saved;
+      maxDiff = std::max(maxDiff, std::abs((plus - minus) / (2 * eps) - param._grad[i]));
+    }
+  }
+  return maxDiff;
+}
+
+void printPlan(const MemoryPlan &plan) {
+  std::cout << plan.numBuffers << " buffers in " << plan.numSlots << " arena slots, " << plan.arenaElements
+	    << " elements instead of " << plan.unplannedElements << std::endl;
+}
+
+int main(int argc, char **argv) {
+  int hiddenSize = argc > 1 ? std::atoi(argv[1]) : 300;
+  int numEpochs = argc > 2 ? std::atoi(argv[2]) : 3;
+
+  MNistDataSet trainSet("mnist/train-images-idx3-ubyte", "mnist/train-labels-idx1-ubyte");
+  MNistDataSet testSet("mnist/t10k-images-idx3-ubyte", "mnist/t10k-labels-idx1-ubyte");
+  const size_t imageSize = trainSet.getNumRows() * trainSet.getNumColumns();
+
+  /* the same MLP as a Network and as a graph: one epoch of each should end with the same weights */
+  Network<float> net;
+  net.addLayer(imageSize, hiddenSize, Layer<float>::ActivationType::RELU);
+  net.addLayer(hiddenSize, 10, Layer<float>::ActivationType::SOFTMAX);
+  auto &layer0 = dynamic_cast<Layer<float> &>(*net.getLayer(0)), &layer1 = dynamic_cast<Layer<float> &>(*net.getLayer(1));
+  Graph<float> mlp;
+  int input = mlp.input(imageSize), target = mlp.input(10);
+  int w0, b0, w1, b1;
+  int hidden = mlp.relu(addDense(mlp, input, layer0, w0, b0));
+  int output = mlp.softmax(addDense(mlp, hidden, layer1, w1, b1));
+  mlp.crossEntropy(output, target);
+  mlp.markOutput(output);
+  if(!mlp.compile()) return 1;
+  std::cout << "mlp: ";
+  printPlan(mlp.getMemoryPlan());
+  runEpoch(net, trainSet, true, 0.2);
+  runGraphEpoch(mlp, trainSet, input, target, output, true, 0.2);
+  std::cout << std::endl << std::scientific << std::setprecision(2) << "max weight difference to Network: "
+	    << std::max(maxDifference(mlp, w0, b0, layer0), maxDifference(mlp, w1, b1, layer1))
+	    << ", max gradient error on a small DAG: " << gradientCheck() << std::endl;
+
+  /* a DAG: two hidden layers with a skip connection around the second */
+  Graph<float> dag;
+  input = dag.input(imageSize);
+  target = dag.input(10);
+  w0 = dag.param(imageSize, hiddenSize, std::sqrt(6.0f / imageSize));
+  b0 = dag.param(1, hiddenSize);
+  w1 = dag.param(hiddenSize, hiddenSize, std::sqrt(6.0f / hiddenSize));
+  b1 = dag.param(1, hiddenSize);
+  int w2 = dag.param(hiddenSize, 10, std::sqrt(6.0f / hiddenSize)), b2 = dag.param(1, 10);
+  int h1 = dag.relu(dag.add(dag.matmul(input, w0), b0));
+  int h2 = dag.relu(dag.add(dag.matmul(h1, w1), b1));
+  output = dag.softmax(dag.add(dag.matmul(dag.add(h1, h2), w2), b2));
+  dag.crossEntropy(output, target);
+  dag.markOutput(output);
+  if(!dag.compile()) return 1;
+  std::cout << "residual dag: ";
+  printPlan(dag.getMemoryPlan());
+  for(int epoch = 0; epoch < numEpochs; epoch++) {
+    const uint64_t allocations = allocationCount;
+    std::pair<double, double> train = runGraphEpoch(dag, trainSet, input, target, output, true, 0.1);
+    const uint64_t epochAllocations = allocationCount - allocations;
+    std::pair<double, double> test = runGraphEpoch(dag, testSet, input, target, output, false);
+    std::cout << std::endl << std::fixed << std::setprecision(4) << "epoch " << epoch << ": train loss " << train.first << ", train error " << train.second
+	      << ", test error " << test.second << ", " << epochAllocations << " allocations" << std::endl;
+  }
+}
@@ -0,0 +1,51 @@
+#include <utility>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <iterator>
+
+#include "trainer.cpp"
+#include "quantize.cpp"
+#include "model_file.cpp"
+
+int main(int argc, char **argv) {
+  int numEpochs = argc > 1 ? std::atoi(argv[1]) : 2;
+  int hiddenSize = argc > 2 ? std::atoi(argv[2]) : 300;
+  int numThreads = argc > 3 ? std::atoi(argv[3]) : std::thread::hardware_concurrency();
+  const int numRepeats = 10;
+
+  MNistDataSet trainSet("mnist/train-images-idx3-ubyte", "mnist/train-labels-idx1-ubyte");
+  MNistDataSet testSet("mnist/t10k-images-idx3-ubyte", "mnist/t10k-labels-idx1-ubyte");
+
+  Network<float> net;
+  net.addLayer(trainSet.getNumRows() * trainSet.getNumColumns(), hiddenSize, Layer<float>::ActivationType::RELU);
+  net.addLayer(hiddenSize, 10, Layer<float>::ActivationType::SOFTMAX);
+  for(int epoch = 0; epoch < numEpochs; epoch++) {
+    runEpoch(net, trainSet, true, 0.2);
+  }
+  std::cout << std::endl << "original: test error " << calcErrorRate(net, testSet, testSet.getNumImages()) << std::endl;
+
+  for(int pruneLevel = 0; pruneLevel <= 2; pruneLevel++) {
+    const std::string path = "model.nnmf";
+    ModelFileStats stats = {0, 0, 0};
+    saveCompactModel(net, path, pruneLevel, &stats);
+    std::ifstream ifs(path, std::ios::in|std::ios::binary);
+    std::vector<uint8_t> file((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+
+    Network<float> loaded;
+    double seconds = 0;
+    for(int repeat = 0; repeat < numRepeats; repeat++) {
+      Network<float> decoded;
+      auto start = std::chrono::steady_clock::now();
+      decodeCompactModel(file, decoded, numThreads);
+      seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      loaded = decoded;
+    }
+    seconds /= numRepeats;
+    std::cout << "prune level " << pruneLevel << ": " << stats.fileBytes << " bytes, ratio "
+	      << static_cast<double>(stats.rawBytes) / stats.fileBytes << " (vs float), "
+	      << static_cast<double>(stats.numWeights) / stats.fileBytes << " (vs int8), decode "
+	      << stats.rawBytes / seconds / 1e9 << " GB/s of float weights with " << numThreads << " threads"
+	      << ", test error " << calcErrorRate(loaded, testSet, testSet.getNumImages()) << std::endl;
+  }
+}
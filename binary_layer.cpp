@@ -0,0 +1,250 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#ifdef __AVX512VPOPCNTDQ__
+#include <immintrin.h>
+#endif
+
+#include "neural_net.cpp"
+
+/*
+ * Binary (+1/-1) or ternary (+1/0/-1) weight layer trained with the
+ * straight-through estimator over latent float weights _w. The effective
+ * weight is alpha[j] * wb[i][j], alpha[j] being the mean magnitude of the
+ * latent weights kept in column j. Pair it with ActivationType::SIGN to
+ * binarize activations as well.
+ */
+template <class S>
+struct BinaryLayer : public LayerBase<S> {
+  bool _ternary;
+  std::vector<std::vector<S> > _w, _w_grad;
+  std::vector<std::vector<S> > _wb; /* binarized _w, refreshed by updateParam */
+  std::vector<S> _alpha; /* size: outSize */
+public:
+  using typename LayerBase<S>::ActivationType;
+
+  BinaryLayer(size_t inSize, size_t outSize, ActivationType activationType, bool ternary = false) :
+    LayerBase<S>(inSize, outSize, activationType),
+    _ternary(ternary),
+    _wb(this->_inSize, std::vector<S>(outSize)),
+    _alpha(outSize)
+  {
+    RandomGenerator<S> rg(-1.0, 1.0);
+    for(int i = 0; i < this->_inSize; i++) {
+      std::vector<S> row(this->_outSize);
+      for(int j = 0; j < this->_outSize; j++) {
+	row[j] = rg.rand();
+      }
+      _w.push_back(row);
+      _w_grad.push_back(std::vector<S>(this->_outSize, 0));
+    }
+    binarize();
+  }
+
+  /* ternary threshold per column: 0.7 * mean |w| (ternary weight networks) */
+  void binarize() {
+    const S norm = static_cast<S>(1) / std::sqrt(static_cast<S>(this->_inSize));
+    for(int j = 0; j < this->_outSize; j++) {
+      S meanAbs = 0;
+      for(int i = 0; i < this->_inSize; i++) {
+	meanAbs += std::abs(_w[i][j]);
+      }
+      meanAbs /= this->_inSize;
+      const S threshold = _ternary ? static_cast<S>(0.7) * meanAbs : 0;
+      S sumKept = 0;
+      int numKept = 0;
+      for(int i = 0; i < this->_inSize; i++) {
+	S w = _w[i][j];
+	if(_ternary && std::abs(w) <= threshold) {
+	  _wb[i][j] = 0;
+	  continue;
+	}
+	_wb[i][j] = w >= 0 ? 1 : -1;
+	sumKept += std::abs(w);
+	numKept++;
+      }
+      _alpha[j] = (numKept > 0 ? sumKept / numKept : 0) * norm;
+    }
+  }
+
+  TensorView<const S> forward(TensorView<const S> input) {
+    this->_input.assign(input.begin(), input.end());
+    this->_input.push_back(static_cast<S>(1));
+    std::fill(this->_u.begin(), this->_u.end(), 0);
+    for(int i = 0; i < this->_inSize; i++) {
+      for(int j = 0; j < this->_outSize; j++) {
+	this->_u[j] += this->_input[i] * _wb[i][j];
+      }
+    }
+    for(int j = 0; j < this->_outSize; j++) {
+      this->_u[j] *= _alpha[j];
+    }
+    this->_activation->activation(this->_u, this->_output);
+    return this->_output;
+  }
+
+  std::vector<S> backpropagate(const std::vector<S> &delta) {
+    std::vector<S> propagated(this->_inSize - 1, 0);
+    for(int i = 0; i < this->_inSize - 1; i++) {
+      for(int j = 0; j < this->_outSize; j++) {
+	propagated[i] += delta[j] * _alpha[j] * _wb[i][j];
+      }
+    }
+    return propagated;
+  }
+
+  /* straight-through: d/dw = d/dwb; updateParam keeps the latent weights in [-1, 1] instead of cancelling gradients outside */
+  void updateGrad(const std::vector<S> &delta) {
+    for(int i = 0; i < this->_inSize; i++) {
+      for(int j = 0; j < this->_outSize; j++) {
+	_w_grad[i][j] += this->_input[i] * delta[j] * _alpha[j];
+      }
+    }
+    this->_sampleCount++;
+  }
+
+  void updateParam(S learningRate) {
+    if(this->_sampleCount == 0) return;
+    for(int i = 0; i < this->_inSize; i++) {
+      for(int j = 0; j < this->_outSize; j++) {
+	S &w = _w[i][j];
+	w -= _w_grad[i][j] * learningRate / this->_sampleCount;
+	w = std::max(static_cast<S>(-1), std::min(static_cast<S>(1), w));
+	_w_grad[i][j] = 0;
+      }
+    }
+    this->_sampleCount = 0;
+    binarize();
+  }
+
+  /* the latent weights are the parameters, their binarized copy counts as weights too */
+  void addMemory(MemoryStats &stats) const {
+    LayerBase<S>::addMemory(stats);
+    stats.weights += vectorBytes(_w) + vectorBytes(_wb) + vectorBytes(_alpha);
+    stats.gradients += vectorBytes(_w_grad);
+  }
+};
+
+/*
+ * Inference-only form of a BinaryLayer followed by a SIGN activation.
+ * Inputs and weight columns are packed one bit per element (set: +1) into
+ * 64-bit words padded to a multiple of 512 bits; a mask marks the non-zero
+ * weights of ternary columns and the padding. The dot product of a column is
+ *   popcount(mask) - 2 * popcount(mask & (in ^ w))
+ * computed with AVX-512 VPOPCNTDQ when available.
+ */
+template <class S>
+class PackedBinaryLayer {
+  size_t _inSize, _outSize; /* inSize excludes the bias */
+  size_t _inWords, _outWords;
+  std::vector<uint64_t> _wBits, _mask; /* size: outSize * inWords, column major */
+  std::vector<int> _nonZero; /* popcount(mask) per column */
+  std::vector<int> _bias; /* binarized bias weight, -1/0/+1 */
+public:
+  static size_t numWords(size_t numBits) {
+    return (numBits + 511) / 512 * 8;
+  }
+
+  PackedBinaryLayer(const BinaryLayer<S> &layer) :
+    _inSize(layer._inSize - 1),
+    _outSize(layer._outSize),
+    _inWords(numWords(_inSize)),
+    _outWords(numWords(_outSize)),
+    _wBits(_outSize * _inWords, 0),
+    _mask(_outSize * _inWords, 0),
+    _nonZero(_outSize, 0),
+    _bias(_outSize)
+  {
+    for(int j = 0; j < _outSize; j++) {
+      for(int i = 0; i < _inSize; i++) {
+	S wb = layer._wb[i][j];
+	if(wb == 0) continue;
+	_mask[j * _inWords + i / 64] |= static_cast<uint64_t>(1) << (i % 64);
+	_wBits[j * _inWords + i / 64] |= static_cast<uint64_t>(wb > 0) << (i % 64);
+	_nonZero[j]++;
+      }
+      _bias[j] = static_cast<int>(layer._wb[_inSize][j]);
+    }
+  }
+
+  size_t getInWords() const {
+    return _inWords;
+  }
+
+  static int64_t countMismatches(const uint64_t *in, const uint64_t *w, const uint64_t *mask, size_t numWords) {
+#ifdef __AVX512VPOPCNTDQ__
+    __m512i acc = _mm512_setzero_si512();
+    for(size_t k = 0; k < numWords; k += 8) {
+      __m512i x = _mm512_xor_si512(_mm512_loadu_si512(in + k), _mm512_loadu_si512(w + k));
+      x = _mm512_and_si512(x, _mm512_loadu_si512(mask + k));
+      acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(x));
+    }
+    return _mm512_reduce_add_epi64(acc);
+#else
+    int64_t count = 0;
+    for(size_t k = 0; k < numWords; k++) {
+      count += __builtin_popcountll((in[k] ^ w[k]) & mask[k]);
+    }
+    return count;
+#endif
+  }
+
+  /* +1/-1 dot products, bias included; alpha > 0 so their sign is the layer's sign output */
+  std::vector<int> dot(const std::vector<uint64_t> &in) const {
+    std::vector<int> out(_outSize);
+    for(int j = 0; j < _outSize; j++) {
+      int64_t mismatches = countMismatches(in.data(), &_wBits[j * _inWords], &_mask[j * _inWords], _inWords);
+      out[j] = _nonZero[j] - 2 * static_cast<int>(mismatches) + _bias[j];
+    }
+    return out;
+  }
+
+  std::vector<uint64_t> forward(const std::vector<uint64_t> &in) const {
+    std::vector<int> d = dot(in);
+    std::vector<uint64_t> out(_outWords, 0);
+    for(int j = 0; j < _outSize; j++) {
+      out[j / 64] |= static_cast<uint64_t>(d[j] >= 0) << (j % 64);
+    }
+    return out;
+  }
+
+  std::vector<S> forwardSign(const std::vector<uint64_t> &in) const {
+    std::vector<int> d = dot(in);
+    std::vector<S> out(_outSize);
+    for(int j = 0; j < _outSize; j++) {
+      out[j] = d[j] >= 0 ? 1 : -1;
+    }
+    return out;
+  }
+};
+
+/* packed binary hidden layers followed by a float output layer fed with +1/-1 */
+template <class S>
+class PackedBinaryNetwork {
+  std::vector<PackedBinaryLayer<S> > _hidden;
+  std::shared_ptr<LayerBase<S> > _output;
+  std::vector<S> _signs; /* input of the output layer, which keeps a view of it */
+public:
+  void addHidden(const BinaryLayer<S> &layer) {
+    _hidden.push_back(PackedBinaryLayer<S>(layer));
+  }
+
+  void setOutput(std::shared_ptr<LayerBase<S> > layer) {
+    _output = layer;
+  }
+
+  size_t getInWords() const {
+    return _hidden.front().getInWords();
+  }
+
+  TensorView<const S> forward(const std::vector<uint64_t> &input) {
+    std::vector<uint64_t> buffer = input;
+    for(int l = 0; l + 1 < _hidden.size(); l++) {
+      buffer = _hidden[l].forward(buffer);
+    }
+    _signs = _hidden.back().forwardSign(buffer);
+    return _output->forward(_signs);
+  }
+};
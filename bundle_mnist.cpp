@@ -0,0 +1,63 @@
+#include <utility>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+
+#include "model_bundle.cpp"
+#include "trainer.cpp"
+
+int main(int argc, char **argv) {
+  size_t numModels = argc > 1 ? std::atoi(argv[1]) : 4;
+  int hiddenSize = argc > 2 ? std::atoi(argv[2]) : 100;
+  int numEpochs = argc > 3 ? std::atoi(argv[3]) : 2;
+
+  MNistDataSet trainSet("mnist/train-images-idx3-ubyte", "mnist/train-labels-idx1-ubyte");
+  MNistDataSet testSet("mnist/t10k-images-idx3-ubyte", "mnist/t10k-labels-idx1-ubyte");
+
+  /* same shape, different initial weights and learning rates */
+  std::vector<std::shared_ptr<Network<float>>> nets, references;
+  std::vector<double> learningRates;
+  for(size_t k = 0; k < numModels; k++) {
+    auto net = std::make_shared<Network<float> >();
+    net->addLayer(trainSet.getNumRows() * trainSet.getNumColumns(), hiddenSize, Layer<float>::ActivationType::RELU);
+    net->addLayer(hiddenSize, 10, Layer<float>::ActivationType::SOFTMAX);
+    nets.push_back(net);
+    references.push_back(net->clone());
+    learningRates.push_back(0.05 * (k + 1));
+  }
+
+  ModelBundle<float> bundle;
+  if(!bundle.pack(nets)) return 1;
+  double bundleSeconds = 0, separateSeconds = 0;
+  for(int epoch = 0; epoch < numEpochs; epoch++) {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::pair<double, double>> results = runBundleEpoch(bundle, trainSet, true, learningRates);
+    bundleSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "epoch " << epoch << ":";
+    for(size_t k = 0; k < numModels; k++) {
+      std::cout << std::fixed << std::setprecision(4) << " [rate " << learningRates[k] << " loss " << results[k].first << " test error " << evaluateErrorRate(*nets[k], testSet) << "]";
+    }
+    std::cout << std::endl;
+  }
+
+  /* the same models trained one after another */
+  progressEnabled() = false;
+  for(int epoch = 0; epoch < numEpochs; epoch++) {
+    for(size_t k = 0; k < numModels; k++) {
+      auto start = std::chrono::steady_clock::now();
+      runEpoch(*references[k], trainSet, true, learningRates[k]);
+      separateSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+  }
+  float maxDiff = 0;
+  for(size_t k = 0; k < numModels; k++) {
+    for(int l = 0; l < nets[k]->getNumLayers(); l++) {
+      auto a = std::dynamic_pointer_cast<Layer<float>>(nets[k]->getLayer(l)), b = std::dynamic_pointer_cast<Layer<float>>(references[k]->getLayer(l));
+      for(int i = 0; i < a->_inSize; i++) {
+	for(int j = 0; j < a->_outSize; j++) maxDiff = std::max(maxDiff, std::abs(a->_w[i][j] - b->_w[i][j]));
+      }
+    }
+  }
+  std::cout << std::endl << numModels << " models: bundled " << bundleSeconds / numEpochs << " sec/epoch, separately " << separateSeconds / numEpochs
+	    << " sec/epoch; max weight difference " << maxDiff << std::endl;
+}
@@ -0,0 +1,286 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <thread>
+#include <random>
+
+#include "neural_net.cpp"
+#include "entropy_coder.cpp"
+
+/* weights of all dense layers, row by row */
+template <class S>
+std::vector<S> getWeights(const Network<S> &net) {
+  std::vector<S> weights;
+  for(int l = 0; l < net.getNumLayers(); l++) {
+    std::shared_ptr<Layer<S>> layer = std::dynamic_pointer_cast<Layer<S>>(net.getLayer(l));
+    if(!layer) continue;
+    for(const auto &row : layer->_w) {
+      weights.insert(weights.end(), row.begin(), row.end());
+    }
+  }
+  return weights;
+}
+
+template <class S>
+void setWeights(Network<S> &net, const std::vector<S> &weights) {
+  size_t pos = 0;
+  for(int l = 0; l < net.getNumLayers(); l++) {
+    std::shared_ptr<Layer<S>> layer = std::dynamic_pointer_cast<Layer<S>>(net.getLayer(l));
+    if(!layer) continue;
+    for(auto &row : layer->_w) {
+      std::copy(weights.begin() + pos, weights.begin() + pos + row.size(), row.begin());
+      pos += row.size();
+    }
+  }
+}
+
+bool readFile(const std::string &path, std::vector<uint8_t> &data) {
+  std::ifstream ifs(path, std::ios::in|std::ios::binary);
+  if(!ifs) return false;
+  data.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+  return true;
+}
+
+/*
+ * Checkpoints as a full base file (prefix.base) followed by delta files
+ * (prefix.delta.1, prefix.delta.2, ...). A delta holds only the blocks of
+ * weights that moved by more than threshold since they were last written,
+ * either as the XOR of the old and new bit patterns (lossless) or as the
+ * difference rounded to multiples of threshold (QUANTIZED, error at most
+ * threshold / 2 in written blocks). Either way the bytes of each element are
+ * split into planes and Huffman-coded. Every baseInterval-th checkpoint is a
+ * new base, which bounds the number of deltas to replay. SGD keeps no
+ * optimizer state between updateParam calls, so only weights are saved.
+ * The base records a random generation, the block size and the threshold;
+ * each delta records the generation it applies to, so deltas left over
+ * from an earlier base are never replayed onto a new one.
+ */
+template <class S>
+class DeltaCheckpointer {
+public:
+  enum class DeltaMode {
+    XOR,
+    QUANTIZED
+  };
+private:
+  Network<S> &_net;
+  std::string _prefix;
+  DeltaMode _mode;
+  size_t _blockSize;
+  S _threshold;
+  int _baseInterval;
+  int _numCheckpoints;
+  int _numDeltas;
+  uint32_t _generation; /* of the current base */
+  std::vector<S> _shadow; /* weights a restore would produce */
+public:
+  DeltaCheckpointer(Network<S> &net, const std::string &prefix, S threshold, DeltaMode mode = DeltaMode::QUANTIZED, size_t blockSize = 4096, int baseInterval = 10) :
+    _net(net),
+    _prefix(prefix),
+    _mode(mode),
+    _blockSize(blockSize),
+    _threshold(threshold),
+    _baseInterval(baseInterval),
+    _numCheckpoints(0),
+    _numDeltas(0),
+    _generation(0)
+  {
+  }
+
+  std::string deltaPath(int k) const {
+    return _prefix + ".delta." + std::to_string(k);
+  }
+
+  /* returns the bytes written */
+  size_t save() {
+    std::vector<S> weights = getWeights(_net);
+    return _numCheckpoints++ % _baseInterval == 0 ? saveBase(weights) : saveDelta(weights);
+  }
+
+  /* [u32 generation][u32 blockSize][S threshold][u32 count][count weights] */
+  size_t saveBase(const std::vector<S> &weights) {
+    /* up to the first missing one, which also removes those of an earlier run */
+    for(int k = 1; std::remove(deltaPath(k).c_str()) == 0 || k <= _numDeltas; ) k++;
+    _numDeltas = 0;
+    _shadow = weights;
+    std::random_device rnd;
+    const uint32_t previous = _generation;
+    while(_generation == previous) _generation = rnd();
+    std::vector<uint8_t> out;
+    putUInt32(out, _generation);
+    putUInt32(out, _blockSize);
+    out.insert(out.end(), reinterpret_cast<const uint8_t *>(&_threshold), reinterpret_cast<const uint8_t *>(&_threshold + 1));
+    putUInt32(out, weights.size());
+    out.insert(out.end(), reinterpret_cast<const uint8_t *>(weights.data()), reinterpret_cast<const uint8_t *>(weights.data() + weights.size()));
+    std::ofstream ofs(_prefix + ".base", std::ios::out|std::ios::binary);
+    ofs.write(reinterpret_cast<const char *>(out.data()), out.size());
+    return out.size();
+  }
+
+  /* the same expression runs on restore, so the shadow matches the restored weights bit for bit */
+  static S applyQuantized(S before, int32_t q, S step) {
+    return before + q * step;
+  }
+
+  /* [u32 generation][u32 numChanged][u8 mode], then per changed block [u32 index][Huffman stream] */
+  size_t saveDelta(const std::vector<S> &weights) {
+    std::vector<uint8_t> out;
+    const size_t numBlocks = (weights.size() + _blockSize - 1) / _blockSize;
+    const size_t elementBytes = _mode == DeltaMode::XOR ? sizeof(S) : 4;
+    uint32_t numChanged = 0;
+    putUInt32(out, _generation);
+    putUInt32(out, 0);
+    out.push_back(static_cast<uint8_t>(_mode));
+    std::vector<uint8_t> planes;
+    for(size_t b = 0; b < numBlocks; b++) {
+      const size_t begin = b * _blockSize, count = std::min(_blockSize, weights.size() - begin);
+      S maxDiff = 0;
+      for(size_t k = begin; k < begin + count; k++) {
+	maxDiff = std::max(maxDiff, std::abs(weights[k] - _shadow[k]));
+      }
+      if(maxDiff <= _threshold) continue;
+      planes.assign(count * elementBytes, 0);
+      for(size_t k = 0; k < count; k++) {
+	if(_mode == DeltaMode::XOR) {
+	  uint8_t now[sizeof(S)], before[sizeof(S)];
+	  std::memcpy(now, &weights[begin + k], sizeof(S));
+	  std::memcpy(before, &_shadow[begin + k], sizeof(S));
+	  for(int byte = 0; byte < sizeof(S); byte++) {
+	    planes[byte * count + k] = now[byte] ^ before[byte];
+	  }
+	  _shadow[begin + k] = weights[begin + k];
+	}else {
+	  const int32_t q = static_cast<int32_t>(std::lround((weights[begin + k] - _shadow[begin + k]) / _threshold));
+	  const uint32_t zigzag = (static_cast<uint32_t>(q) << 1) ^ static_cast<uint32_t>(q >> 31);
+	  for(int byte = 0; byte < 4; byte++) {
+	    planes[byte * count + k] = static_cast<uint8_t>(zigzag >> (8 * byte));
+	  }
+	  _shadow[begin + k] = applyQuantized(_shadow[begin + k], q, _threshold);
+	}
+      }
+      putUInt32(out, b);
+      encodeHuffmanStream(planes.data(), planes.size(), out);
+      numChanged++;
+    }
+    for(int byte = 0; byte < 4; byte++) {
+      out[4 + byte] = static_cast<uint8_t>(numChanged >> (8 * byte));
+    }
+    std::ofstream ofs(deltaPath(++_numDeltas), std::ios::out|std::ios::binary);
+    ofs.write(reinterpret_cast<const char *>(out.data()), out.size());
+    return out.size();
+  }
+
+  /*
+   * Loads the base, decodes the blocks of every delta of its generation in
+   * parallel, then applies them in checkpoint order. The block size and
+   * threshold are taken from the base. Returns false, leaving the network
+   * unchanged, if the files are missing, corrupt or for another shape.
+   */
+  bool restore(int numThreads = std::thread::hardware_concurrency()) {
+    const size_t baseHeaderBytes = 12 + sizeof(S);
+    std::vector<uint8_t> base;
+    if(!readFile(_prefix + ".base", base)) return false;
+    if(base.size() < baseHeaderBytes || getUInt32(&base[4]) == 0
+       || base.size() != baseHeaderBytes + static_cast<uint64_t>(getUInt32(&base[8 + sizeof(S)])) * sizeof(S)) {
+      std::cerr << "corrupt " << _prefix << ".base" << std::endl;
+      return false;
+    }
+    std::vector<S> weights(getUInt32(&base[8 + sizeof(S)]));
+    if(weights.size() != getWeights(_net).size()) {
+      std::cerr << _prefix << ".base holds " << weights.size() << " weights, the network has " << getWeights(_net).size() << std::endl;
+      return false;
+    }
+    const uint32_t generation = getUInt32(&base[0]);
+    const size_t blockSize = getUInt32(&base[4]);
+    S threshold;
+    std::memcpy(&threshold, &base[8], sizeof(S));
+    std::memcpy(weights.data(), &base[baseHeaderBytes], weights.size() * sizeof(S));
+    const size_t numBlocks = (weights.size() + blockSize - 1) / blockSize;
+
+    std::vector<std::vector<uint8_t> > deltas;
+    for(int k = 1; ; k++) {
+      std::vector<uint8_t> delta;
+      if(!readFile(deltaPath(k), delta)) break;
+      if(delta.size() < 4 || getUInt32(delta.data()) != generation) break; /* left over from an earlier base */
+      deltas.push_back(delta);
+    }
+    struct Block {
+      size_t index;
+      std::vector<uint8_t> planes;
+    };
+    std::vector<std::vector<Block> > blocks(deltas.size());
+    std::vector<std::vector<HuffmanCode> > codes(deltas.size());
+    std::vector<DeltaMode> modes(deltas.size());
+    std::vector<HuffmanChunk> chunks;
+    for(size_t d = 0; d < deltas.size(); d++) {
+      const uint8_t *p = deltas[d].data(), *end = deltas[d].data() + deltas[d].size();
+      if(end - p < 9 || getUInt32(p + 4) > numBlocks || p[8] > static_cast<uint8_t>(DeltaMode::QUANTIZED)) {
+	std::cerr << "corrupt " << deltaPath(d + 1) << std::endl;
+	return false;
+      }
+      const uint32_t numChanged = getUInt32(p + 4);
+      modes[d] = static_cast<DeltaMode>(p[8]);
+      const size_t elementBytes = modes[d] == DeltaMode::XOR ? sizeof(S) : 4;
+      p += 9;
+      blocks[d].resize(numChanged);
+      codes[d].resize(numChanged);
+      for(uint32_t c = 0; c < numChanged; c++) {
+	Block &block = blocks[d][c];
+	if(end - p < 4 || getUInt32(p) >= numBlocks) {
+	  std::cerr << "corrupt block in " << deltaPath(d + 1) << std::endl;
+	  return false;
+	}
+	block.index = getUInt32(p);
+	p += 4;
+	const size_t count = std::min(blockSize, weights.size() - block.index * blockSize);
+	block.planes.resize(count * elementBytes);
+	const size_t consumed = parseHuffmanStream(p, end, codes[d][c], block.planes.data(), block.planes.size(), chunks);
+	if(consumed == 0) {
+	  std::cerr << "corrupt block in " << deltaPath(d + 1) << std::endl;
+	  return false;
+	}
+	p += consumed;
+      }
+    }
+    decodeHuffmanChunks(chunks, std::max(1, numThreads));
+
+    for(size_t d = 0; d < blocks.size(); d++) {
+      const size_t elementBytes = modes[d] == DeltaMode::XOR ? sizeof(S) : 4;
+      for(const Block &block : blocks[d]) {
+	const size_t begin = block.index * blockSize, count = block.planes.size() / elementBytes;
+	for(size_t k = 0; k < count; k++) {
+	  if(modes[d] == DeltaMode::XOR) {
+	    uint8_t bytes[sizeof(S)];
+	    std::memcpy(bytes, &weights[begin + k], sizeof(S));
+	    for(int byte = 0; byte < sizeof(S); byte++) {
+	      bytes[byte] ^= block.planes[byte * count + k];
+	    }
+	    std::memcpy(&weights[begin + k], bytes, sizeof(S));
+	  }else {
+	    uint32_t zigzag = 0;
+	    for(int byte = 0; byte < 4; byte++) {
+	      zigzag |= static_cast<uint32_t>(block.planes[byte * count + k]) << (8 * byte);
+	    }
+	    const int32_t q = static_cast<int32_t>(zigzag >> 1) ^ -static_cast<int32_t>(zigzag & 1);
+	    weights[begin + k] = applyQuantized(weights[begin + k], q, threshold);
+	  }
+	}
+      }
+    }
+    setWeights(_net, weights);
+    _shadow = weights;
+    _generation = generation;
+    _blockSize = blockSize;
+    _threshold = threshold;
+    _numDeltas = deltas.size();
+    _numCheckpoints = 1 + _numDeltas;
+    return true;
+  }
+};
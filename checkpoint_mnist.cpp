@@ -0,0 +1,47 @@
+#include <utility>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+
+#include "trainer.cpp"
+#include "quantize.cpp"
+#include "checkpoint.cpp"
+
+int main(int argc, char **argv) {
+  int numEpochs = argc > 1 ? std::atoi(argv[1]) : 5;
+  float threshold = argc > 2 ? std::atof(argv[2]) : 1e-4;
+  auto mode = argc > 3 && std::string(argv[3]) == "xor" ? DeltaCheckpointer<float>::DeltaMode::XOR : DeltaCheckpointer<float>::DeltaMode::QUANTIZED;
+
+  MNistDataSet trainSet("mnist/train-images-idx3-ubyte", "mnist/train-labels-idx1-ubyte");
+  MNistDataSet testSet("mnist/t10k-images-idx3-ubyte", "mnist/t10k-labels-idx1-ubyte");
+
+  Network<float> net;
+  net.addLayer(trainSet.getNumRows() * trainSet.getNumColumns(), 300, Layer<float>::ActivationType::RELU);
+  net.addLayer(300, 10, Layer<float>::ActivationType::SOFTMAX);
+  DeltaCheckpointer<float> checkpointer(net, "checkpoint", threshold, mode, 1024, 4);
+  std::cout << "checkpoint 0: " << checkpointer.save() << " bytes" << std::endl;
+  for(int epoch = 0; epoch < numEpochs; epoch++) {
+    runEpoch(net, trainSet, true, 0.2);
+    auto start = std::chrono::steady_clock::now();
+    size_t bytes = checkpointer.save();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << std::endl << "checkpoint " << epoch + 1 << ": " << bytes << " bytes, " << seconds << " sec" << std::endl;
+  }
+
+  Network<float> restored;
+  restored.addLayer(trainSet.getNumRows() * trainSet.getNumColumns(), 300, Layer<float>::ActivationType::RELU);
+  restored.addLayer(300, 10, Layer<float>::ActivationType::SOFTMAX);
+  DeltaCheckpointer<float> loader(restored, "checkpoint", threshold, mode, 1024, 4);
+  auto start = std::chrono::steady_clock::now();
+  loader.restore();
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  std::vector<float> original = getWeights(net), loaded = getWeights(restored);
+  float maxDiff = 0;
+  for(size_t k = 0; k < original.size(); k++) {
+    maxDiff = std::max(maxDiff, std::abs(original[k] - loaded[k]));
+  }
+  std::cout << "restored in " << seconds << " sec, max weight difference " << std::scientific << maxDiff << std::fixed
+	    << ", test error " << calcErrorRate(net, testSet, testSet.getNumImages())
+	    << " (restored " << calcErrorRate(restored, testSet, testSet.getNumImages()) << ")" << std::endl;
+}
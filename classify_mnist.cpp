@@ -3,44 +3,7 @@
 #include <iomanip>
 #include <limits>
 
-#include "neural_net.cpp"
-#include "mnist.cpp"
-
-std::pair<double, double> runEpoch(Network<double> &net, MNistDataSet &set, bool train, double learningRate = 0.1, int batchSize = 100) {
-  int numCorrect = 0;
-  int numWrong = 0;
-  double sumLoss = 0;
-  double batchLoss = 0;
-  int batchId = 0;
-  for(uint32_t sample = 0; sample < set.getNumImages(); sample++) {
-    std::vector<double> in = set.getImageDouble(sample);
-    std::vector<double> out = net.forward(in);
-    uint8_t estimatedLabel = std::distance(out.begin(), std::max_element(out.begin(), out.end()));
-    bool isCorrect = estimatedLabel == set.getLabel(sample) ? true : false;
-    if(isCorrect) {
-      numCorrect++;
-    }else {
-      numWrong++;
-    }
-    std::vector<double> labelOneHot = set.getLabelDouble(sample);
-    double sampleLoss = net.calcLoss(labelOneHot);
-    sumLoss += sampleLoss;
-    batchLoss += sampleLoss;
-    if(train) {
-      net.backward(labelOneHot);
-      if(sample % batchSize == 0 || sample == set.getNumImages() - 1) {
-	std::cout << std::fixed << std::setprecision(4) << "\rbatch loss[" << batchId << "]: " << batchLoss / batchSize;
-	std::cout.flush();
-	batchLoss = 0;
-	batchId++;
-	net.updateParam(learningRate);
-      }
-    }
-  }
-  double meanLoss = sumLoss / (numCorrect + numWrong);
-  double errorRate = (double)numWrong / (numCorrect + numWrong);
-  return std::make_pair(meanLoss, errorRate);
-}
+#include "trainer.cpp"
 
 int main() {
 
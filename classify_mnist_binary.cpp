@@ -0,0 +1,61 @@
+#include <utility>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstring>
+
+#include "trainer.cpp"
+#include "binary_layer.cpp"
+
+int main(int argc, char **argv) {
+  bool ternary = argc > 1 && std::strcmp(argv[1], "ternary") == 0;
+  int numEpochs = argc > 2 ? std::atoi(argv[2]) : 10;
+
+  MNistDataSet trainSet("mnist/train-images-idx3-ubyte", "mnist/train-labels-idx1-ubyte");
+  MNistDataSet testSet("mnist/t10k-images-idx3-ubyte", "mnist/t10k-labels-idx1-ubyte");
+  size_t inSize = trainSet.getNumRows() * trainSet.getNumColumns();
+
+  auto hidden1 = std::make_shared<BinaryLayer<double> >(inSize, 512, Layer<double>::ActivationType::SIGN, ternary);
+  auto hidden2 = std::make_shared<BinaryLayer<double> >(512, 512, Layer<double>::ActivationType::SIGN, ternary);
+  auto output = std::make_shared<Layer<double> >(512, 10, Layer<double>::ActivationType::SOFTMAX);
+  Network<double> net;
+  net.addLayer(hidden1);
+  net.addLayer(hidden2);
+  net.addLayer(output);
+
+  InputFunction getSign = [](MNistDataSet &set, uint32_t sample) {return set.getImageSign(sample);};
+  double learningRate = 0.05;
+  for(int epoch = 0; epoch < numEpochs; epoch++) {
+    std::cout << "running epoch " << epoch << std::endl;
+    auto trainResult = runEpoch(net, trainSet, getSign, true, learningRate);
+    std::cout << std::endl << "train set error rate: " << trainResult.second << std::endl;
+    auto testResult = runEpoch(net, testSet, getSign, false);
+    std::cout << "test set error rate: " << testResult.second << std::endl;
+  }
+
+  PackedBinaryNetwork<double> packed;
+  packed.addHidden(*hidden1);
+  packed.addHidden(*hidden2);
+  packed.setOutput(output);
+
+  auto start = std::chrono::steady_clock::now();
+  int numWrong = 0;
+  for(uint32_t sample = 0; sample < testSet.getNumImages(); sample++) {
+    const std::vector<double> image = testSet.getImageSign(sample);
+    TensorView<const double> out = net.forward(image);
+    numWrong += std::distance(out.begin(), std::max_element(out.begin(), out.end())) != testSet.getLabel(sample);
+  }
+  double floatSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  std::cout << "float inference: error rate " << (double)numWrong / testSet.getNumImages()
+	    << ", " << testSet.getNumImages() / floatSeconds << " images/sec" << std::endl;
+
+  start = std::chrono::steady_clock::now();
+  numWrong = 0;
+  for(uint32_t sample = 0; sample < testSet.getNumImages(); sample++) {
+    TensorView<const double> out = packed.forward(testSet.getImagePacked(sample, packed.getInWords()));
+    numWrong += std::distance(out.begin(), std::max_element(out.begin(), out.end())) != testSet.getLabel(sample);
+  }
+  double packedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  std::cout << "xnor-popcount inference: error rate " << (double)numWrong / testSet.getNumImages()
+	    << ", " << testSet.getNumImages() / packedSeconds << " images/sec" << std::endl;
+}
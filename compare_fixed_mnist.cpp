@@ -0,0 +1,36 @@
+#include <utility>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+
+#include "trainer.cpp"
+#include "fixed_point.cpp"
+
+template <class S>
+void trainAndReport(const std::string &name, MNistDataSet &trainSet, MNistDataSet &testSet, int numEpochs) {
+  Network<S> net;
+  net.addLayer(trainSet.getNumRows() * trainSet.getNumColumns(), 300, Layer<S>::ActivationType::RELU);
+  net.addLayer(300, 10, Layer<S>::ActivationType::SOFTMAX);
+  double learningRate = 0.2;
+  for(int epoch = 0; epoch < numEpochs; epoch++) {
+    auto start = std::chrono::steady_clock::now();
+    auto trainResult = runEpoch(net, trainSet, true, learningRate);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    auto testResult = runEpoch(net, testSet, false);
+    std::cout << std::endl << name << " epoch " << epoch
+	      << ": train error " << trainResult.second
+	      << ", test error " << testResult.second
+	      << ", test loss " << std::setprecision(10) << testResult.first << std::setprecision(4)
+	      << ", " << trainSet.getNumImages() / seconds << " samples/sec" << std::endl;
+  }
+}
+
+int main(int argc, char **argv) {
+  int numEpochs = argc > 1 ? std::atoi(argv[1]) : 5;
+
+  MNistDataSet trainSet("mnist/train-images-idx3-ubyte", "mnist/train-labels-idx1-ubyte");
+  MNistDataSet testSet("mnist/t10k-images-idx3-ubyte", "mnist/t10k-labels-idx1-ubyte");
+
+  trainAndReport<float>("float", trainSet, testSet, numEpochs);
+  trainAndReport<Fixed16>("fixed16 (Q3.12)", trainSet, testSet, numEpochs);
+}
@@ -0,0 +1,49 @@
+#include <utility>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+
+#include "trainer.cpp"
+#include "hashed_layer.cpp"
+
+void trainAndReport(const std::string &name, Network<double> &net, size_t paramBytes, MNistDataSet &trainSet, MNistDataSet &testSet, int numEpochs) {
+  double learningRate = 0.2;
+  for(int epoch = 0; epoch < numEpochs; epoch++) {
+    auto start = std::chrono::steady_clock::now();
+    auto trainResult = runEpoch(net, trainSet, true, learningRate);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    auto testResult = runEpoch(net, testSet, false);
+    std::cout << std::endl << name << " epoch " << epoch
+	      << ": train error " << trainResult.second
+	      << ", test error " << testResult.second
+	      << ", " << trainSet.getNumImages() / seconds << " samples/sec" << std::endl;
+  }
+  std::cout << name << " parameter bytes: " << paramBytes << std::endl;
+}
+
+int main(int argc, char **argv) {
+  int compression = argc > 1 ? std::atoi(argv[1]) : 64;
+  int numEpochs = argc > 2 ? std::atoi(argv[2]) : 5;
+  if(compression <= 0) {
+    std::cerr << "compression must be positive" << std::endl;
+    return 1;
+  }
+
+  MNistDataSet trainSet("mnist/train-images-idx3-ubyte", "mnist/train-labels-idx1-ubyte");
+  MNistDataSet testSet("mnist/t10k-images-idx3-ubyte", "mnist/t10k-labels-idx1-ubyte");
+  size_t inSize = trainSet.getNumRows() * trainSet.getNumColumns();
+
+  Network<double> dense;
+  dense.addLayer(inSize, 300, Layer<double>::ActivationType::RELU);
+  dense.addLayer(300, 10, Layer<double>::ActivationType::SOFTMAX);
+  size_t denseParams = (inSize + 1) * 300 + 301 * 10;
+  trainAndReport("dense", dense, denseParams * sizeof(double), trainSet, testSet, numEpochs);
+
+  /* as HashedLayer clamps them, so that the reported bytes match */
+  size_t hashedParams1 = std::max<size_t>(1, (inSize + 1) * 300 / compression);
+  size_t hashedParams2 = std::max<size_t>(1, 301 * 10 / compression);
+  Network<double> hashed;
+  hashed.addLayer(std::make_shared<HashedLayer<double> >(inSize, 300, Layer<double>::ActivationType::RELU, hashedParams1));
+  hashed.addLayer(std::make_shared<HashedLayer<double> >(300, 10, Layer<double>::ActivationType::SOFTMAX, hashedParams2));
+  trainAndReport("hashed 1/" + std::to_string(compression), hashed, (hashedParams1 + hashedParams2) * sizeof(double), trainSet, testSet, numEpochs);
+}
@@ -0,0 +1,58 @@
+#include <utility>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+
+#include "trainer.cpp"
+#include "quantize.cpp"
+#include "compressed_layer.cpp"
+
+template <class S>
+void evaluate(const std::string &name, Network<S> &net, size_t weightBytes, MNistDataSet &testSet) {
+  auto start = std::chrono::steady_clock::now();
+  double errorRate = calcErrorRate(net, testSet, testSet.getNumImages());
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  std::cout << name << ": test error " << errorRate << ", " << testSet.getNumImages() / seconds << " images/sec, "
+	    << weightBytes << " weight bytes" << std::endl;
+}
+
+/* dense layers as CompressedLayers; other layers are shared as they are and not counted in weightBytes */
+template <class S>
+Network<S> compress(const Network<S> &net, bool asyncDecode, size_t &weightBytes) {
+  Network<S> compressed;
+  weightBytes = 0;
+  for(int l = 0; l < net.getNumLayers(); l++) {
+    std::shared_ptr<Layer<S>> dense = std::dynamic_pointer_cast<Layer<S>>(net.getLayer(l));
+    if(!dense) {
+      std::cerr << "layer " << l << " is not dense, kept uncompressed" << std::endl;
+      compressed.addLayer(net.getLayer(l));
+      continue;
+    }
+    auto layer = std::make_shared<CompressedLayer<S> >(*dense, asyncDecode);
+    weightBytes += layer->compressedBytes();
+    compressed.addLayer(layer);
+  }
+  return compressed;
+}
+
+int main(int argc, char **argv) {
+  int numEpochs = argc > 1 ? std::atoi(argv[1]) : 5;
+
+  MNistDataSet trainSet("mnist/train-images-idx3-ubyte", "mnist/train-labels-idx1-ubyte");
+  MNistDataSet testSet("mnist/t10k-images-idx3-ubyte", "mnist/t10k-labels-idx1-ubyte");
+
+  Network<float> net;
+  net.addLayer(trainSet.getNumRows() * trainSet.getNumColumns(), 300, Layer<float>::ActivationType::RELU);
+  net.addLayer(300, 10, Layer<float>::ActivationType::SOFTMAX);
+  for(int epoch = 0; epoch < numEpochs; epoch++) {
+    runEpoch(net, trainSet, true, 0.2);
+  }
+  std::cout << std::endl;
+
+  evaluate("dense", net, PrecisionPlan<float>(net.getNumLayers()).weightBytes(net), testSet);
+  size_t weightBytes;
+  Network<float> sync = compress(net, false, weightBytes);
+  evaluate("4-bit codebook, decode then multiply", sync, weightBytes, testSet);
+  Network<float> async = compress(net, true, weightBytes);
+  evaluate("4-bit codebook, decode overlapped", async, weightBytes, testSet);
+}
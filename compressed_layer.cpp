@@ -0,0 +1,218 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include <cmath>
+
+#include "neural_net.cpp"
+
+/*
+ * Inference-only copy of a dense Layer whose weights stay compressed as 4-bit
+ * indices into a 16-entry k-means codebook. forward decodes tiles of input
+ * rows into one of two L2-sized buffers just before multiplying them; with
+ * asyncDecode a decoder thread fills the next buffer while the current tile
+ * is multiplied. Rows whose input is zero are neither decoded nor multiplied.
+ */
+template <class S>
+struct CompressedLayer : public LayerBase<S> {
+  static const int numCodes = 16;
+  std::vector<S> _codebook;
+  size_t _rowBytes;
+  std::vector<uint8_t> _codes; /* size: inSize * rowBytes, even column in the low nibble */
+  size_t _tileRows, _numTiles;
+  std::vector<S> _tiles[2]; /* size: (tileRows * outSize) each */
+  bool _async;
+  std::thread _decoder;
+  std::mutex _mutex;
+  std::condition_variable _cv;
+  int _nextTile; /* next tile for the decoder */
+  int _consumed; /* tiles multiplied so far in this forward */
+  int _tileReady[2]; /* tile held by each buffer, -1 if none */
+  bool _stop;
+public:
+  CompressedLayer(const Layer<S> &layer, bool asyncDecode = true, size_t tileBytes = 256 * 1024, int numIterations = 10) :
+    LayerBase<S>(layer._inSize - 1, layer._outSize, layer._activationType),
+    _codebook(numCodes),
+    _rowBytes((layer._outSize + 1) / 2),
+    _codes(layer._inSize * _rowBytes, 0),
+    _tileRows(std::max<size_t>(1, tileBytes / (layer._outSize * sizeof(S)))),
+    _numTiles((layer._inSize + _tileRows - 1) / _tileRows),
+    _async(asyncDecode),
+    _nextTile(0),
+    _consumed(0),
+    _stop(false)
+  {
+    buildCodebook(layer, numIterations);
+    for(int b = 0; b < 2; b++) {
+      _tiles[b].resize(_tileRows * this->_outSize);
+      _tileReady[b] = -1;
+    }
+    if(_async) {
+      _nextTile = _numTiles;
+      _decoder = std::thread([this]() {decodeLoop();});
+    }
+  }
+
+  CompressedLayer(const CompressedLayer &) = delete;
+
+  ~CompressedLayer() {
+    if(_async) {
+      {
+	std::lock_guard<std::mutex> lock(_mutex);
+	_stop = true;
+      }
+      _cv.notify_all();
+      _decoder.join();
+    }
+  }
+
+  int nearestCode(S w) const {
+    int best = 0;
+    for(int c = 1; c < numCodes; c++) {
+      if(std::abs(w - _codebook[c]) < std::abs(w - _codebook[best])) best = c;
+    }
+    return best;
+  }
+
+  /* 1-d k-means, centroids initialized evenly between min and max */
+  void buildCodebook(const Layer<S> &layer, int numIterations) {
+    S lo = layer._w[0][0], hi = layer._w[0][0];
+    for(const auto &row : layer._w) {
+      for(S w : row) {
+	lo = std::min(lo, w);
+	hi = std::max(hi, w);
+      }
+    }
+    for(int c = 0; c < numCodes; c++) {
+      _codebook[c] = lo + (hi - lo) * (c + static_cast<S>(0.5)) / numCodes;
+    }
+    for(int iteration = 0; iteration < numIterations; iteration++) {
+      std::vector<S> sum(numCodes, 0);
+      std::vector<size_t> count(numCodes, 0);
+      for(const auto &row : layer._w) {
+	for(S w : row) {
+	  int c = nearestCode(w);
+	  sum[c] += w;
+	  count[c]++;
+	}
+      }
+      for(int c = 0; c < numCodes; c++) {
+	if(count[c] > 0) _codebook[c] = sum[c] / count[c];
+      }
+    }
+    for(int i = 0; i < this->_inSize; i++) {
+      for(int j = 0; j < this->_outSize; j++) {
+	_codes[i * _rowBytes + j / 2] |= nearestCode(layer._w[i][j]) << (4 * (j % 2));
+      }
+    }
+  }
+
+  size_t compressedBytes() const {
+    return _codes.size() + _codebook.size() * sizeof(S);
+  }
+
+  void decodeTile(int tile) {
+    S *out = _tiles[tile % 2].data();
+    const size_t begin = tile * _tileRows, end = std::min(begin + _tileRows, this->_inSize);
+    for(size_t i = begin; i < end; i++) {
+      if(this->_input[i] == 0) continue;
+      const uint8_t *codes = &_codes[i * _rowBytes];
+      S *row = out + (i - begin) * this->_outSize;
+      for(int b = 0; b < this->_outSize / 2; b++) {
+	row[2 * b] = _codebook[codes[b] & 0xf];
+	row[2 * b + 1] = _codebook[codes[b] >> 4];
+      }
+      if(this->_outSize % 2) {
+	row[this->_outSize - 1] = _codebook[codes[this->_outSize / 2] & 0xf];
+      }
+    }
+  }
+
+  void multiplyTile(int tile) {
+    const S *w = _tiles[tile % 2].data();
+    const size_t begin = tile * _tileRows, end = std::min(begin + _tileRows, this->_inSize);
+    for(size_t i = begin; i < end; i++) {
+      const S x = this->_input[i];
+      if(x == 0) continue;
+      const S *row = w + (i - begin) * this->_outSize;
+      for(int j = 0; j < this->_outSize; j++) {
+	this->_u[j] += x * row[j];
+      }
+    }
+  }
+
+  /* stays at most two tiles ahead of the multiplication */
+  void decodeLoop() {
+    while(true) {
+      int tile;
+      {
+	std::unique_lock<std::mutex> lock(_mutex);
+	_cv.wait(lock, [this]() {return _stop || (_nextTile < _numTiles && _nextTile < _consumed + 2);});
+	if(_stop) return;
+	tile = _nextTile++;
+      }
+      decodeTile(tile);
+      {
+	std::lock_guard<std::mutex> lock(_mutex);
+	_tileReady[tile % 2] = tile;
+      }
+      _cv.notify_all();
+    }
+  }
+
+  TensorView<const S> forward(TensorView<const S> input) {
+    this->_input.assign(input.begin(), input.end());
+    this->_input.push_back(static_cast<S>(1));
+    std::fill(this->_u.begin(), this->_u.end(), 0);
+    if(!_async) {
+      for(int tile = 0; tile < _numTiles; tile++) {
+	decodeTile(tile);
+	multiplyTile(tile);
+      }
+    }else {
+      {
+	std::lock_guard<std::mutex> lock(_mutex);
+	_nextTile = 0;
+	_consumed = 0;
+	_tileReady[0] = _tileReady[1] = -1;
+      }
+      _cv.notify_all();
+      for(int tile = 0; tile < _numTiles; tile++) {
+	{
+	  std::unique_lock<std::mutex> lock(_mutex);
+	  _cv.wait(lock, [this, tile]() {return _tileReady[tile % 2] == tile;});
+	}
+	multiplyTile(tile);
+	{
+	  std::lock_guard<std::mutex> lock(_mutex);
+	  _tileReady[tile % 2] = -1;
+	  _consumed++;
+	}
+	_cv.notify_all();
+      }
+    }
+    this->_activation->activation(this->_u, this->_output);
+    return this->_output;
+  }
+
+  /* inference only */
+  std::vector<S> backpropagate(const std::vector<S> &delta) {
+    return std::vector<S>(this->_inSize - 1, 0);
+  }
+
+  void updateGrad(const std::vector<S> &delta) {
+  }
+
+  void updateParam(S learningRate) {
+  }
+
+  /* the decoded tiles are a cache of the compressed weights */
+  void addMemory(MemoryStats &stats) const {
+    LayerBase<S>::addMemory(stats);
+    stats.weights += vectorBytes(_codes) + vectorBytes(_codebook);
+    stats.caches += vectorBytes(_tiles[0]) + vectorBytes(_tiles[1]);
+  }
+};
@@ -0,0 +1,362 @@
+#pragma once
+
+#if __cplusplus < 202002L
+#error "coroutine_pipeline.cpp needs C++20 coroutines (--std=c++20)"
+#endif
+
+#include <coroutine>
+#include <optional>
+#include <deque>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <iostream>
+#include <iomanip>
+
+#include "trainer.cpp"
+
+/* per stage: items handled, time blocked on an empty input or a full output, time alive */
+struct StageMetrics {
+  std::string name;
+  uint64_t items = 0;
+  uint64_t inputStallNs = 0;
+  uint64_t outputStallNs = 0;
+  uint64_t totalNs = 0;
+  double occupancySum = 0; /* output buffer fill / capacity, sampled at each send */
+  uint64_t occupancySamples = 0;
+
+  double busyFraction() const {
+    return totalNs > 0 ? 1.0 - static_cast<double>(inputStallNs + outputStallNs) / totalNs : 0;
+  }
+
+  void report(std::ostream &os) const {
+    os << std::fixed << std::setprecision(3) << std::setw(12) << name << ": " << items << " items, busy " << busyFraction()
+       << ", input stall " << inputStallNs / 1e9 << " sec, output stall " << outputStallNs / 1e9 << " sec";
+    if(occupancySamples > 0) os << ", output buffer occupancy " << occupancySum / occupancySamples;
+    os << std::endl;
+  }
+};
+
+/*
+ * Resumes coroutines as HIGH tasks on the default scheduler. Without workers
+ * a resumed stage runs inline in the stage that woke it, whose metrics then
+ * include the nested work.
+ */
+class CoroutineExecutor {
+  TaskGroup _group;
+public:
+  void post(std::coroutine_handle<> handle) {
+    defaultScheduler().submit([handle]() {handle.resume();}, TaskPriority::HIGH, &_group);
+  }
+
+  void wait(const std::atomic<int> &remaining) {
+    while(remaining > 0) {
+      defaultScheduler().wait(_group);
+      std::this_thread::yield();
+    }
+  }
+};
+
+/* coroutine started by the executor; decrements remaining when it finishes */
+struct PipelineTask {
+  struct promise_type {
+    std::atomic<int> *remaining = nullptr;
+
+    PipelineTask get_return_object() {
+      return PipelineTask{std::coroutine_handle<promise_type>::from_promise(*this)};
+    }
+    std::suspend_always initial_suspend() noexcept {
+      return {};
+    }
+    std::suspend_never final_suspend() noexcept {
+      return {};
+    }
+    void return_void() {
+      if(remaining) (*remaining)--;
+    }
+    void unhandled_exception() {
+      std::terminate();
+    }
+  };
+  std::coroutine_handle<promise_type> _handle;
+
+  void start(CoroutineExecutor &executor, std::atomic<int> &remaining) {
+    _handle.promise().remaining = &remaining;
+    executor.post(_handle);
+  }
+};
+
+/*
+ * Bounded single-producer single-consumer buffer between two stages. A
+ * sender suspends while the buffer is full and a receiver while it is empty;
+ * the other side resumes it through the executor.
+ */
+template <class T>
+class Channel {
+  std::mutex _mutex;
+  std::deque<T> _items;
+  size_t _capacity;
+  bool _closed;
+  CoroutineExecutor &_executor;
+  struct SendAwaiter;
+  struct ReceiveAwaiter;
+  SendAwaiter *_blockedSender;
+  ReceiveAwaiter *_blockedReceiver;
+
+  static uint64_t now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  struct SendAwaiter {
+    Channel &channel;
+    T item;
+    StageMetrics &metrics;
+    std::coroutine_handle<> handle;
+    uint64_t suspendedAt = 0;
+
+    bool await_ready() {
+      return false;
+    }
+    bool await_suspend(std::coroutine_handle<> h) {
+      std::coroutine_handle<> wake;
+      {
+	std::lock_guard<std::mutex> lock(channel._mutex);
+	metrics.occupancySum += static_cast<double>(channel._items.size()) / channel._capacity;
+	metrics.occupancySamples++;
+	if(channel._blockedReceiver) {
+	  channel._blockedReceiver->item = std::move(item);
+	  wake = channel._blockedReceiver->handle;
+	  channel._blockedReceiver = nullptr;
+	}else if(channel._items.size() < channel._capacity) {
+	  channel._items.push_back(std::move(item));
+	}else {
+	  handle = h;
+	  suspendedAt = now();
+	  channel._blockedSender = this;
+	  return true;
+	}
+      }
+      /* outside the lock: without workers the receiver runs inline */
+      if(wake) channel._executor.post(wake);
+      return false;
+    }
+    void await_resume() {
+      if(suspendedAt) metrics.outputStallNs += now() - suspendedAt;
+    }
+  };
+
+  struct ReceiveAwaiter {
+    Channel &channel;
+    std::optional<T> item;
+    StageMetrics &metrics;
+    std::coroutine_handle<> handle;
+    uint64_t suspendedAt = 0;
+
+    bool await_ready() {
+      return false;
+    }
+    bool await_suspend(std::coroutine_handle<> h) {
+      std::coroutine_handle<> wake;
+      {
+	std::lock_guard<std::mutex> lock(channel._mutex);
+	if(!channel._items.empty()) {
+	  item = std::move(channel._items.front());
+	  channel._items.pop_front();
+	  if(channel._blockedSender) {
+	    channel._items.push_back(std::move(channel._blockedSender->item));
+	    wake = channel._blockedSender->handle;
+	    channel._blockedSender = nullptr;
+	  }
+	}else if(!channel._closed) {
+	  handle = h;
+	  suspendedAt = now();
+	  channel._blockedReceiver = this;
+	  return true;
+	}
+      }
+      if(wake) channel._executor.post(wake);
+      return false;
+    }
+    std::optional<T> await_resume() {
+      if(suspendedAt) metrics.inputStallNs += now() - suspendedAt;
+      return std::move(item);
+    }
+  };
+public:
+  Channel(size_t capacity, CoroutineExecutor &executor) :
+    _capacity(std::max<size_t>(1, capacity)),
+    _closed(false),
+    _executor(executor),
+    _blockedSender(nullptr),
+    _blockedReceiver(nullptr)
+  {
+  }
+
+  SendAwaiter send(T item, StageMetrics &metrics) {
+    return SendAwaiter{*this, std::move(item), metrics};
+  }
+
+  /* empty optional once the channel is closed and drained */
+  ReceiveAwaiter receive(StageMetrics &metrics) {
+    return ReceiveAwaiter{*this, std::nullopt, metrics};
+  }
+
+  void close() {
+    std::coroutine_handle<> wake;
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _closed = true;
+      if(_blockedReceiver) {
+	wake = _blockedReceiver->handle;
+	_blockedReceiver = nullptr;
+      }
+    }
+    if(wake) _executor.post(wake);
+  }
+};
+
+template <class S>
+struct PipelineOptions {
+  size_t depth = 64; /* items buffered between two stages */
+  double learningRate = 0.1;
+  int batchSize = 100;
+  int checkpointInterval = 0; /* batches between checkpoints, 0: never */
+  std::function<void(int, const Network<S> &)> checkpoint; /* batch id, snapshot taken right after its update */
+};
+
+struct PipelineMetrics {
+  StageMetrics load{"load"}, preprocess{"preprocess"}, train{"train"}, log{"log"};
+
+  void report(std::ostream &os) const {
+    load.report(os);
+    preprocess.report(os);
+    train.report(os);
+    log.report(os);
+  }
+};
+
+template <class S>
+struct PipelineSample {
+  uint32_t index;
+  std::vector<uint8_t> image; /* copied out of the data set by the load stage */
+  uint8_t label;
+  std::vector<S> target;
+};
+
+template <class S>
+struct PipelineResult {
+  uint32_t index;
+  double loss;
+  bool correct;
+  std::shared_ptr<Network<S> > snapshot; /* set on checkpoint batches */
+};
+
+/* reads each image out of the set, so the page faults of a mapped set are taken here rather than in training */
+template <class S>
+PipelineTask loadStage(MNistDataSet &set, Channel<PipelineSample<S> > &out, StageMetrics &metrics) {
+  auto start = std::chrono::steady_clock::now();
+  for(uint32_t sample = 0; sample < set.getNumImages(); sample++) {
+    TensorView<const uint8_t> image = set.getImage(sample);
+    PipelineSample<S> item{sample, std::vector<uint8_t>(image.data(), image.data() + image.size()), set.getLabel(sample), {}};
+    metrics.items++;
+    co_await out.send(std::move(item), metrics);
+  }
+  out.close();
+  metrics.totalNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+template <class S>
+PipelineTask preprocessStage(Channel<PipelineSample<S> > &in, Channel<PipelineSample<S> > &out, StageMetrics &metrics) {
+  auto start = std::chrono::steady_clock::now();
+  while(std::optional<PipelineSample<S> > item = co_await in.receive(metrics)) {
+    item->target.assign(10, 0);
+    item->target[item->label] = 1;
+    metrics.items++;
+    co_await out.send(std::move(*item), metrics);
+  }
+  out.close();
+  metrics.totalNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+/* forward, backward and update stay in one stage: SGD needs each update before the next batch's forward */
+template <class S>
+PipelineTask trainStage(Network<S> &net, uint32_t numImages, const PipelineOptions<S> &options, Channel<PipelineSample<S> > &in, Channel<PipelineResult<S> > &out, StageMetrics &metrics) {
+  auto start = std::chrono::steady_clock::now();
+  int batchId = 0;
+  while(std::optional<PipelineSample<S> > item = co_await in.receive(metrics)) {
+    TensorView<const S> output = net.forward(TensorView<const uint8_t>(item->image), static_cast<S>(1.0 / 256));
+    const bool correct = std::distance(output.begin(), std::max_element(output.begin(), output.end())) == item->label;
+    const double loss = static_cast<double>(net.calcLoss(item->target));
+    net.backward(item->target);
+    PipelineResult<S> result{item->index, loss, correct, nullptr};
+    if(item->index % options.batchSize == 0 || item->index == numImages - 1) {
+      net.updateParam(static_cast<S>(options.learningRate));
+      if(options.checkpoint && options.checkpointInterval > 0 && batchId % options.checkpointInterval == 0) result.snapshot = net.clone();
+      batchId++;
+    }
+    metrics.items++;
+    co_await out.send(std::move(result), metrics);
+  }
+  out.close();
+  metrics.totalNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+template <class S>
+PipelineTask logStage(uint32_t numImages, const PipelineOptions<S> &options, Channel<PipelineResult<S> > &in, std::pair<double, double> &epochResult, StageMetrics &metrics) {
+  auto start = std::chrono::steady_clock::now();
+  double sumLoss = 0, batchLoss = 0;
+  uint32_t numSamples = 0, numWrong = 0;
+  int batchId = 0;
+  while(std::optional<PipelineResult<S> > result = co_await in.receive(metrics)) {
+    sumLoss += result->loss;
+    batchLoss += result->loss;
+    numWrong += !result->correct;
+    numSamples++;
+    if(result->index % options.batchSize == 0 || result->index == numImages - 1) {
+      if(progressEnabled()) {
+	std::cout << std::fixed << std::setprecision(4) << "\rbatch loss[" << batchId << "]: " << batchLoss / options.batchSize;
+	std::cout.flush();
+      }
+      batchLoss = 0;
+      if(result->snapshot) options.checkpoint(batchId, *result->snapshot);
+      batchId++;
+    }
+    metrics.items++;
+  }
+  epochResult = std::make_pair(sumLoss / numSamples, static_cast<double>(numWrong) / numSamples);
+  metrics.totalNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+/*
+ * runEpoch for training as four coroutine stages (load, preprocess, train,
+ * log/checkpoint) connected by bounded channels of options.depth items, so
+ * that loading and logging overlap with training on the scheduler's
+ * workers. Loading copies the images out of the data set, which reads the
+ * image file only if the set is mapped (see MNistDataSet); an in-memory set
+ * was read when it was constructed. Samples are trained in order with the same update points as
+ * runEpoch, which gives the same weights. The train stage snapshots the
+ * network on checkpoint batches and the log stage hands the snapshot to
+ * options.checkpoint, so writing it does not hold up training.
+ */
+template <class S>
+std::pair<double, double> runPipelinedEpoch(Network<S> &net, MNistDataSet &set, const PipelineOptions<S> &options, PipelineMetrics &metrics) {
+  CoroutineExecutor executor;
+  Channel<PipelineSample<S> > loaded(options.depth, executor), preprocessed(options.depth, executor);
+  Channel<PipelineResult<S> > results(options.depth, executor);
+  std::pair<double, double> epochResult;
+  std::atomic<int> remaining(4);
+  logStage<S>(set.getNumImages(), options, results, epochResult, metrics.log).start(executor, remaining);
+  trainStage(net, set.getNumImages(), options, preprocessed, results, metrics.train).start(executor, remaining);
+  preprocessStage<S>(loaded, preprocessed, metrics.preprocess).start(executor, remaining);
+  loadStage<S>(set, loaded, metrics.load).start(executor, remaining);
+  executor.wait(remaining);
+  if(memoryReportEnabled()) {
+    std::cout << std::endl;
+    printMemoryReport(collectMemory(net, &set), std::cout);
+  }
+  return epochResult;
+}
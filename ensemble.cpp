@@ -0,0 +1,193 @@
+#pragma once
+
+#include <vector>
+#include <iostream>
+#include <memory>
+#include <cmath>
+#include <numeric>
+#include <algorithm>
+
+#include "neural_net.cpp"
+
+/*
+ * Inference-only layer l of several dense members side by side: member k
+ * reads inputs [inOffset, inOffset + in) of the packed input and writes
+ * outputs [outOffset, outOffset + out), so the weights form a block
+ * diagonal of which only the blocks are stored. As the last layer it
+ * fuses each member's softmax with their average into an output of one
+ * member's size.
+ */
+template <class S>
+struct BlockDiagonalLayer : public LayerBase<S> {
+  struct Block {
+    size_t inOffset, in;
+    size_t outOffset, out;
+    size_t weightOffset; /* rows of out weights, bias row last */
+  };
+  std::vector<Block> _blocks;
+  std::vector<S> _weights;
+  bool _averageSoftmax;
+  size_t _packedSize; /* outputs of all blocks, the size of _u; _outSize unless averageSoftmax */
+  TensorView<const S> _inputView;
+public:
+  using typename LayerBase<S>::ActivationType;
+
+  /* layers must be dense and of one activation type, SOFTMAX only with averageSoftmax */
+  BlockDiagonalLayer(const std::vector<std::shared_ptr<Layer<S>>> &layers, bool averageSoftmax) :
+    LayerBase<S>(sumSizes(layers, true), averageSoftmax ? layers[0]->_outSize : sumSizes(layers, false), layers[0]->_activationType),
+    _averageSoftmax(averageSoftmax),
+    _packedSize(sumSizes(layers, false))
+  {
+    size_t inOffset = 0, outOffset = 0;
+    for(auto &layer : layers) {
+      _blocks.push_back(Block{inOffset, layer->_inSize - 1, outOffset, layer->_outSize, _weights.size()});
+      for(const auto &row : layer->_w) {
+	_weights.insert(_weights.end(), row.begin(), row.end());
+      }
+      inOffset += layer->_inSize - 1;
+      outOffset += layer->_outSize;
+    }
+    this->_u.assign(_packedSize, 0);
+    this->_frozen = true;
+  }
+
+  TensorView<const S> forward(TensorView<const S> input) {
+    _inputView = input;
+    defaultScheduler().parallelFor(0, _blocks.size(), 1, [this](size_t b0, size_t b1) {
+      for(size_t b = b0; b < b1; b++) {
+	const Block &block = _blocks[b];
+	S *u = this->_u.data() + block.outOffset;
+	const S *w = _weights.data() + block.weightOffset;
+	std::fill(u, u + block.out, 0);
+	for(size_t i = 0; i < block.in; i++) {
+	  const S x = _inputView[block.inOffset + i];
+	  if(x == 0) continue;
+	  vec(u, block.out) += x * vec(w + i * block.out, block.out);
+	}
+	vec(u, block.out) += vec(w + block.in * block.out, block.out);
+      }
+    });
+    if(!_averageSoftmax) {
+      this->_activation->activation(this->_u, this->_output);
+      return this->_output;
+    }
+    /* softmax of each block, accumulated into the average without storing the members' outputs */
+    using std::exp;
+    std::fill(this->_output.begin(), this->_output.end(), 0);
+    for(const Block &block : _blocks) {
+      S *u = this->_u.data() + block.outOffset;
+      const S max = *std::max_element(u, u + block.out);
+      vec(u, block.out) = map(vec(u, block.out) - max, [](S x) {return exp(x);});
+      const S sum = std::accumulate(u, u + block.out, static_cast<S>(0));
+      vec(this->_output) += vec(u, block.out) / (sum * static_cast<S>(_blocks.size()));
+    }
+    return this->_output;
+  }
+
+  std::vector<S> backpropagate(const std::vector<S> &delta) {
+    return std::vector<S>(this->_inSize - 1, 0);
+  }
+
+  void updateGrad(const std::vector<S> &delta) {
+  }
+
+  void updateParam(S learningRate) {
+  }
+
+  std::shared_ptr<LayerBase<S>> clone() const {
+    return std::make_shared<BlockDiagonalLayer<S> >(*this);
+  }
+
+  bool canClone() const {
+    return true;
+  }
+
+  void addMemory(MemoryStats &stats) const {
+    LayerBase<S>::addMemory(stats);
+    stats.weights += vectorBytes(_weights);
+  }
+
+private:
+  static size_t sumSizes(const std::vector<std::shared_ptr<Layer<S>>> &layers, bool in) {
+    size_t sum = 0;
+    for(auto &layer : layers) sum += in ? layer->_inSize - 1 : layer->_outSize;
+    return sum;
+  }
+};
+
+/*
+ * Inference-only ensemble packed into one network: the members' first
+ * layers stacked along the output dimension into one dense Layer, which
+ * reads each input once, and the later layers as BlockDiagonalLayers,
+ * the last one averaging the members' softmax outputs. A forward runs all
+ * members in one pass and returns the averaged class probabilities, so
+ * an Ensemble can be evaluated wherever a Network can. Members need the
+ * same number of dense layers, input and output size and activation per
+ * layer; hidden sizes may differ. All layers are frozen.
+ */
+template <class S>
+class Ensemble : public Network<S> {
+  size_t _numMembers;
+public:
+  Ensemble() :
+    _numMembers(0)
+  {
+  }
+
+  /* false if the members cannot be packed */
+  bool pack(const std::vector<std::shared_ptr<Network<S>>> &members) {
+    typedef typename Layer<S>::ActivationType ActivationType;
+    if(members.empty() || members[0]->getNumLayers() < 2) {
+      std::cerr << "Ensemble: needs members with at least two layers" << std::endl;
+      return false;
+    }
+    const size_t numLayers = members[0]->getNumLayers();
+    std::vector<std::vector<std::shared_ptr<Layer<S>>>> layers(numLayers);
+    for(size_t k = 0; k < members.size(); k++) {
+      if(members[k]->getNumLayers() != numLayers) {
+	std::cerr << "Ensemble: member " << k << " has " << members[k]->getNumLayers() << " layers, member 0 has " << numLayers << std::endl;
+	return false;
+      }
+      for(size_t l = 0; l < numLayers; l++) {
+	std::shared_ptr<Layer<S>> layer = std::dynamic_pointer_cast<Layer<S>>(members[k]->getLayer(l));
+	const bool last = l + 1 == numLayers;
+	if(!layer || layer->_activationType != members[0]->getLayer(l)->_activationType || (layer->_activationType == ActivationType::SOFTMAX) != last
+	   || (l == 0 && layer->_inSize != members[0]->getLayer(0)->_inSize) || (last && layer->_outSize != members[0]->getLayer(l)->_outSize)) {
+	  std::cerr << "Ensemble: layer " << l << " of member " << k << " does not match member 0, or is not dense" << std::endl;
+	  return false;
+	}
+	layers[l].push_back(layer);
+      }
+    }
+    this->_layers.clear();
+    size_t stacked = 0;
+    for(auto &layer : layers[0]) stacked += layer->_outSize;
+    auto first = std::make_shared<Layer<S> >(layers[0][0]->_inSize - 1, stacked, layers[0][0]->_activationType);
+    for(size_t i = 0; i < first->_inSize; i++) {
+      size_t offset = 0;
+      for(auto &layer : layers[0]) {
+	std::copy(layer->_w[i].begin(), layer->_w[i].end(), first->_w[i].begin() + offset);
+	offset += layer->_outSize;
+      }
+    }
+    first->_w_grad.clear(); /* frozen, never accumulated */
+    first->_frozen = true;
+    this->addLayer(first);
+    for(size_t l = 1; l < numLayers; l++) {
+      this->addLayer(std::make_shared<BlockDiagonalLayer<S> >(layers[l], l + 1 == numLayers));
+    }
+    _numMembers = members.size();
+    return true;
+  }
+
+  size_t getNumMembers() const {
+    return _numMembers;
+  }
+
+  std::shared_ptr<Network<S>> clone() const {
+    auto copy = std::make_shared<Ensemble<S> >();
+    if(!this->cloneLayersTo(*copy)) return nullptr;
+    copy->_numMembers = _numMembers;
+    return copy;
+  }
+};
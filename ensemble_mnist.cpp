@@ -0,0 +1,67 @@
+#include <utility>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <functional>
+
+#include "trainer.cpp"
+#include "ensemble.cpp"
+
+/* microseconds per test image for one forward of forward(image) */
+double latency(MNistDataSet &testSet, const std::function<void(TensorView<const uint8_t>)> &forward) {
+  auto start = std::chrono::steady_clock::now();
+  for(uint32_t sample = 0; sample < testSet.getNumImages(); sample++) {
+    forward(testSet.getImage(sample));
+  }
+  return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / testSet.getNumImages();
+}
+
+int main(int argc, char **argv) {
+  size_t numMembers = argc > 1 ? std::atoi(argv[1]) : 4;
+  int numEpochs = argc > 2 ? std::atoi(argv[2]) : 2;
+
+  MNistDataSet trainSet("mnist/train-images-idx3-ubyte", "mnist/train-labels-idx1-ubyte");
+  MNistDataSet testSet("mnist/t10k-images-idx3-ubyte", "mnist/t10k-labels-idx1-ubyte");
+  const float scale = 1.0 / 256;
+
+  /* members of different hidden sizes */
+  progressEnabled() = false;
+  std::vector<std::shared_ptr<Network<float>>> members;
+  for(size_t k = 0; k < numMembers; k++) {
+    auto net = std::make_shared<Network<float> >();
+    net->addLayer(trainSet.getNumRows() * trainSet.getNumColumns(), 100 + 50 * k, Layer<float>::ActivationType::RELU);
+    net->addLayer(100 + 50 * k, 10, Layer<float>::ActivationType::SOFTMAX);
+    for(int epoch = 0; epoch < numEpochs; epoch++) {
+      runEpoch(*net, trainSet, true, 0.2);
+    }
+    std::cout << "member " << k << ": hidden " << 100 + 50 * k << ", test error " << evaluateErrorRate(*net, testSet) << std::endl;
+    members.push_back(net);
+  }
+
+  Ensemble<float> ensemble;
+  if(!ensemble.pack(members)) return 1;
+  std::cout << "ensemble of " << ensemble.getNumMembers() << ": test error " << evaluateErrorRate(ensemble, testSet) << std::endl;
+
+  /* the packed forward against running the members one by one and averaging their outputs */
+  std::vector<float> average(10);
+  float maxDiff = 0;
+  for(uint32_t sample = 0; sample < testSet.getNumImages(); sample++) {
+    std::fill(average.begin(), average.end(), 0);
+    for(auto &member : members) {
+      vec(average) += vec(member->forward(testSet.getImage(sample), scale)) / static_cast<float>(numMembers);
+    }
+    TensorView<const float> out = ensemble.forward(testSet.getImage(sample), scale);
+    for(size_t j = 0; j < average.size(); j++) maxDiff = std::max(maxDiff, std::abs(out[j] - average[j]));
+  }
+  std::cout << "max output difference to averaged members: " << maxDiff << std::endl;
+
+  double single = latency(testSet, [&](TensorView<const uint8_t> image) {members[0]->forward(image, scale);});
+  double separate = latency(testSet, [&](TensorView<const uint8_t> image) {
+    std::fill(average.begin(), average.end(), 0);
+    for(auto &member : members) {
+      vec(average) += vec(member->forward(image, scale)) / static_cast<float>(numMembers);
+    }
+  });
+  double packed = latency(testSet, [&](TensorView<const uint8_t> image) {ensemble.forward(image, scale);});
+  std::cout << std::fixed << std::setprecision(2) << "usec/image: member 0 alone " << single << ", members one by one " << separate << ", packed ensemble " << packed << std::endl;
+}
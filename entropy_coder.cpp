@@ -0,0 +1,262 @@
+#pragma once
+
+#include <vector>
+#include <queue>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+void putUInt32(std::vector<uint8_t> &out, uint32_t x) {
+  for(int b = 0; b < 4; b++) {
+    out.push_back(static_cast<uint8_t>(x >> (8 * b)));
+  }
+}
+
+uint32_t getUInt32(const uint8_t *in) {
+  return static_cast<uint32_t>(in[0]) | (static_cast<uint32_t>(in[1]) << 8) | (static_cast<uint32_t>(in[2]) << 16) | (static_cast<uint32_t>(in[3]) << 24);
+}
+
+/* canonical Huffman code over bytes, code lengths limited to maxLength for a single table lookup per symbol */
+class HuffmanCode {
+public:
+  static const int maxLength = 12; /* 8 KB table stays in L1 */
+  std::vector<uint8_t> _lengths; /* size: 256, 0 for unused symbols */
+  std::vector<uint16_t> _codes; /* size: 256 */
+  std::vector<uint16_t> _table; /* size: 2^maxLength, (symbol << 4) | length */
+
+  HuffmanCode() :
+    _lengths(256, 0),
+    _codes(256, 0)
+  {
+  }
+
+  void build(const std::vector<uint64_t> &frequencies) {
+    std::vector<uint64_t> freq = frequencies;
+    while(true) {
+      buildLengths(freq);
+      if(*std::max_element(_lengths.begin(), _lengths.end()) <= maxLength) break;
+      for(uint64_t &f : freq) {
+	if(f > 0) f = (f + 1) / 2;
+      }
+    }
+    assignCodes();
+  }
+
+  void buildLengths(const std::vector<uint64_t> &freq) {
+    typedef std::pair<uint64_t, int> Node;
+    std::priority_queue<Node, std::vector<Node>, std::greater<Node> > heap;
+    std::vector<int> parent;
+    for(int s = 0; s < 256; s++) {
+      parent.push_back(-1);
+      if(freq[s] > 0) heap.push(Node(freq[s], s));
+    }
+    std::fill(_lengths.begin(), _lengths.end(), 0);
+    if(heap.size() == 1) {
+      _lengths[heap.top().second] = 1;
+      return;
+    }
+    while(heap.size() > 1) {
+      Node a = heap.top();
+      heap.pop();
+      Node b = heap.top();
+      heap.pop();
+      parent.push_back(-1);
+      parent[a.second] = parent[b.second] = parent.size() - 1;
+      heap.push(Node(a.first + b.first, parent.size() - 1));
+    }
+    for(int s = 0; s < 256; s++) {
+      if(freq[s] == 0) continue;
+      int length = 0;
+      for(int n = s; parent[n] >= 0; n = parent[n]) length++;
+      _lengths[s] = length;
+    }
+  }
+
+  void assignCodes() {
+    std::vector<int> symbols;
+    for(int s = 0; s < 256; s++) {
+      if(_lengths[s] > 0) symbols.push_back(s);
+    }
+    std::sort(symbols.begin(), symbols.end(), [this](int a, int b) {
+      return _lengths[a] != _lengths[b] ? _lengths[a] < _lengths[b] : a < b;
+    });
+    uint32_t code = 0;
+    int length = symbols.empty() ? 0 : _lengths[symbols[0]];
+    _table.assign(1 << maxLength, 0);
+    for(int s : symbols) {
+      code <<= (_lengths[s] - length);
+      length = _lengths[s];
+      _codes[s] = code;
+      const uint32_t first = code << (maxLength - length), count = 1 << (maxLength - length);
+      for(uint32_t k = 0; k < count; k++) {
+	_table[first + k] = static_cast<uint16_t>((s << 4) | length);
+      }
+      code++;
+    }
+  }
+
+  static uint64_t bigEndian(uint64_t word) {
+    const uint32_t probe = 1;
+    if(*reinterpret_cast<const uint8_t *>(&probe) == 0) return word;
+    return __builtin_bswap64(word);
+  }
+
+  /* false for lengths the table cannot hold: longer than maxLength, or more codes than fit (Kraft sum over 1) */
+  bool setLengths(const uint8_t *lengths) {
+    uint32_t kraft = 0;
+    for(int s = 0; s < 256; s++) {
+      if(lengths[s] > maxLength) return false;
+      if(lengths[s] > 0) kraft += 1 << (maxLength - lengths[s]);
+    }
+    if(kraft > (1u << maxLength)) return false;
+    _lengths.assign(lengths, lengths + 256);
+    assignCodes();
+    return true;
+  }
+
+  void encode(const uint8_t *in, size_t n, std::vector<uint8_t> &out) const {
+    uint64_t buffer = 0;
+    int numBits = 0;
+    for(size_t k = 0; k < n; k++) {
+      buffer = (buffer << _lengths[in[k]]) | _codes[in[k]];
+      numBits += _lengths[in[k]];
+      while(numBits >= 8) {
+	numBits -= 8;
+	out.push_back(static_cast<uint8_t>(buffer >> numBits));
+      }
+    }
+    if(numBits > 0) {
+      out.push_back(static_cast<uint8_t>(buffer << (8 - numBits)));
+    }
+  }
+
+  /*
+   * MSB-first bit buffer, one table lookup per symbol. Refills load 8 bytes at
+   * once; the bits of a partially consumed byte are loaded again by the next
+   * refill into the same position, which leaves them unchanged.
+   */
+  void decode(const uint8_t *in, size_t inBytes, uint8_t *out, size_t n) const {
+    const uint16_t *table = _table.data(); /* out may alias members, keep the table pointer local */
+    uint64_t buffer = 0;
+    int numBits = 0;
+    size_t pos = 0;
+    for(size_t k = 0; k < n; k++) {
+      if(numBits <= 56) {
+	if(pos + 8 <= inBytes) {
+	  uint64_t word;
+	  std::memcpy(&word, in + pos, 8);
+	  buffer |= bigEndian(word) >> numBits;
+	  const int numBytes = (63 - numBits) >> 3;
+	  pos += numBytes;
+	  numBits += 8 * numBytes;
+	}else {
+	  while(numBits <= 56) {
+	    uint64_t byte = pos < inBytes ? in[pos] : 0;
+	    pos++;
+	    buffer |= byte << (56 - numBits);
+	    numBits += 8;
+	  }
+	}
+      }
+      const uint16_t entry = table[buffer >> (64 - maxLength)];
+      const int length = entry & 0xf;
+      out[k] = static_cast<uint8_t>(entry >> 4);
+      buffer <<= length;
+      numBits -= length;
+    }
+  }
+};
+
+/* independently decodable piece of a coded stream */
+struct HuffmanChunk {
+  const HuffmanCode *code;
+  const uint8_t *in;
+  size_t inBytes;
+  uint8_t *out;
+  size_t numSymbols;
+};
+
+/*
+ * Stream layout: 256 code lengths, chunk count, then (symbol count, byte
+ * count) per chunk followed by the chunk payloads. Each chunk starts on a
+ * byte boundary so that chunks decode in parallel.
+ */
+void encodeHuffmanStream(const uint8_t *in, size_t n, std::vector<uint8_t> &out, size_t chunkSymbols = 1 << 16) {
+  std::vector<uint64_t> freq(256, 0);
+  for(size_t k = 0; k < n; k++) {
+    freq[in[k]]++;
+  }
+  HuffmanCode code;
+  code.build(freq);
+  out.insert(out.end(), code._lengths.begin(), code._lengths.end());
+  const size_t numChunks = (n + chunkSymbols - 1) / chunkSymbols;
+  putUInt32(out, numChunks);
+  std::vector<std::vector<uint8_t> > payloads(numChunks);
+  for(size_t c = 0; c < numChunks; c++) {
+    const size_t begin = c * chunkSymbols, count = std::min(chunkSymbols, n - begin);
+    code.encode(in + begin, count, payloads[c]);
+    putUInt32(out, count);
+    putUInt32(out, payloads[c].size());
+  }
+  for(const auto &payload : payloads) {
+    out.insert(out.end(), payload.begin(), payload.end());
+  }
+}
+
+/*
+ * Parses a stream written by encodeHuffmanStream, which must end by end
+ * and hold exactly outSize symbols; returns the bytes consumed, or 0 (and
+ * adds no chunks) if the stream is malformed, so that corrupt input never
+ * makes the decoder read or write out of bounds.
+ */
+size_t parseHuffmanStream(const uint8_t *in, const uint8_t *end, HuffmanCode &code, uint8_t *out, size_t outSize, std::vector<HuffmanChunk> &chunks) {
+  if(end - in < 260 || !code.setLengths(in)) return 0;
+  const uint8_t *p = in + 256;
+  const size_t numChunks = getUInt32(p);
+  p += 4;
+  if(numChunks > static_cast<size_t>(end - p) / 8) return 0;
+  const uint8_t *payload = p + 8 * numChunks;
+  const size_t firstChunk = chunks.size();
+  size_t numSymbols = 0;
+  for(size_t c = 0; c < numChunks; c++) {
+    HuffmanChunk chunk;
+    chunk.code = &code;
+    chunk.numSymbols = getUInt32(p);
+    chunk.inBytes = getUInt32(p + 4);
+    if(chunk.numSymbols > outSize - numSymbols || chunk.inBytes > static_cast<size_t>(end - payload)) {
+      chunks.erase(chunks.begin() + firstChunk, chunks.end());
+      return 0;
+    }
+    chunk.in = payload;
+    chunk.out = out + numSymbols;
+    p += 8;
+    payload += chunk.inBytes;
+    numSymbols += chunk.numSymbols;
+    chunks.push_back(chunk);
+  }
+  if(numSymbols != outSize) {
+    chunks.erase(chunks.begin() + firstChunk, chunks.end());
+    return 0;
+  }
+  return payload - in;
+}
+
+void decodeHuffmanChunks(const std::vector<HuffmanChunk> &chunks, int numThreads) {
+  std::atomic<size_t> next(0);
+  auto worker = [&chunks, &next]() {
+    for(size_t c = next++; c < chunks.size(); c = next++) {
+      const HuffmanChunk &chunk = chunks[c];
+      chunk.code->decode(chunk.in, chunk.inBytes, chunk.out, chunk.numSymbols);
+    }
+  };
+  std::vector<std::thread> threads;
+  for(int t = 1; t < numThreads; t++) {
+    threads.push_back(std::thread(worker));
+  }
+  worker();
+  for(auto &thread : threads) {
+    thread.join();
+  }
+}
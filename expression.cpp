@@ -0,0 +1,237 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <algorithm>
+
+/*
+ * Lazy elementwise expressions. vec() wraps a vector (or pointer and size),
+ * arithmetic between wrapped vectors and scalars builds an expression type
+ * instead of a temporary, and assigning an expression to a wrapped vector
+ * evaluates the whole chain in one loop:
+ *
+ *   vec(w) -= learningRate / n * vec(g);
+ *   vec(delta) = (vec(y) - vec(t)) * map(vec(u), reluGradient);
+ *
+ * Element i of the result depends only on element i of the operands, so
+ * the destination may also appear on the right-hand side.
+ */
+
+/* no loop-carried dependencies, so no alias checks are needed to vectorize */
+#if defined(__clang__)
+#define NN_IVDEP _Pragma("clang loop vectorize(assume_safety)")
+#elif defined(__GNUC__)
+#define NN_IVDEP _Pragma("GCC ivdep")
+#else
+#define NN_IVDEP
+#endif
+
+template <class E>
+struct Expression {
+  const E &self() const {
+    return static_cast<const E &>(*this);
+  }
+};
+
+template <class S>
+struct ScalarExpr : public Expression<ScalarExpr<S> > {
+  typedef S value_type;
+  S _value;
+
+  ScalarExpr(S value) :
+    _value(value)
+  {
+  }
+
+  S operator[](size_t) const {
+    return _value;
+  }
+};
+
+template <class S>
+struct VectorExpr : public Expression<VectorExpr<S> > {
+  typedef S value_type;
+  const S *_data;
+  size_t _size;
+
+  VectorExpr(const S *data, size_t size) :
+    _data(data),
+    _size(size)
+  {
+  }
+
+  S operator[](size_t i) const {
+    return _data[i];
+  }
+};
+
+struct AddOp {
+  template <class S>
+  static S apply(S a, S b) {
+    return a + b;
+  }
+};
+
+struct SubOp {
+  template <class S>
+  static S apply(S a, S b) {
+    return a - b;
+  }
+};
+
+struct MulOp {
+  template <class S>
+  static S apply(S a, S b) {
+    return a * b;
+  }
+};
+
+struct DivOp {
+  template <class S>
+  static S apply(S a, S b) {
+    return a / b;
+  }
+};
+
+template <class L, class R, class Op>
+struct BinaryExpr : public Expression<BinaryExpr<L, R, Op> > {
+  typedef typename L::value_type value_type;
+  L _l;
+  R _r;
+
+  BinaryExpr(const L &l, const R &r) :
+    _l(l),
+    _r(r)
+  {
+  }
+
+  value_type operator[](size_t i) const {
+    return Op::apply(_l[i], _r[i]);
+  }
+};
+
+/* f applied to each element */
+template <class A, class F>
+struct MapExpr : public Expression<MapExpr<A, F> > {
+  typedef typename A::value_type value_type;
+  A _a;
+  F _f;
+
+  MapExpr(const A &a, const F &f) :
+    _a(a),
+    _f(f)
+  {
+  }
+
+  value_type operator[](size_t i) const {
+    return _f(_a[i]);
+  }
+};
+
+/* blocks of a fixed length, which compilers vectorize even without a cost model allowing epilogues */
+template <class S, class E, class Assign>
+void evaluate(S *dst, size_t size, const E &e, const Assign &assign) {
+  const size_t block = 8, blocked = size / block * block;
+  for(size_t i = 0; i < blocked; i += block) {
+    NN_IVDEP
+    for(size_t k = 0; k < block; k++) {
+      assign(dst[i + k], e[i + k]);
+    }
+  }
+  for(size_t i = blocked; i < size; i++) {
+    assign(dst[i], e[i]);
+  }
+}
+
+/* a writable vector, also usable as an operand */
+template <class S>
+struct VectorRef : public Expression<VectorRef<S> > {
+  typedef S value_type;
+  S *_data;
+  size_t _size;
+
+  VectorRef(S *data, size_t size) :
+    _data(data),
+    _size(size)
+  {
+  }
+
+  S operator[](size_t i) const {
+    return _data[i];
+  }
+
+  template <class E>
+  VectorRef &operator=(const Expression<E> &e) {
+    evaluate(_data, _size, e.self(), [](S &d, S x) {d = x;});
+    return *this;
+  }
+
+  VectorRef &operator=(S value) {
+    std::fill(_data, _data + _size, value);
+    return *this;
+  }
+
+  template <class E>
+  VectorRef &operator+=(const Expression<E> &e) {
+    evaluate(_data, _size, e.self(), [](S &d, S x) {d += x;});
+    return *this;
+  }
+
+  template <class E>
+  VectorRef &operator-=(const Expression<E> &e) {
+    evaluate(_data, _size, e.self(), [](S &d, S x) {d -= x;});
+    return *this;
+  }
+
+  template <class E>
+  VectorRef &operator*=(const Expression<E> &e) {
+    evaluate(_data, _size, e.self(), [](S &d, S x) {d *= x;});
+    return *this;
+  }
+};
+
+template <class S>
+VectorRef<S> vec(std::vector<S> &v) {
+  return VectorRef<S>(v.data(), v.size());
+}
+
+template <class S>
+VectorExpr<S> vec(const std::vector<S> &v) {
+  return VectorExpr<S>(v.data(), v.size());
+}
+
+template <class S>
+VectorRef<S> vec(S *data, size_t size) {
+  return VectorRef<S>(data, size);
+}
+
+template <class S>
+VectorExpr<S> vec(const S *data, size_t size) {
+  return VectorExpr<S>(data, size);
+}
+
+template <class A, class F>
+MapExpr<A, F> map(const Expression<A> &a, const F &f) {
+  return MapExpr<A, F>(a.self(), f);
+}
+
+#define NN_EXPRESSION_OPERATOR(op, Op)						\
+  template <class L, class R>							\
+  BinaryExpr<L, R, Op> operator op(const Expression<L> &l, const Expression<R> &r) { \
+    return BinaryExpr<L, R, Op>(l.self(), r.self());				\
+  }										\
+  template <class R>								\
+  BinaryExpr<ScalarExpr<typename R::value_type>, R, Op> operator op(typename R::value_type l, const Expression<R> &r) { \
+    return BinaryExpr<ScalarExpr<typename R::value_type>, R, Op>(ScalarExpr<typename R::value_type>(l), r.self()); \
+  }										\
+  template <class L>								\
+  BinaryExpr<L, ScalarExpr<typename L::value_type>, Op> operator op(const Expression<L> &l, typename L::value_type r) { \
+    return BinaryExpr<L, ScalarExpr<typename L::value_type>, Op>(l.self(), ScalarExpr<typename L::value_type>(r)); \
+  }
+
+NN_EXPRESSION_OPERATOR(+, AddOp)
+NN_EXPRESSION_OPERATOR(-, SubOp)
+NN_EXPRESSION_OPERATOR(*, MulOp)
+NN_EXPRESSION_OPERATOR(/, DivOp)
+
+#undef NN_EXPRESSION_OPERATOR
@@ -0,0 +1,55 @@
+#include <utility>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+
+#include "trainer.cpp"
+#include "quantize.cpp"
+#include "activation_cache.cpp"
+
+template <class S>
+double timedEpoch(Network<S> &net, MNistDataSet &trainSet, const ForwardFunctionT<S> &forward, double learningRate) {
+  auto start = std::chrono::steady_clock::now();
+  runEpoch(net, trainSet, forward, true, learningRate);
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char **argv) {
+  int numEpochs = argc > 1 ? std::atoi(argv[1]) : 3;
+  int numFinetuneEpochs = argc > 2 ? std::atoi(argv[2]) : 3;
+  std::string cachePath = argc > 3 ? argv[3] : "";
+
+  MNistDataSet trainSet("mnist/train-images-idx3-ubyte", "mnist/train-labels-idx1-ubyte");
+  MNistDataSet testSet("mnist/t10k-images-idx3-ubyte", "mnist/t10k-labels-idx1-ubyte");
+
+  Network<float> net;
+  net.addLayer(trainSet.getNumRows() * trainSet.getNumColumns(), 300, Layer<float>::ActivationType::RELU);
+  net.addLayer(300, 10, Layer<float>::ActivationType::SOFTMAX);
+  for(int epoch = 0; epoch < numEpochs; epoch++) {
+    runEpoch(net, trainSet, true, 0.2);
+  }
+  std::cout << std::endl << "pretrained: test error " << calcErrorRate(net, testSet, testSet.getNumImages()) << std::endl;
+
+  /* retrain a fresh output layer on top of the frozen hidden layer, with and without the cache */
+  ForwardFunctionT<float> uncached = [](Network<float> &net, MNistDataSet &set, uint32_t sample) {
+    return net.forward(set.getImage(sample), 1.0f / 256);
+  };
+  std::shared_ptr<ActivationCache<float>> cache;
+  for(int cached = 0; cached < 2; cached++) {
+    Network<float> finetuned;
+    finetuned.addLayer(net.getLayer(0));
+    finetuned.addLayer(300, 10, Layer<float>::ActivationType::SOFTMAX);
+    finetuned.freeze(1);
+    if(cached) {
+      cache = makeActivationCache(finetuned, trainSet, cachePath);
+      if(!cachePath.empty()) std::cout << cachePath << ": " << cache->getNumFilled() << " rows reused" << std::endl;
+    }
+    const ForwardFunctionT<float> forward = cached ? cachedForward(*cache) : uncached;
+    for(int epoch = 0; epoch < numFinetuneEpochs; epoch++) {
+      double seconds = timedEpoch(finetuned, trainSet, forward, 0.2);
+      std::cout << std::endl << (cached ? "cached" : "uncached") << " epoch " << epoch << ": " << seconds << " sec";
+    }
+    std::cout << std::endl << (cached ? "cached" : "uncached") << ": test error "
+	      << calcErrorRate(finetuned, testSet, testSet.getNumImages()) << std::endl;
+  }
+}
@@ -0,0 +1,335 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <iostream>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "neural_net.cpp"
+
+/*
+ * Q-format fixed point number stored in int16 with FracBits fractional bits.
+ * All arithmetic, including exp and log, is done on integers so that results
+ * are bit-exact on every platform. Out of range results saturate.
+ */
+template <int FracBits>
+class Fixed {
+public:
+  static const int fracBits = FracBits;
+  static const int32_t one = 1 << FracBits;
+  int16_t _raw;
+
+  Fixed() : _raw(0) {}
+  Fixed(int x) : _raw(saturate(static_cast<int64_t>(x) * one)) {}
+  Fixed(double x) : _raw(saturate(std::llround(x * one))) {}
+
+  static int16_t saturate(int64_t raw) {
+    return static_cast<int16_t>(std::max<int64_t>(INT16_MIN, std::min<int64_t>(INT16_MAX, raw)));
+  }
+
+  /* rounds half up; relies on arithmetic right shift of negative values */
+  static int64_t roundShift(int64_t v, int shift) {
+    return (v + (static_cast<int64_t>(1) << (shift - 1))) >> shift;
+  }
+
+  static Fixed fromRaw(int64_t raw) {
+    Fixed x;
+    x._raw = saturate(raw);
+    return x;
+  }
+
+  explicit operator double() const {
+    return static_cast<double>(_raw) / one;
+  }
+
+  friend Fixed operator+(Fixed a, Fixed b) {return fromRaw(static_cast<int64_t>(a._raw) + b._raw);}
+  friend Fixed operator-(Fixed a, Fixed b) {return fromRaw(static_cast<int64_t>(a._raw) - b._raw);}
+  friend Fixed operator*(Fixed a, Fixed b) {return fromRaw(roundShift(static_cast<int64_t>(a._raw) * b._raw, FracBits));}
+  friend Fixed operator/(Fixed a, Fixed b) {
+    if(b._raw == 0) return fromRaw(a._raw >= 0 ? INT16_MAX : INT16_MIN);
+    return fromRaw(static_cast<int64_t>(a._raw) * one / b._raw);
+  }
+  Fixed operator-() const {return fromRaw(-static_cast<int64_t>(_raw));}
+  Fixed &operator+=(Fixed b) {return *this = *this + b;}
+  Fixed &operator-=(Fixed b) {return *this = *this - b;}
+  Fixed &operator*=(Fixed b) {return *this = *this * b;}
+  Fixed &operator/=(Fixed b) {return *this = *this / b;}
+  friend bool operator==(Fixed a, Fixed b) {return a._raw == b._raw;}
+  friend bool operator!=(Fixed a, Fixed b) {return a._raw != b._raw;}
+  friend bool operator<(Fixed a, Fixed b) {return a._raw < b._raw;}
+  friend bool operator>(Fixed a, Fixed b) {return a._raw > b._raw;}
+  friend bool operator<=(Fixed a, Fixed b) {return a._raw <= b._raw;}
+  friend bool operator>=(Fixed a, Fixed b) {return a._raw >= b._raw;}
+
+  friend std::ostream &operator<<(std::ostream &os, Fixed x) {
+    return os << static_cast<double>(x);
+  }
+};
+
+typedef Fixed<12> Fixed16;
+
+/* 2^(x log2 e): integer part by shifting, fractional part by a cubic in Q15 */
+template <int F>
+Fixed<F> exp(Fixed<F> x) {
+  const int64_t log2e = 23637; /* Q14 */
+  int64_t t = static_cast<int64_t>(x._raw) * log2e; /* Q(F + 14) */
+  int64_t n = t >> (F + 14);
+  int64_t f = (t - n * (static_cast<int64_t>(1) << (F + 14))) >> (F + 14 - 15); /* Q15, [0, 1) */
+  int64_t p = 2536;
+  p = ((p * f) >> 15) + 7436;
+  p = ((p * f) >> 15) + 22788;
+  p = ((p * f) >> 15) + 32768; /* 2^f in Q15 */
+  int64_t shift = n + F - 15;
+  if(shift >= 0) {
+    return shift > 16 ? Fixed<F>::fromRaw(INT16_MAX) : Fixed<F>::fromRaw(p << shift);
+  }
+  return -shift > 32 ? Fixed<F>() : Fixed<F>::fromRaw(Fixed<F>::roundShift(p, -shift));
+}
+
+/* (msb - F + log2(mantissa)) ln 2, log2 of the mantissa by a cubic in Q15 */
+template <int F>
+Fixed<F> log(Fixed<F> x) {
+  if(x._raw <= 0) return Fixed<F>::fromRaw(INT16_MIN);
+  int64_t raw = x._raw;
+  int msb = 0;
+  while((raw >> (msb + 1)) != 0) msb++;
+  int64_t f = ((raw << 15) >> msb) - 32768; /* Q15, [0, 1) */
+  int64_t p = 5425;
+  p = ((p * f) >> 15) - 19259;
+  p = ((p * f) >> 15) + 46645;
+  p = (p * f) >> 15; /* log2(1 + f) in Q15 */
+  int64_t log2x = static_cast<int64_t>(msb - F) * 32768 + p;
+  const int64_t ln2 = 22713; /* Q15 */
+  return Fixed<F>::fromRaw(Fixed<F>::roundShift(log2x * ln2, 30 - F));
+}
+
+/*
+ * Softmax with the exp terms summed as raw int64: summed in Q3.12 the total
+ * saturates just below 8, e.g. 10 equal logits came out as 0.125 each.
+ */
+template <>
+class SoftmaxActivation<Fixed16> : public Activation<Fixed16> {
+public:
+  void activation(TensorView<const Fixed16> input, TensorView<Fixed16> output) {
+    const Fixed16 max = *std::max_element(input.begin(), input.end());
+    int64_t sum = 0; /* at least one, from exp(max - max) */
+    for(size_t i = 0; i < input.size(); i++) {
+      output[i] = exp(input[i] - max);
+      sum += output[i]._raw;
+    }
+    for(size_t i = 0; i < output.size(); i++) {
+      output[i] = Fixed16::fromRaw((static_cast<int64_t>(output[i]._raw) * Fixed16::one + sum / 2) / sum);
+    }
+  }
+
+  void gradient(TensorView<const Fixed16> input, TensorView<Fixed16> output) {
+    std::copy(input.begin(), input.end(), output.begin()); // dummy
+  }
+};
+
+/* counter based generator (splitmix64), identical sequences on every platform */
+class FixedRandom {
+public:
+  static uint64_t mix(uint64_t z) {
+    z += 0x9e3779b97f4a7c15ull;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+  }
+
+  static uint32_t nextSeed() {
+    static uint32_t seed = 0;
+    return seed++;
+  }
+};
+
+/*
+ * int16 weights with int64 accumulators. Weights of input rows 2p and 2p+1
+ * are interleaved so that one pmaddwd multiplies a pair of inputs with four
+ * output columns; its int32 pair sums are sign-extended before they are
+ * added, since sums of Q2F products over 785 inputs or a batch of samples
+ * exceed int32. Gradients are kept in int64 (Q2F) and applied with
+ * stochastic rounding driven by FixedRandom, so training is deterministic.
+ */
+template <>
+struct Layer<Fixed16> : public LayerBase<Fixed16> {
+  typedef Fixed16 S;
+  static const int F = Fixed16::fracBits;
+  size_t _inPad, _outPad; /* inSize rounded up to 2, outSize to 8 */
+  std::vector<int16_t> _w; /* size: inPad * outPad, pairs of rows interleaved */
+  std::vector<int64_t> _w_grad; /* size: inPad * outPad, row major */
+  std::vector<int16_t> _x; /* size: inPad */
+  std::vector<int64_t> _acc; /* size: outPad */
+  std::vector<int16_t> _deltaWide; /* size: 2 * outPad, (delta[j], 0) pairs */
+  uint32_t _seed;
+  uint64_t _numUpdates;
+public:
+  Layer(size_t inSize, size_t outSize, ActivationType activationType) :
+    LayerBase<Fixed16>(inSize, outSize, activationType),
+    _inPad((this->_inSize + 1) / 2 * 2),
+    _outPad((outSize + 7) / 8 * 8),
+    _w(_inPad * _outPad, 0),
+    _w_grad(_inPad * _outPad, 0),
+    _x(_inPad, 0),
+    _acc(_outPad, 0),
+    _deltaWide(2 * _outPad, 0),
+    _seed(FixedRandom::nextSeed()),
+    _numUpdates(0)
+  {
+    /* same distribution as the float layer: uniform [0, 1) / inSize, rounded stochastically */
+    for(int i = 0; i < this->_inSize; i++) {
+      for(int j = 0; j < this->_outSize; j++) {
+	uint64_t r = FixedRandom::mix((static_cast<uint64_t>(_seed) << 40) ^ (i * _outPad + j));
+	int64_t scaled = static_cast<int64_t>(r >> 32) * Fixed16::one / this->_inSize; /* Q(F + 32) */
+	weight(i, j) = Fixed16::saturate((scaled + static_cast<int64_t>(r & 0xffffffffu)) >> 32);
+      }
+    }
+  }
+
+  int16_t &weight(size_t i, size_t j) {
+    return _w[((i / 2) * _outPad + j) * 2 + (i % 2)];
+  }
+
+#ifdef __SSE2__
+  /* acc[0..3] += the four int32 lanes of v, sign-extended */
+  static void addWidened(int64_t *acc, __m128i v) {
+    const __m128i sign = _mm_srai_epi32(v, 31);
+    __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i *>(acc));
+    __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i *>(acc + 2));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(acc), _mm_add_epi64(lo, _mm_unpacklo_epi32(v, sign)));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(acc + 2), _mm_add_epi64(hi, _mm_unpackhi_epi32(v, sign)));
+  }
+#endif
+
+  TensorView<const S> forward(TensorView<const S> input) {
+    this->_input.assign(input.begin(), input.end());
+    this->_input.push_back(static_cast<S>(1));
+    for(int i = 0; i < this->_inSize; i++) {
+      _x[i] = this->_input[i]._raw;
+    }
+    std::fill(_acc.begin(), _acc.end(), 0);
+    for(int p = 0; p < _inPad / 2; p++) {
+      const uint32_t pair = static_cast<uint16_t>(_x[2 * p]) | (static_cast<uint32_t>(static_cast<uint16_t>(_x[2 * p + 1])) << 16);
+      if(pair == 0) continue;
+      const int16_t *w = &_w[p * _outPad * 2];
+#ifdef __SSE2__
+      const __m128i xv = _mm_set1_epi32(static_cast<int32_t>(pair));
+      for(int j = 0; j < _outPad; j += 4) {
+	__m128i wv = _mm_loadu_si128(reinterpret_cast<const __m128i *>(w + 2 * j));
+	addWidened(&_acc[j], _mm_madd_epi16(wv, xv));
+      }
+#else
+      for(int j = 0; j < _outPad; j++) {
+	_acc[j] += static_cast<int64_t>(w[2 * j]) * _x[2 * p] + static_cast<int64_t>(w[2 * j + 1]) * _x[2 * p + 1];
+      }
+#endif
+    }
+    for(int j = 0; j < this->_outSize; j++) {
+      this->_u[j] = Fixed16::fromRaw(Fixed16::roundShift(_acc[j], F));
+    }
+    this->_activation->activation(this->_u, this->_output);
+    return this->_output;
+  }
+
+  /* scaling the raw bytes directly, 255 does not fit Q3.12 before the scale is applied */
+  TensorView<const S> forward(TensorView<const uint8_t> input, S scale) {
+    std::vector<S> converted(input.size());
+    for(int i = 0; i < input.size(); i++) {
+      converted[i] = Fixed16::fromRaw(static_cast<int64_t>(input[i]) * scale._raw);
+    }
+    return forward(converted);
+  }
+
+  void widenDelta(const std::vector<S> &delta) {
+    for(int j = 0; j < this->_outSize; j++) {
+      _deltaWide[2 * j] = delta[j]._raw;
+    }
+  }
+
+  std::vector<S> backpropagate(const std::vector<S> &delta) {
+    widenDelta(delta);
+    std::vector<S> propagated(this->_inSize - 1);
+    for(int p = 0; p < _inPad / 2; p++) {
+      const int16_t *w = &_w[p * _outPad * 2];
+      int64_t sum[2] = {0, 0};
+#ifdef __SSE2__
+      /* (delta, 0) pairs pick the even row, the same shifted by one lane the odd row */
+      int64_t even[4] = {0, 0, 0, 0}, odd[4] = {0, 0, 0, 0};
+      for(int j = 0; j < _outPad; j += 4) {
+	__m128i wv = _mm_loadu_si128(reinterpret_cast<const __m128i *>(w + 2 * j));
+	__m128i dv = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&_deltaWide[2 * j]));
+	addWidened(even, _mm_madd_epi16(wv, dv));
+	addWidened(odd, _mm_madd_epi16(wv, _mm_slli_epi32(dv, 16)));
+      }
+      sum[0] = even[0] + even[1] + even[2] + even[3];
+      sum[1] = odd[0] + odd[1] + odd[2] + odd[3];
+#else
+      for(int j = 0; j < _outPad; j++) {
+	sum[0] += static_cast<int64_t>(w[2 * j]) * _deltaWide[2 * j];
+	sum[1] += static_cast<int64_t>(w[2 * j + 1]) * _deltaWide[2 * j];
+      }
+#endif
+      for(int r = 0; r < 2; r++) {
+	if(2 * p + r < this->_inSize - 1) {
+	  propagated[2 * p + r] = Fixed16::fromRaw(Fixed16::roundShift(sum[r], F));
+	}
+      }
+    }
+    return propagated;
+  }
+
+  void updateGrad(const std::vector<S> &delta) {
+    widenDelta(delta);
+    for(int i = 0; i < this->_inSize; i++) {
+      const int16_t x = _x[i];
+      if(x == 0) continue;
+      int64_t *g = &_w_grad[i * _outPad];
+#ifdef __SSE2__
+      const __m128i xv = _mm_set1_epi32(static_cast<uint16_t>(x));
+      for(int j = 0; j < _outPad; j += 4) {
+	__m128i dv = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&_deltaWide[2 * j]));
+	addWidened(g + j, _mm_madd_epi16(xv, dv));
+      }
+#else
+      for(int j = 0; j < _outPad; j++) {
+	g[j] += static_cast<int64_t>(x) * _deltaWide[2 * j];
+      }
+#endif
+    }
+    this->_sampleCount++;
+  }
+
+  /*
+   * w -= grad * learningRate / sampleCount, rounded stochastically back to
+   * Q(F). grad * scale can exceed int64, so the product is split at bit 16
+   * of grad; flooring the low part first gives the same step.
+   */
+  void updateParam(S learningRate) {
+    if(this->_sampleCount == 0) return;
+    const int64_t scale = static_cast<int64_t>(learningRate._raw) * (static_cast<int64_t>(1) << 16) / this->_sampleCount; /* Q(F + 16) */
+    const int shift = 2 * F + 16; /* grad * scale is Q(3F + 16) */
+    const uint64_t base = (static_cast<uint64_t>(_seed) << 40) ^ (_numUpdates++ * _inPad * _outPad);
+    for(int i = 0; i < this->_inSize; i++) {
+      int64_t *g = &_w_grad[i * _outPad];
+      for(int j = 0; j < this->_outSize; j++) {
+	const int64_t noise = static_cast<int64_t>(FixedRandom::mix(base + i * _outPad + j) >> (64 - shift));
+	const int64_t low = ((g[j] & 0xffff) * scale + noise) >> 16;
+	const int64_t step = ((g[j] >> 16) * scale + low) >> (shift - 16);
+	int16_t &w = weight(i, j);
+	w = Fixed16::saturate(w - step);
+	g[j] = 0;
+      }
+    }
+    this->_sampleCount = 0;
+  }
+
+  void addMemory(MemoryStats &stats) const {
+    LayerBase<S>::addMemory(stats);
+    stats.weights += vectorBytes(_w);
+    stats.gradients += vectorBytes(_w_grad);
+    stats.activations += vectorBytes(_x) + vectorBytes(_acc) + vectorBytes(_deltaWide);
+  }
+};
@@ -0,0 +1,412 @@
+#pragma once
+
+#include <vector>
+#include <functional>
+#include <initializer_list>
+#include <iostream>
+#include <numeric>
+#include <cmath>
+
+#include "autograd.cpp"
+
+/* node id in the optimized graph by original id, -1 where the node was removed */
+typedef std::vector<int> NodeMap;
+
+/*
+ * One rewrite of a graph into a new one. A pass first claims its matches:
+ * a root (the last node of the pattern), which it emits itself, nodes
+ * dropped with the match, and aliases that map to the root's replacement.
+ * run() then copies every other node in order. Parameters are copied when
+ * first referenced, so the ones a match replaces disappear.
+ */
+template <class S>
+class GraphRewriter {
+  typedef typename Graph<S>::Node Node;
+  typedef typename Graph<S>::Op Op;
+  const Graph<S> &_in;
+  Graph<S> _out;
+  NodeMap _map;
+  std::vector<int> _uses; /* consumers plus output marks */
+  std::vector<int> _consumer; /* the last consumer */
+  std::vector<bool> _root, _dropped;
+  std::vector<std::vector<int> > _aliases;
+  bool _matched;
+public:
+  GraphRewriter(const Graph<S> &in) :
+    _in(in),
+    _map(in.getNumNodes(), -1),
+    _uses(in.getNumNodes(), 0),
+    _consumer(in.getNumNodes(), -1),
+    _root(in.getNumNodes(), false),
+    _dropped(in.getNumNodes(), false),
+    _aliases(in.getNumNodes()),
+    _matched(false)
+  {
+    _out.setTraining(in.isTraining());
+    _out.setStep(in.getStep());
+    for(size_t n = 0; n < in.getNumNodes(); n++) {
+      const Node &node = in.getNode(n);
+      for(int operand : {node._a, node._b, node._c}) {
+	if(operand < 0) continue;
+	_uses[operand]++;
+	_consumer[operand] = n;
+      }
+    }
+    for(int n : in.getOutputs()) {
+      _uses[n]++;
+    }
+  }
+
+  const Node &node(int n) const {
+    return _in.getNode(n);
+  }
+
+  const GraphParam<S> &param(int n) const {
+    return _in.getParam(n);
+  }
+
+  bool isOp(int n, Op op) const {
+    return n >= 0 && node(n)._op == op;
+  }
+
+  /* used by exactly one node and not an output */
+  bool single(int n) const {
+    return n >= 0 && _uses[n] == 1;
+  }
+
+  int consumer(int n) const {
+    return _consumer[n];
+  }
+
+  bool isFree(int n) const {
+    return !_root[n] && !_dropped[n];
+  }
+
+  /* false if a node of the match is already part of another one */
+  bool claim(int root, std::initializer_list<int> dropped, std::initializer_list<int> aliases = {}) {
+    if(!isFree(root)) return false;
+    for(int n : dropped) {
+      if(!isFree(n)) return false;
+    }
+    for(int n : aliases) {
+      if(!isFree(n)) return false;
+    }
+    _root[root] = true;
+    for(int n : dropped) _dropped[n] = true;
+    for(int n : aliases) {
+      _dropped[n] = true;
+      _aliases[root].push_back(n);
+    }
+    _matched = true;
+    return true;
+  }
+
+  void drop(int n) {
+    _dropped[n] = true;
+    _matched = true;
+  }
+
+  Graph<S> &out() {
+    return _out;
+  }
+
+  /* id of n in the new graph, copying a parameter on first use */
+  int mapped(int n) {
+    if(n < 0) return -1;
+    if(_map[n] < 0 && node(n)._op == Op::PARAM) _map[n] = _out.addParamCopy(param(n));
+    return _map[n];
+  }
+
+  /* false if nothing was claimed; emit(root) returns the id of the root's replacement */
+  bool run(const std::function<int(int)> &emit, Graph<S> &result, NodeMap &map) {
+    for(size_t n = 0; n < _in.getNumNodes(); n++) {
+      const Node &node = _in.getNode(n);
+      if(_root[n]) {
+	_map[n] = emit(n);
+	for(int alias : _aliases[n]) _map[alias] = _map[n];
+      }else if(!_dropped[n] && node._op != Op::PARAM) {
+	_map[n] = _out.addCopy(node, mapped(node._a), mapped(node._b), mapped(node._c));
+      }
+    }
+    for(int n : _in.getOutputs()) {
+      if(_map[n] >= 0) _out.markOutput(_map[n]);
+    }
+    result = _out;
+    map = _map;
+    return _matched;
+  }
+};
+
+/* removes nodes that neither the loss nor a marked output depends on; inputs stay */
+template <class S>
+bool eliminateDeadNodes(const Graph<S> &graph, Graph<S> &result, NodeMap &map) {
+  typedef typename Graph<S>::Op Op;
+  GraphRewriter<S> rw(graph);
+  std::vector<bool> live(graph.getNumNodes(), false);
+  if(graph.getLoss() >= 0) live[graph.getLoss()] = true;
+  for(int n : graph.getOutputs()) live[n] = true;
+  for(int n = graph.getNumNodes() - 1; n >= 0; n--) {
+    const typename Graph<S>::Node &node = graph.getNode(n);
+    if(!live[n]) {
+      if(node._op != Op::INPUT && node._op != Op::PARAM) rw.drop(n);
+      continue;
+    }
+    for(int operand : {node._a, node._b, node._c}) {
+      if(operand >= 0) live[operand] = true;
+    }
+  }
+  return rw.run([](int) {return -1;}, result, map);
+}
+
+/* batchNorm(matmul(x, W) [+ b]) -> matmul(x, W') + b'; inference only, as the statistics become weights */
+template <class S>
+bool foldBatchNorm(const Graph<S> &graph, Graph<S> &result, NodeMap &map) {
+  typedef typename Graph<S>::Op Op;
+  using std::sqrt;
+  GraphRewriter<S> rw(graph);
+  std::vector<int> matmulOf(graph.getNumNodes(), -1), biasOf(graph.getNumNodes(), -1);
+  for(size_t n = 0; n < graph.getNumNodes(); n++) {
+    if(!rw.isOp(n, Op::BATCHNORM)) continue;
+    const int x = rw.node(n)._a;
+    if(rw.isOp(x, Op::ADD) && rw.single(x) && rw.isOp(rw.node(x)._a, Op::MATMUL) && rw.single(rw.node(x)._a) && rw.isOp(rw.node(x)._b, Op::PARAM)) {
+      if(!rw.claim(n, {x, rw.node(x)._a})) continue;
+      matmulOf[n] = rw.node(x)._a;
+      biasOf[n] = rw.node(x)._b;
+    }else if(rw.isOp(x, Op::MATMUL) && rw.single(x)) {
+      if(rw.claim(n, {x})) matmulOf[n] = x;
+    }
+  }
+  return rw.run([&](int n) {
+    const int m = matmulOf[n];
+    const GraphParam<S> &w = rw.param(rw.node(m)._b), &bn = rw.param(rw.node(n)._b);
+    const size_t rows = w._rows, cols = w._cols;
+    Graph<S> &out = rw.out();
+    int wFolded = out.param(rows, cols), bFolded = out.param(1, cols);
+    std::vector<S> &wv = out.getParam(wFolded)._value, &bv = out.getParam(bFolded)._value;
+    for(size_t j = 0; j < cols; j++) {
+      const S scale = bn._value[j] / sqrt(bn._value[3 * cols + j] + Graph<S>::batchNormEpsilon());
+      for(size_t i = 0; i < rows; i++) wv[i * cols + j] = w._value[i * cols + j] * scale;
+      const S bias = biasOf[n] >= 0 ? rw.param(biasOf[n])._value[j] : 0;
+      bv[j] = (bias - bn._value[2 * cols + j]) * scale + bn._value[cols + j];
+    }
+    return out.add(out.matmul(rw.mapped(rw.node(m)._a), wFolded), bFolded);
+  }, result, map);
+}
+
+/*
+ * matmul(matmul(x, W1) [+ b1], W2) [+ b2] -> matmul(x, W1 W2) + (b1 W2 + b2),
+ * two linear layers without an activation in between. Only where the
+ * product has fewer multiply-adds; inference only, as training the product
+ * is not training the factors.
+ */
+template <class S>
+bool foldLinear(const Graph<S> &graph, Graph<S> &result, NodeMap &map) {
+  typedef typename Graph<S>::Op Op;
+  GraphRewriter<S> rw(graph);
+  struct Match {
+    int m1, bias1, m2, bias2;
+  };
+  std::vector<Match> matches(graph.getNumNodes(), Match{-1, -1, -1, -1});
+  for(size_t n = 0; n < graph.getNumNodes(); n++) {
+    if(!rw.isOp(n, Op::MATMUL)) continue;
+    Match match{-1, -1, static_cast<int>(n), -1};
+    int x = rw.node(n)._a, hidden = -1;
+    if(rw.isOp(x, Op::ADD) && rw.single(x) && rw.isOp(rw.node(x)._a, Op::MATMUL) && rw.single(rw.node(x)._a) && rw.isOp(rw.node(x)._b, Op::PARAM)) {
+      hidden = x;
+      match.m1 = rw.node(x)._a;
+      match.bias1 = rw.node(x)._b;
+    }else if(rw.isOp(x, Op::MATMUL) && rw.single(x)) {
+      match.m1 = x;
+    }else {
+      continue;
+    }
+    const GraphParam<S> &w1 = rw.param(rw.node(match.m1)._b), &w2 = rw.param(rw.node(n)._b);
+    if(w1._rows * w2._cols > w1._rows * w1._cols + w2._rows * w2._cols) continue;
+    int root = n;
+    const int c = rw.consumer(n);
+    if(rw.single(n) && rw.isOp(c, Op::ADD) && rw.node(c)._a == static_cast<int>(n) && rw.isOp(rw.node(c)._b, Op::PARAM)) {
+      root = c;
+      match.bias2 = rw.node(c)._b;
+    }
+    bool claimed = false;
+    if(root == static_cast<int>(n)) {
+      claimed = hidden >= 0 ? rw.claim(root, {match.m1, hidden}) : rw.claim(root, {match.m1});
+    }else {
+      claimed = hidden >= 0 ? rw.claim(root, {match.m1, hidden, static_cast<int>(n)}) : rw.claim(root, {match.m1, static_cast<int>(n)});
+    }
+    if(claimed) matches[root] = match;
+  }
+  return rw.run([&](int n) {
+    const Match &match = matches[n];
+    const GraphParam<S> &w1 = rw.param(rw.node(match.m1)._b), &w2 = rw.param(rw.node(match.m2)._b);
+    const size_t rows = w1._rows, inner = w1._cols, cols = w2._cols;
+    Graph<S> &out = rw.out();
+    int w = out.param(rows, cols);
+    std::vector<S> &wv = out.getParam(w)._value;
+    for(size_t i = 0; i < rows; i++) {
+      for(size_t k = 0; k < inner; k++) {
+	const S a = w1._value[i * inner + k];
+	if(a == 0) continue;
+	for(size_t j = 0; j < cols; j++) wv[i * cols + j] += a * w2._value[k * cols + j];
+      }
+    }
+    int y = out.matmul(rw.mapped(rw.node(match.m1)._a), w);
+    if(match.bias1 < 0 && match.bias2 < 0) return y;
+    int b = out.param(1, cols);
+    std::vector<S> &bv = out.getParam(b)._value;
+    if(match.bias1 >= 0) {
+      const std::vector<S> &b1 = rw.param(match.bias1)._value;
+      for(size_t k = 0; k < inner; k++) {
+	for(size_t j = 0; j < cols; j++) bv[j] += b1[k] * w2._value[k * cols + j];
+      }
+    }
+    if(match.bias2 >= 0) {
+      const std::vector<S> &b2 = rw.param(match.bias2)._value;
+      for(size_t j = 0; j < cols; j++) bv[j] += b2[j];
+    }
+    return out.add(y, b);
+  }, result, map);
+}
+
+/* matmul [+ bias param] [relu | sigmoid] [dropout] -> one DENSE node doing the rest in its epilogue */
+template <class S>
+bool fuseEpilogue(const Graph<S> &graph, Graph<S> &result, NodeMap &map) {
+  typedef typename Graph<S>::Op Op;
+  typedef typename Graph<S>::Epilogue Epilogue;
+  GraphRewriter<S> rw(graph);
+  struct Match {
+    int matmul, bias;
+    Epilogue epilogue;
+    float rate;
+    uint64_t seed;
+  };
+  std::vector<Match> matches(graph.getNumNodes());
+  for(size_t n = 0; n < graph.getNumNodes(); n++) {
+    if(!rw.isOp(n, Op::MATMUL)) continue;
+    Match match{static_cast<int>(n), -1, Epilogue::NONE, 0, 0};
+    std::vector<int> chain{static_cast<int>(n)};
+    int c = rw.consumer(n);
+    if(rw.single(chain.back()) && rw.isOp(c, Op::ADD)) {
+      const int other = rw.node(c)._a == chain.back() ? rw.node(c)._b : rw.node(c)._a;
+      if(rw.isOp(other, Op::PARAM)) {
+	match.bias = other;
+	chain.push_back(c);
+	c = rw.consumer(c);
+      }
+    }
+    if(rw.single(chain.back()) && (rw.isOp(c, Op::RELU) || rw.isOp(c, Op::SIGMOID))) {
+      match.epilogue = rw.isOp(c, Op::RELU) ? Epilogue::RELU : Epilogue::SIGMOID;
+      chain.push_back(c);
+      c = rw.consumer(c);
+    }
+    if(rw.single(chain.back()) && rw.isOp(c, Op::DROPOUT)) {
+      match.rate = rw.node(c)._rate;
+      match.seed = rw.node(c)._seed;
+      chain.push_back(c);
+    }
+    if(chain.size() == 1) continue;
+    const int root = chain.back();
+    bool free = true;
+    for(int node : chain) free = free && rw.isFree(node);
+    if(!free) continue;
+    rw.claim(root, {});
+    for(size_t k = 0; k + 1 < chain.size(); k++) rw.drop(chain[k]);
+    matches[root] = match;
+  }
+  return rw.run([&](int n) {
+    const Match &match = matches[n];
+    const typename Graph<S>::Node &m = rw.node(match.matmul);
+    return rw.out().dense(rw.mapped(m._a), rw.mapped(m._b), rw.mapped(match.bias), match.epilogue, match.rate, match.seed);
+  }, result, map);
+}
+
+/* crossEntropy(softmax(x), t) -> softmaxCrossEntropy(x, t), whose gradient is y - t */
+template <class S>
+bool fuseSoftmaxCrossEntropy(const Graph<S> &graph, Graph<S> &result, NodeMap &map) {
+  typedef typename Graph<S>::Op Op;
+  GraphRewriter<S> rw(graph);
+  const int loss = graph.getLoss();
+  /* the fused node takes the softmax's place, so the target must already exist there */
+  if(rw.isOp(loss, Op::CROSS_ENTROPY) && rw.isOp(rw.node(loss)._a, Op::SOFTMAX) && rw.node(loss)._b < rw.node(loss)._a) {
+    rw.claim(rw.node(loss)._a, {}, {loss});
+  }
+  return rw.run([&](int n) {
+    return rw.out().softmaxCrossEntropy(rw.mapped(rw.node(n)._a), rw.mapped(rw.node(loss)._b));
+  }, result, map);
+}
+
+/* each pass can be turned off to measure or rule it out */
+struct OptimizerOptions {
+  bool eliminateDead = true;
+  bool foldBatchNorm = true; /* inference only */
+  bool foldLinear = true; /* inference only */
+  bool fuseEpilogue = true;
+  bool fuseSoftmaxCrossEntropy = true;
+
+  /* the passes that keep the graph trainable */
+  static OptimizerOptions training() {
+    OptimizerOptions options;
+    options.foldBatchNorm = options.foldLinear = false;
+    return options;
+  }
+};
+
+/* optimized copy of graph, to be compiled; map takes the original node ids to the new ones */
+template <class S>
+Graph<S> optimizeGraph(const Graph<S> &graph, const OptimizerOptions &options, NodeMap &map) {
+  typedef bool (*Pass)(const Graph<S> &, Graph<S> &, NodeMap &);
+  Graph<S> current = graph;
+  map.resize(graph.getNumNodes());
+  std::iota(map.begin(), map.end(), 0);
+  auto apply = [&](Pass pass) {
+    Graph<S> next;
+    NodeMap step;
+    const bool changed = pass(current, next, step);
+    for(int &id : map) id = id >= 0 ? step[id] : -1;
+    current = next;
+    return changed;
+  };
+  if(options.eliminateDead) apply(eliminateDeadNodes<S>);
+  if(options.foldBatchNorm) apply(foldBatchNorm<S>);
+  if(options.foldLinear) {
+    while(apply(foldLinear<S>)) {}
+  }
+  if(options.fuseEpilogue) apply(fuseEpilogue<S>);
+  if(options.fuseSoftmaxCrossEntropy) apply(fuseSoftmaxCrossEntropy<S>);
+  return current;
+}
+
+/* graph of a Network of dense RELU layers with a SOFTMAX output layer, false for other layers */
+template <class S>
+bool buildGraph(const Network<S> &net, Graph<S> &graph, int &input, int &target, int &output) {
+  typedef typename Layer<S>::ActivationType ActivationType;
+  std::shared_ptr<Layer<S>> first = std::dynamic_pointer_cast<Layer<S>>(net.getLayer(0));
+  if(!first) {
+    std::cerr << "buildGraph: layer 0 is not dense" << std::endl;
+    return false;
+  }
+  input = graph.input(first->_inSize - 1);
+  /* the target comes before the softmax so that the two can be fused */
+  target = graph.input(net.getLayer(net.getNumLayers() - 1)->_outSize);
+  int x = input;
+  for(size_t l = 0; l < net.getNumLayers(); l++) {
+    std::shared_ptr<Layer<S>> layer = std::dynamic_pointer_cast<Layer<S>>(net.getLayer(l));
+    const bool last = l + 1 == net.getNumLayers();
+    if(!layer || layer->_activationType != (last ? ActivationType::SOFTMAX : ActivationType::RELU)) {
+      std::cerr << "buildGraph: layer " << l << " is not a dense " << (last ? "softmax" : "relu") << " layer" << std::endl;
+      return false;
+    }
+    const size_t in = layer->_inSize - 1, out = layer->_outSize;
+    int w = graph.param(in, out), b = graph.param(1, out);
+    for(size_t i = 0; i < in; i++) {
+      std::copy(layer->_w[i].begin(), layer->_w[i].end(), graph.getParam(w)._value.begin() + i * out);
+    }
+    std::copy(layer->_w[in].begin(), layer->_w[in].end(), graph.getParam(b)._value.begin());
+    x = graph.add(graph.matmul(x, w), b);
+    x = last ? graph.softmax(x) : graph.relu(x);
+  }
+  output = x;
+  graph.crossEntropy(output, target);
+  graph.markOutput(output);
+  return graph.compile();
+}
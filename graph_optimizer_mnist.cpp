@@ -0,0 +1,135 @@
+#include <utility>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <string>
+#include <cmath>
+
+#include "graph_optimizer.cpp"
+
+struct OptimizerConfig {
+  std::string name;
+  OptimizerOptions options;
+  bool trainable; /* only passes that keep training the same */
+};
+
+std::vector<OptimizerConfig> optimizerConfigs() {
+  OptimizerOptions none;
+  none.eliminateDead = none.foldBatchNorm = none.foldLinear = none.fuseEpilogue = none.fuseSoftmaxCrossEntropy = false;
+  std::vector<OptimizerConfig> configs;
+  configs.push_back({"none", none, true});
+  configs.push_back({"dead", none, true});
+  configs.back().options.eliminateDead = true;
+  configs.push_back({"batchnorm", none, false});
+  configs.back().options.foldBatchNorm = true;
+  configs.push_back({"linear", none, false});
+  configs.back().options.foldLinear = true;
+  configs.push_back({"epilogue", none, true});
+  configs.back().options.fuseEpilogue = true;
+  configs.push_back({"softmax_ce", none, true});
+  configs.back().options.fuseSoftmaxCrossEntropy = true;
+  configs.push_back({"training", OptimizerOptions::training(), true});
+  configs.push_back({"all", OptimizerOptions(), false});
+  return configs;
+}
+
+/* inference over set, numRounds times; returns seconds and keeps the outputs of the last round */
+double infer(Graph<float> &graph, int input, int output, MNistDataSet &set, int numRounds, std::vector<float> &outputs) {
+  const size_t size = graph.getNode(output)._size;
+  outputs.resize(set.getNumImages() * size);
+  auto start = std::chrono::steady_clock::now();
+  for(int round = 0; round < numRounds; round++) {
+    for(uint32_t sample = 0; sample < set.getNumImages(); sample++) {
+      graph.setInput(input, set.getImage(sample), 1.0f / 256);
+      graph.forward();
+      std::copy(graph.value(output), graph.value(output) + size, outputs.begin() + sample * size);
+    }
+  }
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/* numSamples training steps; returns seconds */
+double train(Graph<float> &graph, int input, int target, MNistDataSet &set, uint32_t numSamples) {
+  auto start = std::chrono::steady_clock::now();
+  for(uint32_t sample = 0; sample < numSamples; sample++) {
+    graph.setInput(input, set.getImage(sample % set.getNumImages()), 1.0f / 256);
+    graph.setOneHot(target, set.getLabel(sample % set.getNumImages()));
+    graph.forward();
+    graph.backward();
+    if(sample % 100 == 99) graph.updateParam(0.1f);
+  }
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+float maxDifference(const std::vector<float> &a, const std::vector<float> &b) {
+  float maxDiff = 0;
+  for(size_t i = 0; i < a.size(); i++) maxDiff = std::max(maxDiff, std::abs(a[i] - b[i]));
+  return maxDiff;
+}
+
+int main(int argc, char **argv) {
+  int numRounds = argc > 1 ? std::atoi(argv[1]) : 3;
+  uint32_t numTrainSteps = argc > 2 ? std::atoi(argv[2]) : 1000;
+
+  MNistDataSet trainSet("mnist/train-images-idx3-ubyte", "mnist/train-labels-idx1-ubyte");
+  MNistDataSet testSet("mnist/t10k-images-idx3-ubyte", "mnist/t10k-labels-idx1-ubyte");
+  const size_t imageSize = trainSet.getNumRows() * trainSet.getNumColumns();
+
+  /* a linear bottleneck, batch norm and dropout, and an auxiliary head nothing reads */
+  Graph<float> graph;
+  int input = graph.input(imageSize), target = graph.input(10);
+  int w0 = graph.param(imageSize, 256, std::sqrt(3.0f / imageSize)), b0 = graph.param(1, 256);
+  int w1 = graph.param(256, 128, std::sqrt(6.0f / 256)), b1 = graph.param(1, 128);
+  int bn = graph.param(4, 128);
+  int w2 = graph.param(128, 10, std::sqrt(6.0f / 128)), b2 = graph.param(1, 10);
+  int wAux = graph.param(128, 10, 0.1f);
+  RandomGenerator<float> rg(0, 1);
+  for(size_t j = 0; j < 128; j++) {
+    std::vector<float> &p = graph.getParam(bn)._value;
+    p[j] = 0.5f + rg.rand(); /* gamma */
+    p[128 + j] = 0.1f * (rg.rand() - 0.5f); /* beta */
+    p[256 + j] = 0.1f * (rg.rand() - 0.5f); /* mean */
+    p[384 + j] = 0.5f + rg.rand(); /* var */
+  }
+  int linear = graph.add(graph.matmul(input, w0), b0);
+  int hidden = graph.relu(graph.batchNorm(graph.add(graph.matmul(linear, w1), b1), bn));
+  graph.softmax(graph.matmul(hidden, wAux));
+  int output = graph.softmax(graph.add(graph.matmul(graph.dropout(hidden, 0.1f), w2), b2));
+  graph.crossEntropy(output, target);
+  graph.markOutput(output);
+  if(!graph.compile()) return 1;
+  Graph<float> untrained = graph;
+  train(graph, input, target, trainSet, trainSet.getNumImages());
+
+  graph.setTraining(false);
+  std::vector<float> reference;
+  double referenceInfer = infer(graph, input, output, testSet, numRounds, reference);
+  std::cout << std::fixed << std::setprecision(3);
+  std::cout << std::setw(12) << "passes" << std::setw(8) << "nodes" << std::setw(10) << "arena" << std::setw(14) << "infer diff"
+	    << std::setw(10) << "speedup" << std::setw(14) << "train diff" << std::setw(10) << "speedup" << std::endl;
+  for(const OptimizerConfig &config : optimizerConfigs()) {
+    NodeMap map;
+    Graph<float> optimized = optimizeGraph(graph, config.options, map);
+    if(!optimized.compile()) return 1;
+    std::vector<float> outputs;
+    double seconds = infer(optimized, map[input], map[output], testSet, numRounds, outputs);
+    std::cout << std::setw(12) << config.name << std::setw(8) << optimized.getNumNodes() << std::setw(10) << optimized.getMemoryPlan().arenaElements
+	      << std::setw(14) << std::scientific << std::setprecision(2) << maxDifference(outputs, reference)
+	      << std::setw(10) << std::fixed << std::setprecision(3) << referenceInfer / seconds;
+    if(config.trainable) {
+      /* both copies take the same steps with the same dropout masks, then infer */
+      Graph<float> plain = untrained, fused = optimizeGraph(untrained, config.options, map);
+      if(!fused.compile()) return 1;
+      double plainSeconds = train(plain, input, target, trainSet, numTrainSteps);
+      double fusedSeconds = train(fused, map[input], map[target], trainSet, numTrainSteps);
+      plain.setTraining(false);
+      fused.setTraining(false);
+      std::vector<float> plainOutputs, fusedOutputs;
+      infer(plain, input, output, testSet, 1, plainOutputs);
+      infer(fused, map[input], map[output], testSet, 1, fusedOutputs);
+      std::cout << std::setw(14) << std::scientific << std::setprecision(2) << maxDifference(plainOutputs, fusedOutputs)
+		<< std::setw(10) << std::fixed << std::setprecision(3) << plainSeconds / fusedSeconds;
+    }
+    std::cout << std::endl;
+  }
+}
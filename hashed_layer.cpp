@@ -0,0 +1,116 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#include "neural_net.cpp"
+
+/*
+ * HashedNets layer: the virtual (inSize+1) x outSize weight matrix is backed by
+ * numParams shared parameters. w[i][j] = sign(i, j) * _p[index(i, j)], where
+ * index and sign come from a hash of (i, j) recomputed on the fly.
+ */
+template <class S>
+struct HashedLayer : public LayerBase<S> {
+  size_t _numParams;
+  uint32_t _seed;
+  std::vector<S> _p, _p_grad;
+  std::vector<uint32_t> _index; /* size: outSize, scratch for one row */
+  std::vector<S> _sign; /* size: outSize, scratch for one row */
+public:
+  using typename LayerBase<S>::ActivationType;
+
+  /* numParams is raised to 1, so that every index(i, j) has a parameter to read */
+  HashedLayer(size_t inSize, size_t outSize, ActivationType activationType, size_t numParams, uint32_t seed = 0x5bd1e995) :
+    LayerBase<S>(inSize, outSize, activationType),
+    _numParams(std::max<size_t>(1, numParams)),
+    _seed(seed),
+    _p(_numParams),
+    _p_grad(_numParams, 0),
+    _index(outSize),
+    _sign(outSize)
+  {
+    RandomGenerator<S> rg(0.0, 1.0);
+    for(int k = 0; k < _numParams; k++) {
+      _p[k] = rg.rand() / this->_inSize;
+    }
+  }
+
+  static uint32_t hash(uint32_t key, uint32_t seed) {
+    key ^= seed;
+    key *= 0x9e3779b1u;
+    key ^= key >> 15;
+    key *= 0x85ebca77u;
+    key ^= key >> 13;
+    return key;
+  }
+
+  /* fills _index and _sign for row i; the loop has no dependencies so that it vectorizes */
+  void hashRow(int i) {
+    const uint32_t base = static_cast<uint32_t>(i) * static_cast<uint32_t>(this->_outSize);
+    const uint64_t numParams = _numParams;
+    for(int j = 0; j < this->_outSize; j++) {
+      uint32_t h = hash(base + j, _seed);
+      _index[j] = static_cast<uint32_t>((static_cast<uint64_t>(h) * numParams) >> 32);
+      _sign[j] = (h & 1) ? static_cast<S>(-1) : static_cast<S>(1);
+    }
+  }
+
+  TensorView<const S> forward(TensorView<const S> input) {
+    this->_input.assign(input.begin(), input.end());
+    this->_input.push_back(static_cast<S>(1));
+    std::fill(this->_u.begin(), this->_u.end(), 0);
+    for(int i = 0; i < this->_inSize; i++) {
+      const S x = this->_input[i];
+      if(x == 0) continue;
+      hashRow(i);
+      for(int j = 0; j < this->_outSize; j++) {
+	this->_u[j] += x * _sign[j] * _p[_index[j]];
+      }
+    }
+    this->_activation->activation(this->_u, this->_output);
+    return this->_output;
+  }
+
+  std::vector<S> backpropagate(const std::vector<S> &delta) {
+    std::vector<S> propagated(this->_inSize - 1, 0);
+    for(int i = 0; i < this->_inSize - 1; i++) {
+      hashRow(i);
+      S sum = 0;
+      for(int j = 0; j < this->_outSize; j++) {
+	sum += delta[j] * _sign[j] * _p[_index[j]];
+      }
+      propagated[i] = sum;
+    }
+    return propagated;
+  }
+
+  void updateGrad(const std::vector<S> &delta) {
+    for(int i = 0; i < this->_inSize; i++) {
+      const S x = this->_input[i];
+      if(x == 0) continue;
+      hashRow(i);
+      for(int j = 0; j < this->_outSize; j++) {
+	_p_grad[_index[j]] += x * _sign[j] * delta[j];
+      }
+    }
+    this->_sampleCount++;
+  }
+
+  void updateParam(S learningRate) {
+    if(this->_sampleCount == 0) return;
+    for(int k = 0; k < _numParams; k++) {
+      _p[k] -= _p_grad[k] * learningRate / this->_sampleCount;
+      _p_grad[k] = 0;
+    }
+    this->_sampleCount = 0;
+  }
+
+  void addMemory(MemoryStats &stats) const {
+    LayerBase<S>::addMemory(stats);
+    stats.weights += vectorBytes(_p);
+    stats.gradients += vectorBytes(_p_grad);
+    stats.activations += vectorBytes(_index) + vectorBytes(_sign);
+  }
+};
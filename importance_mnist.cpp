@@ -0,0 +1,43 @@
+#include <utility>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+
+#include "trainer.cpp"
+#include "quantize.cpp"
+#include "importance_sampling.cpp"
+
+int main(int argc, char **argv) {
+  double targetError = argc > 1 ? std::atof(argv[1]) : 0.03;
+  int maxEpochs = argc > 2 ? std::atoi(argv[2]) : 20;
+  double stepFraction = argc > 3 ? std::atof(argv[3]) : 0.5;
+
+  MNistDataSet trainSet("mnist/train-images-idx3-ubyte", "mnist/train-labels-idx1-ubyte");
+  MNistDataSet testSet("mnist/t10k-images-idx3-ubyte", "mnist/t10k-labels-idx1-ubyte");
+
+  /* an importance epoch draws stepFraction of the training set */
+  for(int importance = 0; importance < 2; importance++) {
+    Network<float> net;
+    net.addLayer(trainSet.getNumRows() * trainSet.getNumColumns(), 300, Layer<float>::ActivationType::RELU);
+    net.addLayer(300, 10, Layer<float>::ActivationType::SOFTMAX);
+    ImportanceSampler sampler(trainSet.getNumImages());
+    double seconds = 0, error = 1;
+    size_t numSteps = 0;
+    int epoch;
+    for(epoch = 0; epoch < maxEpochs && error > targetError; epoch++) {
+      auto start = std::chrono::steady_clock::now();
+      if(importance) {
+	uint32_t steps = static_cast<uint32_t>(stepFraction * trainSet.getNumImages());
+	runImportanceEpoch(net, trainSet, sampler, steps, 0.2);
+	numSteps += steps;
+      }else {
+	runEpoch(net, trainSet, true, 0.2);
+	numSteps += trainSet.getNumImages();
+      }
+      seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      error = calcErrorRate(net, testSet, testSet.getNumImages());
+    }
+    std::cout << std::endl << (importance ? "importance" : "uniform") << ": test error " << error << " after " << epoch
+	      << " epochs, " << numSteps << " samples, " << seconds << " sec training" << std::endl;
+  }
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <vector>
+#include <random>
+#include <utility>
+#include <iostream>
+#include <iomanip>
+
+#include "trainer.cpp"
+
+/* complete binary tree of partial sums over the leaf priorities, O(log n) update and sample */
+class SumTree {
+  size_t _numLeaves; /* power of two */
+  std::vector<double> _nodes; /* size: 2 * numLeaves, root at 1, leaves from numLeaves */
+public:
+  SumTree(size_t size) :
+    _numLeaves(1)
+  {
+    while(_numLeaves < size) _numLeaves *= 2;
+    _nodes.assign(2 * _numLeaves, 0);
+  }
+
+  double total() const {
+    return _nodes[1];
+  }
+
+  double get(size_t i) const {
+    return _nodes[_numLeaves + i];
+  }
+
+  /* parents are recomputed from their children, so no rounding error accumulates */
+  void set(size_t i, double priority) {
+    size_t node = _numLeaves + i;
+    _nodes[node] = priority;
+    for(node /= 2; node >= 1; node /= 2) {
+      _nodes[node] = _nodes[2 * node] + _nodes[2 * node + 1];
+    }
+  }
+
+  /* leaf whose prefix-sum interval contains mass, 0 <= mass < total() */
+  size_t find(double mass) const {
+    size_t node = 1;
+    while(node < _numLeaves) {
+      if(mass < _nodes[2 * node] || _nodes[2 * node + 1] <= 0) {
+	node = 2 * node;
+      }else {
+	mass -= _nodes[2 * node];
+	node = 2 * node + 1;
+      }
+    }
+    return node - _numLeaves;
+  }
+};
+
+/*
+ * Samples training examples with probability proportional to their last
+ * seen loss, mixed with uniform sampling so that no sample starves on a
+ * stale low loss: p_i = (1 - uniformMix) * loss_i / sum(loss) + uniformMix / N.
+ * Each sample's gradient is weighted by 1 / (N p_i), which keeps the batch
+ * gradient an unbiased estimate of the full-data mean gradient.
+ */
+class ImportanceSampler {
+  uint32_t _numSamples;
+  std::vector<float> _loss; /* last seen loss per sample */
+  SumTree _tree;
+  double _uniformMix;
+  std::mt19937 _mt;
+  std::uniform_real_distribution<double> _dist;
+public:
+  ImportanceSampler(uint32_t numSamples, double uniformMix = 0.2, float initialLoss = 2.3f) :
+    _numSamples(numSamples),
+    _loss(numSamples, initialLoss),
+    _tree(numSamples),
+    _uniformMix(uniformMix),
+    _mt(1),
+    _dist(0, 1)
+  {
+    for(uint32_t i = 0; i < numSamples; i++) {
+      _tree.set(i, initialLoss);
+    }
+  }
+
+  double probability(uint32_t sample) const {
+    return (1 - _uniformMix) * _loss[sample] / _tree.total() + _uniformMix / _numSamples;
+  }
+
+  /* returns (sample, gradient weight) */
+  std::pair<uint32_t, double> draw() {
+    uint32_t sample;
+    if(_dist(_mt) < _uniformMix || _tree.total() <= 0) {
+      sample = std::min<uint32_t>(_numSamples - 1, _dist(_mt) * _numSamples);
+    }else {
+      sample = std::min<uint32_t>(_numSamples - 1, _tree.find(_dist(_mt) * _tree.total()));
+    }
+    return std::make_pair(sample, 1 / (_numSamples * probability(sample)));
+  }
+
+  void update(uint32_t sample, float loss) {
+    _loss[sample] = loss;
+    _tree.set(sample, loss);
+  }
+};
+
+/*
+ * Trains on numSteps samples drawn by sampler (all samples of set by
+ * default) instead of one pass in order. Returns the mean loss and error
+ * rate of the drawn samples.
+ */
+template <class S>
+std::pair<double, double> runImportanceEpoch(Network<S> &net, MNistDataSet &set, ImportanceSampler &sampler, const ForwardFunctionT<S> &forward, uint32_t numSteps = 0, double learningRate = 0.1, int batchSize = 100) {
+  if(numSteps == 0) numSteps = set.getNumImages();
+  int numWrong = 0;
+  double sumLoss = 0;
+  for(uint32_t step = 0; step < numSteps; step++) {
+    std::pair<uint32_t, double> drawn = sampler.draw();
+    const uint32_t sample = drawn.first;
+    TensorView<const S> out = forward(net, set, sample);
+    uint8_t estimatedLabel = std::distance(out.begin(), std::max_element(out.begin(), out.end()));
+    numWrong += estimatedLabel != set.getLabel(sample);
+    std::vector<double> labelDouble = set.getLabelDouble(sample);
+    std::vector<S> labelOneHot(labelDouble.begin(), labelDouble.end());
+    double sampleLoss = static_cast<double>(net.calcLoss(labelOneHot));
+    sumLoss += sampleLoss;
+    sampler.update(sample, static_cast<float>(sampleLoss));
+    net.backward(labelOneHot, static_cast<S>(drawn.second));
+    if((step + 1) % batchSize == 0 || step == numSteps - 1) {
+      net.updateParam(static_cast<S>(learningRate));
+    }
+  }
+  return std::make_pair(sumLoss / numSteps, static_cast<double>(numWrong) / numSteps);
+}
+
+template <class S>
+std::pair<double, double> runImportanceEpoch(Network<S> &net, MNistDataSet &set, ImportanceSampler &sampler, uint32_t numSteps = 0, double learningRate = 0.1, int batchSize = 100) {
+  ForwardFunctionT<S> forward = [](Network<S> &net, MNistDataSet &set, uint32_t sample) {
+    return net.forward(set.getImage(sample), static_cast<S>(1.0 / 256));
+  };
+  return runImportanceEpoch(net, set, sampler, forward, numSteps, learningRate, batchSize);
+}
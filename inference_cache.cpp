@@ -0,0 +1,265 @@
+#pragma once
+
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <cstring>
+
+#include "neural_net.cpp"
+
+struct Hash128 {
+  uint64_t lo, hi;
+
+  bool operator==(const Hash128 &other) const {
+    return lo == other.lo && hi == other.hi;
+  }
+};
+
+struct Hash128Hasher {
+  size_t operator()(const Hash128 &h) const {
+    return static_cast<size_t>(h.lo);
+  }
+};
+
+/* MurmurHash3 x64_128 */
+Hash128 hash128(const uint8_t *data, size_t n, uint64_t seed = 0) {
+  const uint64_t c1 = 0x87c37b91114253d5ULL, c2 = 0x4cf5ad432745937fULL;
+  auto rotl = [](uint64_t x, int r) {return (x << r) | (x >> (64 - r));};
+  auto fmix = [](uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+  };
+  uint64_t h1 = seed, h2 = seed;
+  const size_t numBlocks = n / 16;
+  for(size_t b = 0; b < numBlocks; b++) {
+    uint64_t k1, k2;
+    std::memcpy(&k1, data + 16 * b, 8);
+    std::memcpy(&k2, data + 16 * b + 8, 8);
+    k1 *= c1; k1 = rotl(k1, 31); k1 *= c2; h1 ^= k1;
+    h1 = rotl(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+    k2 *= c2; k2 = rotl(k2, 33); k2 *= c1; h2 ^= k2;
+    h2 = rotl(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+  }
+  const uint8_t *tail = data + 16 * numBlocks;
+  uint64_t k1 = 0, k2 = 0;
+  for(int t = static_cast<int>(n & 15) - 1; t >= 8; t--) {
+    k2 ^= static_cast<uint64_t>(tail[t]) << (8 * (t - 8));
+  }
+  for(int t = std::min(static_cast<int>(n & 15), 8) - 1; t >= 0; t--) {
+    k1 ^= static_cast<uint64_t>(tail[t]) << (8 * t);
+  }
+  if(n & 15) {
+    k2 *= c2; k2 = rotl(k2, 33); k2 *= c1; h2 ^= k2;
+    k1 *= c1; k1 = rotl(k1, 31); k1 *= c2; h1 ^= k1;
+  }
+  h1 ^= n; h2 ^= n;
+  h1 += h2; h2 += h1;
+  h1 = fmix(h1); h2 = fmix(h2);
+  h1 += h2; h2 += h1;
+  return Hash128{h1, h2};
+}
+
+struct InferenceCacheStats {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+  uint64_t stale; /* entries dropped because the model was swapped */
+  uint64_t hitNanoseconds;
+  uint64_t missNanoseconds;
+
+  double hitRate() const {
+    return hits + misses > 0 ? static_cast<double>(hits) / (hits + misses) : 0;
+  }
+
+  /* one "name value" line per metric */
+  void report(std::ostream &os) const {
+    os << "inference_cache_hits " << hits << std::endl
+       << "inference_cache_misses " << misses << std::endl
+       << "inference_cache_evictions " << evictions << std::endl
+       << "inference_cache_stale " << stale << std::endl
+       << std::fixed << std::setprecision(4)
+       << "inference_cache_hit_rate " << hitRate() << std::endl
+       << "inference_cache_hit_latency_us " << (hits > 0 ? hitNanoseconds / 1e3 / hits : 0) << std::endl
+       << "inference_cache_miss_latency_us " << (misses > 0 ? missNanoseconds / 1e3 / misses : 0) << std::endl;
+  }
+};
+
+/*
+ * Cache in front of Network::forward for byte inputs, keyed by the 128-bit
+ * hash of the input. Entries are spread over shards by hash, each shard an
+ * LRU list under its own lock, so concurrent requests rarely contend. With
+ * labelsOnly the entries keep only the predicted label. Every entry records
+ * the model generation it was computed with; setModel bumps the generation,
+ * which turns all older entries into misses.
+ *
+ * The network itself keeps per-layer state in forward, so misses are
+ * evaluated one at a time.
+ */
+template <class S>
+class InferenceCache {
+  struct Entry {
+    Hash128 key;
+    uint64_t generation;
+    uint8_t label;
+    std::vector<S> output; /* empty if labelsOnly */
+  };
+  struct Shard {
+    std::mutex mutex;
+    std::list<Entry> lru; /* most recently used first */
+    std::unordered_map<Hash128, typename std::list<Entry>::iterator, Hash128Hasher> index;
+  };
+  std::shared_ptr<Network<S>> _net;
+  std::mutex _netMutex;
+  std::atomic<uint64_t> _generation;
+  bool _labelsOnly;
+  size_t _shardCapacity;
+  std::vector<std::unique_ptr<Shard> > _shards;
+  std::atomic<uint64_t> _hits, _misses, _evictions, _stale, _hitNanoseconds, _missNanoseconds;
+
+  Shard &shardOf(const Hash128 &key) {
+    return *_shards[key.hi % _shards.size()];
+  }
+
+  /* returns false on a miss; a stale entry is removed */
+  bool lookup(const Hash128 &key, bool needOutput, Entry &found) {
+    Shard &shard = shardOf(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.index.find(key);
+    if(it == shard.index.end()) return false;
+    if(it->second->generation != _generation) {
+      shard.lru.erase(it->second);
+      shard.index.erase(it);
+      _stale++;
+      return false;
+    }
+    if(needOutput && it->second->output.empty()) return false;
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+    found = *it->second;
+    return true;
+  }
+
+  void insert(Entry &&entry) {
+    Shard &shard = shardOf(entry.key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.index.find(entry.key);
+    if(it != shard.index.end()) {
+      if(it->second->generation > entry.generation) return;
+      shard.lru.erase(it->second);
+      shard.index.erase(it);
+    }
+    shard.lru.push_front(std::move(entry));
+    shard.index[shard.lru.front().key] = shard.lru.begin();
+    if(shard.lru.size() > _shardCapacity) {
+      shard.index.erase(shard.lru.back().key);
+      shard.lru.pop_back();
+      _evictions++;
+    }
+  }
+
+  Entry evaluate(const Hash128 &key, TensorView<const uint8_t> input, S scale) {
+    Entry entry;
+    entry.key = key;
+    std::vector<S> output;
+    {
+      std::lock_guard<std::mutex> lock(_netMutex);
+      entry.generation = _generation;
+      output = _net->forward(input, scale).toVector();
+    }
+    entry.label = std::distance(output.begin(), std::max_element(output.begin(), output.end()));
+    entry.output = output;
+    return entry;
+  }
+
+  Entry get(TensorView<const uint8_t> input, S scale, bool needOutput) {
+    auto start = std::chrono::steady_clock::now();
+    Hash128 key = hash128(input.data(), input.size());
+    Entry entry;
+    if(lookup(key, needOutput, entry)) {
+      _hits++;
+      _hitNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+      return entry;
+    }
+    entry = evaluate(key, input, scale);
+    Entry stored = entry;
+    if(_labelsOnly) stored.output.clear();
+    insert(std::move(stored));
+    _misses++;
+    _missNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    return entry;
+  }
+
+public:
+  InferenceCache(std::shared_ptr<Network<S>> net, size_t capacity, int numShards = 16, bool labelsOnly = false) :
+    _net(net),
+    _generation(0),
+    _labelsOnly(labelsOnly),
+    _shardCapacity(std::max<size_t>(1, capacity / numShards)),
+    _hits(0),
+    _misses(0),
+    _evictions(0),
+    _stale(0),
+    _hitNanoseconds(0),
+    _missNanoseconds(0)
+  {
+    for(int s = 0; s < numShards; s++) {
+      _shards.push_back(std::unique_ptr<Shard>(new Shard()));
+    }
+  }
+
+  /* the input scale must not change between calls, it is not part of the key */
+  std::vector<S> forward(TensorView<const uint8_t> input, S scale) {
+    return get(input, scale, true).output;
+  }
+
+  uint8_t classify(TensorView<const uint8_t> input, S scale) {
+    return get(input, scale, false).label;
+  }
+
+  /* hot-swaps the model; entries computed with the previous one are never returned again */
+  void setModel(std::shared_ptr<Network<S>> net) {
+    std::lock_guard<std::mutex> lock(_netMutex);
+    _net = net;
+    _generation++;
+  }
+
+  std::shared_ptr<Network<S>> getModel() {
+    std::lock_guard<std::mutex> lock(_netMutex);
+    return _net;
+  }
+
+  size_t size() {
+    size_t total = 0;
+    for(auto &shard : _shards) {
+      std::lock_guard<std::mutex> lock(shard->mutex);
+      total += shard->lru.size();
+    }
+    return total;
+  }
+
+  /* entries with their outputs, list nodes and index nodes (node overheads estimated) */
+  size_t memoryBytes() {
+    size_t bytes = 0;
+    for(auto &shard : _shards) {
+      std::lock_guard<std::mutex> lock(shard->mutex);
+      for(const Entry &entry : shard->lru) {
+	bytes += sizeof(Entry) + 2 * sizeof(void *) + entry.output.capacity() * sizeof(S);
+      }
+      bytes += shard->index.size() * (sizeof(Hash128) + 3 * sizeof(void *)) + shard->index.bucket_count() * sizeof(void *);
+    }
+    return bytes;
+  }
+
+  InferenceCacheStats getStats() const {
+    return InferenceCacheStats{_hits, _misses, _evictions, _stale, _hitNanoseconds, _missNanoseconds};
+  }
+};
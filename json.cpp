@@ -0,0 +1,140 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+#include <cctype>
+#include <cstdlib>
+
+/* the subset of JSON used by the benchmark baselines: objects, strings and numbers */
+struct JsonValue {
+  enum class Type {
+    NUMBER,
+    STRING,
+    OBJECT
+  };
+  Type _type;
+  double _number;
+  std::string _string;
+  std::map<std::string, JsonValue> _members;
+
+  JsonValue() :
+    _type(Type::OBJECT),
+    _number(0)
+  {
+  }
+
+  JsonValue(double number) :
+    _type(Type::NUMBER),
+    _number(number)
+  {
+  }
+
+  JsonValue(const std::string &str) :
+    _type(Type::STRING),
+    _number(0),
+    _string(str)
+  {
+  }
+
+  bool has(const std::string &key) const {
+    return _type == Type::OBJECT && _members.count(key) > 0;
+  }
+
+  const JsonValue &operator[](const std::string &key) const {
+    return _members.at(key);
+  }
+
+  JsonValue &operator[](const std::string &key) {
+    return _members[key];
+  }
+
+  void write(std::ostream &os, int indent = 0) const {
+    switch(_type) {
+    case Type::NUMBER:
+      os << std::setprecision(10) << _number;
+      break;
+    case Type::STRING:
+      os << '"' << _string << '"';
+      break;
+    case Type::OBJECT:
+      os << "{";
+      for(auto it = _members.begin(); it != _members.end(); it++) {
+	os << (it == _members.begin() ? "\n" : ",\n") << std::string(indent + 2, ' ') << '"' << it->first << "\": ";
+	it->second.write(os, indent + 2);
+      }
+      os << "\n" << std::string(indent, ' ') << "}";
+      break;
+    }
+  }
+};
+
+/* returns false and reports the offset on malformed input; strings have no escapes */
+class JsonParser {
+  const std::string &_text;
+  size_t _pos;
+
+  void skipSpace() {
+    while(_pos < _text.size() && std::isspace(static_cast<unsigned char>(_text[_pos]))) _pos++;
+  }
+
+  bool expect(char c) {
+    skipSpace();
+    if(_pos >= _text.size() || _text[_pos] != c) return false;
+    _pos++;
+    return true;
+  }
+
+  bool parseString(std::string &out) {
+    if(!expect('"')) return false;
+    size_t end = _text.find('"', _pos);
+    if(end == std::string::npos) return false;
+    out = _text.substr(_pos, end - _pos);
+    _pos = end + 1;
+    return true;
+  }
+
+  bool parseValue(JsonValue &value) {
+    skipSpace();
+    if(_pos >= _text.size()) return false;
+    if(_text[_pos] == '{') {
+      _pos++;
+      value = JsonValue();
+      if(expect('}')) return true;
+      do {
+	std::string key;
+	if(!parseString(key) || !expect(':') || !parseValue(value._members[key])) return false;
+      } while(expect(','));
+      return expect('}');
+    }
+    if(_text[_pos] == '"') {
+      std::string str;
+      if(!parseString(str)) return false;
+      value = JsonValue(str);
+      return true;
+    }
+    const char *begin = _text.c_str() + _pos;
+    char *end;
+    double number = std::strtod(begin, &end);
+    if(end == begin) return false;
+    _pos += end - begin;
+    value = JsonValue(number);
+    return true;
+  }
+public:
+  JsonParser(const std::string &text) :
+    _text(text),
+    _pos(0)
+  {
+  }
+
+  bool parse(JsonValue &value) {
+    if(!parseValue(value)) {
+      std::cerr << "JSON parse error at offset " << _pos << std::endl;
+      return false;
+    }
+    return true;
+  }
+};
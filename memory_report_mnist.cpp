@@ -0,0 +1,28 @@
+#define NN_TRACK_ALLOCATIONS
+#include <utility>
+#include <iostream>
+#include <iomanip>
+
+#include "trainer.cpp"
+
+int main(int argc, char **argv) {
+  int hiddenSize = argc > 1 ? std::atoi(argv[1]) : 300;
+  int numEpochs = argc > 2 ? std::atoi(argv[2]) : 2;
+
+  MNistDataSet trainSet("mnist/train-images-idx3-ubyte", "mnist/train-labels-idx1-ubyte");
+  const size_t imageBytes = trainSet.getNumRows() * trainSet.getNumColumns();
+
+  std::cout << "estimate: ";
+  printMemoryReport(estimateMemory<float>({imageBytes, static_cast<size_t>(hiddenSize), 10}, trainSet.getNumImages(), imageBytes), std::cout);
+
+  Network<float> net;
+  net.addLayer(imageBytes, hiddenSize, Layer<float>::ActivationType::RELU);
+  net.addLayer(hiddenSize, 10, Layer<float>::ActivationType::SOFTMAX);
+  std::cout << "built: ";
+  printMemoryReport(collectMemory(net, &trainSet), std::cout);
+
+  memoryReportEnabled() = true;
+  for(int epoch = 0; epoch < numEpochs; epoch++) {
+    runEpoch(net, trainSet, true, 0.2);
+  }
+}
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <atomic>
+#include <new>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+
+#include "neural_net.cpp"
+#include "mnist.cpp"
+
+/*
+ * Memory accounting. Subsystem totals come from the containers themselves
+ * (LayerBase::addMemory, MNistDataSet::getMemoryBytes, the caches'
+ * memoryBytes); RSS comes from /proc. Defining NN_TRACK_ALLOCATIONS before
+ * including this file also replaces the global operator new/delete to count
+ * every allocation and the live and peak heap bytes.
+ */
+std::atomic<uint64_t> allocationCount(0), liveHeapBytes(0), peakHeapBytes(0);
+
+#ifdef NN_TRACK_ALLOCATIONS
+const size_t allocationHeader = 16; /* size, then the pointer malloc returned; keeps the returned pointer 16-byte aligned */
+
+/*
+ * Both stay out of line: inlined into a caller of new and delete, g++ would
+ * see free() on a pointer from new (-Wmismatched-new-delete) and the header
+ * access as out of the caller's bounds (-Warray-bounds).
+ */
+__attribute__((noinline)) void *trackedAlloc(size_t size, size_t alignment = allocationHeader) {
+  uint8_t *raw = static_cast<uint8_t *>(std::malloc(size + alignment + allocationHeader));
+  if(!raw) return nullptr;
+  const uintptr_t first = reinterpret_cast<uintptr_t>(raw) + allocationHeader;
+  uint8_t *p = raw + allocationHeader + (alignment - first % alignment) % alignment;
+  std::memcpy(p - allocationHeader, &size, sizeof(size));
+  std::memcpy(p - sizeof(raw), &raw, sizeof(raw));
+  allocationCount++;
+  const uint64_t live = liveHeapBytes += size;
+  uint64_t peak = peakHeapBytes;
+  while(live > peak && !peakHeapBytes.compare_exchange_weak(peak, live)) {}
+  return p;
+}
+
+__attribute__((noinline)) void trackedFree(void *ptr) {
+  if(!ptr) return;
+  uint8_t *p = static_cast<uint8_t *>(ptr);
+  size_t size;
+  uint8_t *raw;
+  std::memcpy(&size, p - allocationHeader, sizeof(size));
+  std::memcpy(&raw, p - sizeof(raw), sizeof(raw));
+  liveHeapBytes -= size;
+  std::free(raw);
+}
+
+void *operator new(size_t size) {
+  void *p = trackedAlloc(size);
+  if(!p) throw std::bad_alloc();
+  return p;
+}
+
+void *operator new[](size_t size) {
+  void *p = trackedAlloc(size);
+  if(!p) throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void *p) noexcept {
+  trackedFree(p);
+}
+
+void operator delete[](void *p) noexcept {
+  trackedFree(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+  trackedFree(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+  trackedFree(p);
+}
+
+#ifdef __cpp_aligned_new
+/* over-aligned types (alignas above 16) from C++17 on */
+void *operator new(size_t size, std::align_val_t alignment) {
+  void *p = trackedAlloc(size, static_cast<size_t>(alignment));
+  if(!p) throw std::bad_alloc();
+  return p;
+}
+
+void *operator new[](size_t size, std::align_val_t alignment) {
+  void *p = trackedAlloc(size, static_cast<size_t>(alignment));
+  if(!p) throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void *p, std::align_val_t) noexcept {
+  trackedFree(p);
+}
+
+void operator delete[](void *p, std::align_val_t) noexcept {
+  trackedFree(p);
+}
+
+void operator delete(void *p, size_t, std::align_val_t) noexcept {
+  trackedFree(p);
+}
+
+void operator delete[](void *p, size_t, std::align_val_t) noexcept {
+  trackedFree(p);
+}
+#endif
+#endif
+
+bool allocationTrackingEnabled() {
+#ifdef NN_TRACK_ALLOCATIONS
+  return true;
+#else
+  return false;
+#endif
+}
+
+/* a "kB" field of /proc/self/status such as VmRSS or VmHWM (peak RSS), 0 where unavailable */
+size_t readProcStatusKb(const std::string &field) {
+  std::ifstream ifs("/proc/self/status");
+  std::string line;
+  while(std::getline(ifs, line)) {
+    if(line.compare(0, field.size() + 1, field + ":") == 0) return std::strtoul(line.c_str() + field.size() + 1, nullptr, 10);
+  }
+  return 0;
+}
+
+template <class S>
+MemoryStats collectMemory(const Network<S> &net, MNistDataSet *set = nullptr) {
+  MemoryStats stats;
+  net.addMemory(stats);
+  if(set) stats.dataset += set->getMemoryBytes();
+  return stats;
+}
+
+void printMemoryReport(const MemoryStats &stats, std::ostream &os) {
+  auto mb = [](size_t bytes) {return bytes / (1024.0 * 1024.0);};
+  os << std::fixed << std::setprecision(2)
+     << "memory MB: weights " << mb(stats.weights)
+     << ", gradients " << mb(stats.gradients)
+     << ", optimizer " << mb(stats.optimizerState)
+     << ", activations " << mb(stats.activations)
+     << ", dataset " << mb(stats.dataset)
+     << ", caches " << mb(stats.caches)
+     << ", total " << mb(stats.total())
+     << "; RSS " << readProcStatusKb("VmRSS") / 1024.0 << " (peak " << readProcStatusKb("VmHWM") / 1024.0 << ")";
+  if(allocationTrackingEnabled()) {
+    os << "; heap " << mb(liveHeapBytes) << " (peak " << mb(peakHeapBytes) << "), " << allocationCount << " allocations";
+  }
+  os << std::endl;
+}
+
+/* training footprint of a dense network with the given layer sizes (input first) before building it */
+template <class S>
+MemoryStats estimateMemory(const std::vector<size_t> &sizes, size_t numImages, size_t imageBytes) {
+  MemoryStats stats;
+  for(size_t l = 0; l + 1 < sizes.size(); l++) {
+    stats.weights += Layer<S>::estimateBytes(sizes[l], sizes[l + 1]) / 2;
+    stats.gradients += Layer<S>::estimateBytes(sizes[l], sizes[l + 1]) / 2;
+    stats.activations += 2 * sizes[l + 1] * sizeof(S); /* inputs are views */
+  }
+  stats.dataset = numImages * (imageBytes + 1);
+  return stats;
+}
+
+/* per-epoch report from runEpoch, off by default */
+bool &memoryReportEnabled() {
+  static bool enabled = false;
+  return enabled;
+}
@@ -1,12 +1,23 @@
+#pragma once
+
 #include <vector>
 #include <iostream>
 #include <fstream>
+#include <memory>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "tensor_view.cpp"
 
 class MNistDataSet {
   uint32_t _numImages;
   uint32_t _numRows;
   uint32_t _numColumns;
-  std::vector<std::vector<uint8_t> > _images;
+  std::vector<uint8_t> _images; /* numImages x numRows * numColumns, one contiguous tensor, empty if mapped */
+  std::shared_ptr<const uint8_t> _mapped; /* the same tensor in the mapped image file, shared by copies */
+  size_t _mappedBytes;
   std::vector<uint8_t> _labels;
 
   static bool isLittleEndian() {
@@ -38,8 +49,36 @@ class MNistDataSet {
     return buf;
   }
 
+  /* read-only shared mapping, so processes (and forked children) mapping the same file share its pages */
+  bool mapPixels(const std::string &imageFile, size_t numPixels) {
+    const size_t headerBytes = 16, bytes = headerBytes + numPixels;
+    int fd = open(imageFile.c_str(), O_RDONLY);
+    struct stat st;
+    void *mapped = MAP_FAILED;
+    if(fd >= 0 && fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= bytes) {
+      mapped = mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    if(fd >= 0) close(fd);
+    if(mapped == MAP_FAILED) {
+      std::cerr << "cannot map " << imageFile << ", reading it into memory" << std::endl;
+      return false;
+    }
+    _mapped = std::shared_ptr<const uint8_t>(static_cast<const uint8_t *>(mapped) + headerBytes, [mapped, bytes](const uint8_t *) {
+      munmap(mapped, bytes);
+    });
+    _mappedBytes = numPixels;
+    return true;
+  }
+
+  const uint8_t *pixels() {
+    return _mapped ? _mapped.get() : _images.data();
+  }
+
 public:
-  MNistDataSet(const std::string imageFile, const std::string labelFile) {
+  /* with mapImages the images stay in the file's page cache instead of being read into memory */
+  MNistDataSet(const std::string imageFile, const std::string labelFile, bool mapImages = false) :
+    _mappedBytes(0)
+  {
     std::ifstream ifsLabel(labelFile, std::ios::in|std::ios::binary);
     uint32_t magicNumber;
     magicNumber = readUInt32(ifsLabel);
@@ -51,8 +90,38 @@ public:
     _numImages = readUInt32(ifsImage);
     _numRows = readUInt32(ifsImage);
     _numColumns = readUInt32(ifsImage);
-    for(int i = 0; i < _numImages; i++) {
-      _images.push_back(readArray(ifsImage, _numRows*_numColumns));
+    const size_t numPixels = static_cast<size_t>(_numImages)*_numRows*_numColumns;
+    if(!mapImages || !mapPixels(imageFile, numPixels)) {
+      _images = readArray(ifsImage, numPixels);
+    }
+  }
+
+  /* in-memory data set, e.g. synthetic; images are numRows * numColumns bytes each */
+  MNistDataSet(uint32_t numRows, uint32_t numColumns, const std::vector<std::vector<uint8_t> > &images, const std::vector<uint8_t> &labels) :
+    _numImages(images.size()),
+    _numRows(numRows),
+    _numColumns(numColumns),
+    _mappedBytes(0),
+    _labels(labels)
+  {
+    _images.reserve(images.size() * numRows * numColumns);
+    for(const auto &image : images) _images.insert(_images.end(), image.begin(), image.end());
+  }
+
+  /* images [begin, end) of set, e.g. to hold out a validation split; a mapped set's pages are shared, not copied */
+  MNistDataSet(const MNistDataSet &set, uint32_t begin, uint32_t end) :
+    _numImages(end - begin),
+    _numRows(set._numRows),
+    _numColumns(set._numColumns),
+    _mappedBytes(0),
+    _labels(set._labels.begin() + begin, set._labels.begin() + end)
+  {
+    const size_t imageSize = static_cast<size_t>(_numRows) * _numColumns;
+    if(set._mapped) {
+      _mapped = std::shared_ptr<const uint8_t>(set._mapped, set._mapped.get() + begin * imageSize);
+      _mappedBytes = _numImages * imageSize;
+    }else {
+      _images.assign(set._images.begin() + begin * imageSize, set._images.begin() + end * imageSize);
     }
   }
 
@@ -68,22 +137,60 @@ public:
     return _numColumns;
   }
 
+  /* mapped images included, though their pages are shared with every process mapping the file */
+  size_t getMemoryBytes() {
+    return _images.capacity() + _mappedBytes + _labels.capacity();
+  }
+
+  bool isMapped() {
+    return _mapped != nullptr;
+  }
+
   uint8_t getLabel(int i) {
     return _labels[i];
   }
 
-  std::vector<uint8_t> getImage(int i) {
-    return _images[i];
+  /* all images, numImages x numRows * numColumns */
+  TensorView<const uint8_t> getImages() {
+    return TensorView<const uint8_t>(pixels(), _numImages, _numRows*_numColumns);
+  }
+
+  /* images [begin, end) without copying */
+  TensorView<const uint8_t> getBatch(uint32_t begin, uint32_t end) {
+    return getImages().slice(0, begin, end);
+  }
+
+  TensorView<const uint8_t> getImage(int i) {
+    return getImages().select(0, i);
   }
 
   std::vector<double> getImageDouble(int i) {
     std::vector<double> imageDouble(_numRows*_numColumns);
     for(int p = 0; p < _numRows*_numColumns; p++) {
-      imageDouble[p] = ((double)_images[i][p]) / ((double)256);
+      imageDouble[p] = ((double)pixels()[i*_numRows*_numColumns + p]) / ((double)256);
     }
     return imageDouble;
   }
 
+  /* pixels above threshold become +1, the rest -1 */
+  std::vector<double> getImageSign(int i, uint8_t threshold = 127) {
+    std::vector<double> imageSign(_numRows*_numColumns);
+    for(int p = 0; p < _numRows*_numColumns; p++) {
+      imageSign[p] = pixels()[i*_numRows*_numColumns + p] > threshold ? 1.0 : -1.0;
+    }
+    return imageSign;
+  }
+
+  /* same thresholding as getImageSign, one bit per pixel (set: +1), padded with zero words to numWords */
+  std::vector<uint64_t> getImagePacked(int i, size_t numWords, uint8_t threshold = 127) {
+    std::vector<uint64_t> packed(numWords, 0);
+    const uint8_t *image = getImage(i).data();
+    for(int p = 0; p < _numRows*_numColumns; p++) {
+      packed[p / 64] |= static_cast<uint64_t>(image[p] > threshold) << (p % 64);
+    }
+    return packed;
+  }
+
   std::vector<double> getLabelDouble(int i) {
     std::vector<double> labelDouble(10, 0.0);
     labelDouble[_labels[i]] = 1.0;
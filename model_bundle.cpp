@@ -0,0 +1,192 @@
+#pragma once
+
+#include <vector>
+#include <iostream>
+#include <algorithm>
+#include <iterator>
+#include <memory>
+
+#include "neural_net.cpp"
+#include "mnist.cpp"
+
+/*
+ * K networks of the same shape trained in lockstep on the same samples.
+ * Their first dense layers are packed side by side into one layer of
+ * K * outSize columns, so each input is read once per sample by a single
+ * wide kernel instead of once per model; the later layers stay the
+ * models' own. Every model follows exactly the arithmetic it would alone,
+ * so a bundle trains the same weights as K runEpoch calls. Training
+ * updates the packed copy of the first layers; unpack writes it back. If
+ * the first layers are frozen, so is the packed one.
+ */
+template <class S>
+class ModelBundle {
+  std::vector<std::shared_ptr<Network<S>>> _nets;
+  std::shared_ptr<Layer<S>> _first; /* packed first layers, model k in columns [k * _hiddenSize, (k + 1) * _hiddenSize) */
+  size_t _hiddenSize;
+  std::vector<S> _propagated; /* error w.r.t. the packed layer's output, size: K * _hiddenSize */
+
+public:
+  ModelBundle() :
+    _hiddenSize(0)
+  {
+  }
+
+  /* false unless every net starts with a dense non-softmax layer of the same shape and freezing and has more layers after it */
+  bool pack(const std::vector<std::shared_ptr<Network<S>>> &nets) {
+    if(nets.empty()) {
+      std::cerr << "ModelBundle: no networks" << std::endl;
+      return false;
+    }
+    std::vector<std::shared_ptr<Layer<S>>> firsts;
+    for(size_t k = 0; k < nets.size(); k++) {
+      std::shared_ptr<Layer<S>> first = std::dynamic_pointer_cast<Layer<S>>(nets[k]->getLayer(0));
+      if(!first || nets[k]->getNumLayers() < 2 || first->_activationType == Layer<S>::ActivationType::SOFTMAX) {
+	std::cerr << "ModelBundle: network " << k << " does not start with a dense non-softmax hidden layer" << std::endl;
+	return false;
+      }
+      if(k > 0 && (first->_inSize != firsts[0]->_inSize || first->_outSize != firsts[0]->_outSize || first->_activationType != firsts[0]->_activationType
+		   || first->_frozen != firsts[0]->_frozen)) {
+	std::cerr << "ModelBundle: the first layer of network " << k << " differs from network 0" << std::endl;
+	return false;
+      }
+      firsts.push_back(first);
+    }
+    _nets = nets;
+    _hiddenSize = firsts[0]->_outSize;
+    _first = std::make_shared<Layer<S> >(firsts[0]->_inSize - 1, nets.size() * _hiddenSize, firsts[0]->_activationType);
+    for(size_t i = 0; i < _first->_inSize; i++) {
+      for(size_t k = 0; k < nets.size(); k++) {
+	std::copy(firsts[k]->_w[i].begin(), firsts[k]->_w[i].end(), _first->_w[i].begin() + k * _hiddenSize);
+      }
+    }
+    if(firsts[0]->_frozen) {
+      _first->_frozen = true;
+      _first->_w_grad.clear(); /* never accumulated */
+    }
+    _propagated.assign(nets.size() * _hiddenSize, 0);
+    return true;
+  }
+
+  /* copies the packed first-layer weights back into the networks */
+  void unpack() {
+    for(size_t k = 0; k < _nets.size(); k++) {
+      Layer<S> &first = static_cast<Layer<S> &>(*_nets[k]->getLayer(0));
+      for(size_t i = 0; i < _first->_inSize; i++) {
+	std::copy(_first->_w[i].begin() + k * _hiddenSize, _first->_w[i].begin() + (k + 1) * _hiddenSize, first._w[i].begin());
+      }
+    }
+  }
+
+  size_t getNumModels() const {
+    return _nets.size();
+  }
+
+  std::shared_ptr<Network<S>> getNetwork(size_t k) const {
+    return _nets[k];
+  }
+
+  /* output buffer of model k, valid until the next forward */
+  TensorView<const S> getOutput(size_t k) const {
+    return _nets[k]->getLayer(_nets[k]->getNumLayers() - 1)->_output;
+  }
+
+  /* runs all models on one input, which must stay valid until backward */
+  void forward(TensorView<const uint8_t> input, S scale) {
+    forwardHeads(_first->forward(input, scale));
+  }
+
+  void forward(TensorView<const S> input) {
+    forwardHeads(_first->forward(input));
+  }
+
+  /* Network::backward for every model, the first layers' gradients in one wide update */
+  void backward(const std::vector<S> &target, S weight = static_cast<S>(1)) {
+    for(size_t k = 0; k < _nets.size(); k++) {
+      std::vector<S> propagated = _nets[k]->backwardFrom(target, weight, 1);
+      std::copy(propagated.begin(), propagated.end(), _propagated.begin() + k * _hiddenSize);
+    }
+    if(!_first->_frozen) _first->updateGrad(_first->calcDelta(_propagated));
+  }
+
+  S calcLoss(size_t k, const std::vector<S> &target) {
+    return _nets[k]->calcLoss(target);
+  }
+
+  /* model k steps with learningRates[k] */
+  void updateParam(const std::vector<S> &learningRates) {
+    if(_first->_sampleCount > 0) {
+      defaultScheduler().parallelFor(0, _first->_inSize, Layer<S>::taskGrain, [&](size_t i0, size_t i1) {
+	for(size_t i = i0; i < i1; i++) {
+	  for(size_t k = 0; k < _nets.size(); k++) {
+	    const S rate = learningRates[k] / static_cast<S>(_first->_sampleCount);
+	    vec(_first->_w[i].data() + k * _hiddenSize, _hiddenSize) -= rate * vec(_first->_w_grad[i].data() + k * _hiddenSize, _hiddenSize);
+	  }
+	  vec(_first->_w_grad[i]) = static_cast<S>(0);
+	}
+      });
+      _first->_sampleCount = 0;
+    }
+    for(size_t k = 0; k < _nets.size(); k++) {
+      for(size_t l = 1; l < _nets[k]->getNumLayers(); l++) {
+	LayerBase<S> &layer = *_nets[k]->getLayer(l);
+	if(!layer._frozen) layer.updateParam(learningRates[k]);
+      }
+    }
+  }
+
+  /* the packed layer and the models' later layers; the models' own first layers are not counted */
+  void addMemory(MemoryStats &stats) const {
+    _first->addMemory(stats);
+    for(auto &net : _nets) {
+      for(size_t l = 1; l < net->getNumLayers(); l++) {
+	net->getLayer(l)->addMemory(stats);
+      }
+    }
+    stats.activations += vectorBytes(_propagated);
+  }
+
+private:
+  void forwardHeads(TensorView<const S> hidden) {
+    for(size_t k = 0; k < _nets.size(); k++) {
+      _nets[k]->forward(hidden.slice(0, k * _hiddenSize, (k + 1) * _hiddenSize), 1, _nets[k]->getNumLayers());
+    }
+  }
+};
+
+/*
+ * runEpoch for every model of the bundle on raw image bytes, with
+ * learningRates[k] for model k and the same batches for all; returns
+ * (mean loss, error rate) per model. After training the networks are
+ * unpacked, so they can be used on their own.
+ */
+template <class S>
+std::vector<std::pair<double, double>> runBundleEpoch(ModelBundle<S> &bundle, MNistDataSet &set, bool train, const std::vector<double> &learningRates = {}, int batchSize = 100) {
+  const size_t numModels = bundle.getNumModels();
+  std::vector<double> sumLoss(numModels, 0);
+  std::vector<uint32_t> numWrong(numModels, 0);
+  std::vector<S> rates(learningRates.begin(), learningRates.end());
+  rates.resize(numModels, static_cast<S>(0.1));
+  for(uint32_t sample = 0; sample < set.getNumImages(); sample++) {
+    bundle.forward(set.getImage(sample), static_cast<S>(1.0 / 256));
+    std::vector<double> labelDouble = set.getLabelDouble(sample);
+    std::vector<S> labelOneHot(labelDouble.begin(), labelDouble.end());
+    for(size_t k = 0; k < numModels; k++) {
+      TensorView<const S> out = bundle.getOutput(k);
+      numWrong[k] += std::distance(out.begin(), std::max_element(out.begin(), out.end())) != set.getLabel(sample);
+      sumLoss[k] += static_cast<double>(bundle.calcLoss(k, labelOneHot));
+    }
+    if(train) {
+      bundle.backward(labelOneHot);
+      if(sample % batchSize == 0 || sample == set.getNumImages() - 1) {
+	bundle.updateParam(rates);
+      }
+    }
+  }
+  if(train) bundle.unpack();
+  std::vector<std::pair<double, double>> results;
+  for(size_t k = 0; k < numModels; k++) {
+    results.push_back(std::make_pair(sumLoss[k] / set.getNumImages(), static_cast<double>(numWrong[k]) / set.getNumImages()));
+  }
+  return results;
+}
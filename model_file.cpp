@@ -0,0 +1,187 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <thread>
+#include <cmath>
+#include <cstring>
+
+#include "neural_net.cpp"
+#include "entropy_coder.cpp"
+
+/*
+ * Compact model file for distribution. Each dense layer's weights are
+ * quantized to int8 with one scale per tensor (values within pruneLevel of
+ * zero are pruned), optionally delta-encoded along the output dimension when
+ * that lowers the entropy, and Huffman-coded in independently decodable
+ * chunks.
+ *
+ * "NNMF", version, layer count, then per layer: inSize, outSize,
+ * activation, delta flag, scale (float), Huffman stream.
+ */
+const char modelFileMagic[4] = {'N', 'N', 'M', 'F'};
+const uint32_t modelFileVersion = 1;
+
+struct ModelFileStats {
+  size_t numWeights;
+  size_t rawBytes; /* weights as S */
+  size_t fileBytes;
+};
+
+double byteEntropy(const std::vector<uint8_t> &symbols) {
+  std::vector<size_t> freq(256, 0);
+  for(uint8_t s : symbols) freq[s]++;
+  double bits = 0;
+  for(size_t f : freq) {
+    if(f > 0) bits -= f * std::log2(static_cast<double>(f) / symbols.size());
+  }
+  return bits;
+}
+
+template <class S>
+bool saveCompactModel(const Network<S> &net, const std::string &path, int pruneLevel = 0, ModelFileStats *stats = nullptr) {
+  std::vector<uint8_t> out(modelFileMagic, modelFileMagic + 4);
+  putUInt32(out, modelFileVersion);
+  putUInt32(out, net.getNumLayers());
+  size_t numWeights = 0;
+  for(int l = 0; l < net.getNumLayers(); l++) {
+    std::shared_ptr<Layer<S>> layer = std::dynamic_pointer_cast<Layer<S>>(net.getLayer(l));
+    if(!layer) {
+      std::cerr << "layer " << l << " is not a dense layer" << std::endl;
+      return false;
+    }
+    const size_t inSize = layer->_inSize, outSize = layer->_outSize;
+    S maxAbs = 0;
+    for(const auto &row : layer->_w) {
+      for(S w : row) maxAbs = std::max(maxAbs, std::abs(w));
+    }
+    const float scale = maxAbs > 0 ? static_cast<float>(maxAbs) / 127 : 1;
+    std::vector<uint8_t> symbols(inSize * outSize), deltas(inSize * outSize);
+    for(int i = 0; i < inSize; i++) {
+      int8_t prev = 0;
+      for(int j = 0; j < outSize; j++) {
+	int q = static_cast<int>(std::lround(layer->_w[i][j] / scale));
+	if(std::abs(q) <= pruneLevel) q = 0;
+	const int8_t value = static_cast<int8_t>(std::max(-127, std::min(127, q)));
+	symbols[i * outSize + j] = static_cast<uint8_t>(value);
+	deltas[i * outSize + j] = static_cast<uint8_t>(value - prev);
+	prev = value;
+      }
+    }
+    const bool useDelta = byteEntropy(deltas) < byteEntropy(symbols);
+    putUInt32(out, inSize - 1);
+    putUInt32(out, outSize);
+    out.push_back(static_cast<uint8_t>(layer->_activationType));
+    out.push_back(useDelta ? 1 : 0);
+    uint32_t scaleBits;
+    std::memcpy(&scaleBits, &scale, 4);
+    putUInt32(out, scaleBits);
+    const std::vector<uint8_t> &coded = useDelta ? deltas : symbols;
+    encodeHuffmanStream(coded.data(), coded.size(), out);
+    numWeights += inSize * outSize;
+  }
+  std::ofstream ofs(path, std::ios::out|std::ios::binary);
+  ofs.write(reinterpret_cast<const char *>(out.data()), out.size());
+  if(stats) {
+    stats->numWeights = numWeights;
+    stats->rawBytes = numWeights * sizeof(S);
+    stats->fileBytes = out.size();
+  }
+  return static_cast<bool>(ofs);
+}
+
+/* decodes the chunks of all layers, then dequantizes their rows, both with numThreads threads */
+template <class S>
+bool decodeCompactModel(const std::vector<uint8_t> &file, Network<S> &net, int numThreads) {
+  if(file.size() < 12 || std::memcmp(file.data(), modelFileMagic, 4) != 0 || getUInt32(&file[4]) != modelFileVersion) {
+    std::cerr << "not a compact model file" << std::endl;
+    return false;
+  }
+  struct LayerInfo {
+    uint32_t inSize, outSize;
+    typename Layer<S>::ActivationType activationType;
+    bool delta;
+    float scale;
+  };
+  const uint32_t numLayers = getUInt32(&file[8]);
+  const uint8_t *end = file.data() + file.size();
+  if(numLayers == 0 || numLayers > (file.size() - 12) / 14) {
+    std::cerr << "compact model file: bad layer count " << numLayers << std::endl;
+    return false;
+  }
+  std::vector<LayerInfo> infos(numLayers);
+  std::vector<HuffmanCode> codes(numLayers);
+  std::vector<std::vector<uint8_t> > symbols(numLayers);
+  std::vector<HuffmanChunk> chunks;
+  const uint8_t *p = &file[12];
+  for(uint32_t l = 0; l < numLayers; l++) {
+    LayerInfo &info = infos[l];
+    if(end - p < 14) {
+      std::cerr << "compact model file: truncated at layer " << l << std::endl;
+      return false;
+    }
+    info.inSize = getUInt32(p);
+    info.outSize = getUInt32(p + 4);
+    if(p[8] > static_cast<uint8_t>(Layer<S>::ActivationType::SIGN)) {
+      std::cerr << "compact model file: bad activation " << static_cast<int>(p[8]) << " in layer " << l << std::endl;
+      return false;
+    }
+    info.activationType = static_cast<typename Layer<S>::ActivationType>(p[8]);
+    info.delta = p[9] != 0;
+    uint32_t scaleBits = getUInt32(p + 10);
+    std::memcpy(&info.scale, &scaleBits, 4);
+    p += 14;
+    /* every symbol takes at least one bit, which bounds the allocation by the file size */
+    const uint64_t numSymbols = (static_cast<uint64_t>(info.inSize) + 1) * info.outSize;
+    if(info.inSize == 0 || info.outSize == 0 || (l > 0 && info.inSize != infos[l - 1].outSize) || numSymbols > 8 * static_cast<uint64_t>(end - p)) {
+      std::cerr << "compact model file: bad shape " << info.inSize << " x " << info.outSize << " in layer " << l << std::endl;
+      return false;
+    }
+    symbols[l].resize(numSymbols);
+    const size_t consumed = parseHuffmanStream(p, end, codes[l], symbols[l].data(), symbols[l].size(), chunks);
+    if(consumed == 0) {
+      std::cerr << "compact model file: corrupt weights in layer " << l << std::endl;
+      return false;
+    }
+    p += consumed;
+  }
+  decodeHuffmanChunks(chunks, numThreads);
+
+  /* delta coding restarts every row, so rows of all layers are dequantized in independent chunks */
+  std::vector<std::vector<std::vector<S> > > weights(numLayers);
+  std::vector<size_t> firstRow(numLayers + 1, 0);
+  for(uint32_t l = 0; l < numLayers; l++) {
+    weights[l].assign(infos[l].inSize + 1, std::vector<S>(infos[l].outSize));
+    firstRow[l + 1] = firstRow[l] + infos[l].inSize + 1;
+  }
+  TaskScheduler scheduler(std::max(1, numThreads) - 1);
+  scheduler.parallelFor(0, firstRow[numLayers], 64, [&](size_t row0, size_t row1) {
+    for(size_t row = row0; row < row1; row++) {
+      const size_t l = std::upper_bound(firstRow.begin(), firstRow.end(), row) - firstRow.begin() - 1, i = row - firstRow[l];
+      const LayerInfo &info = infos[l];
+      const uint8_t *s = symbols[l].data() + i * info.outSize;
+      S *w = weights[l][i].data();
+      int8_t value = 0;
+      for(uint32_t j = 0; j < info.outSize; j++) {
+	const int8_t symbol = static_cast<int8_t>(s[j]);
+	value = info.delta ? static_cast<int8_t>(value + symbol) : symbol;
+	w[j] = value * info.scale;
+      }
+    }
+  });
+  for(uint32_t l = 0; l < numLayers; l++) {
+    net.addLayer(std::make_shared<Layer<S> >(std::move(weights[l]), infos[l].activationType));
+  }
+  return true;
+}
+
+template <class S>
+bool loadCompactModel(const std::string &path, Network<S> &net, int numThreads = std::thread::hardware_concurrency()) {
+  std::ifstream ifs(path, std::ios::in|std::ios::binary);
+  std::vector<uint8_t> file((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+  return decodeCompactModel(file, net, std::max(1, numThreads));
+}
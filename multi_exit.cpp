@@ -0,0 +1,196 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+
+#include "neural_net.cpp"
+
+/* nominal multiply-adds (times two) of a dense layer, bias included */
+template <class S>
+double layerFlops(const LayerBase<S> &layer) {
+  return 2.0 * layer._inSize * layer._outSize;
+}
+
+struct ExitStats {
+  std::vector<uint64_t> counts; /* per exit, the final output last */
+  double sumFlops;
+  uint64_t numRequests;
+
+  double averageFlops() const {
+    return numRequests > 0 ? sumFlops / numRequests : 0;
+  }
+
+  void report(std::ostream &os, double fullFlops) const {
+    os << std::fixed << std::setprecision(4) << "exits:";
+    for(uint64_t count : counts) {
+      os << " " << (numRequests > 0 ? static_cast<double>(count) / numRequests : 0);
+    }
+    os << ", average FLOPs " << std::setprecision(0) << averageFlops()
+       << std::setprecision(4) << " (" << averageFlops() / fullFlops << " of full)" << std::endl;
+  }
+};
+
+/*
+ * Network with auxiliary classifier heads attached to the outputs of
+ * intermediate layers. Training runs every head and minimizes the sum of the
+ * final loss and the heads' losses scaled by their weights; the heads'
+ * errors flow back into the trunk. With an exit threshold set, forward
+ * returns the output of the first head (or the final layer) whose largest
+ * softmax probability reaches the threshold, skipping everything after it.
+ */
+template <class S>
+class MultiExitNetwork : public Network<S> {
+  struct Exit {
+    size_t afterLayer;
+    std::shared_ptr<Network<S>> head;
+    S weight;
+  };
+  std::vector<Exit> _exits; /* sorted by afterLayer */
+  S _exitThreshold; /* 0: run the whole network */
+  ExitStats _stats;
+public:
+  using Network<S>::forward;
+
+  MultiExitNetwork() :
+    Network<S>(),
+    _exitThreshold(0)
+  {
+    resetStats();
+  }
+
+  /* head ends with a softmax layer; afterLayer must not be the last layer */
+  void addExit(size_t afterLayer, std::shared_ptr<Network<S>> head, S weight = static_cast<S>(0.5)) {
+    _exits.push_back(Exit{afterLayer, head, weight});
+    std::sort(_exits.begin(), _exits.end(), [](const Exit &a, const Exit &b) {return a.afterLayer < b.afterLayer;});
+    resetStats();
+  }
+
+  size_t getNumExits() const {
+    return _exits.size();
+  }
+
+  /* copies the trunk, the heads and the threshold; the copy starts with empty stats */
+  std::shared_ptr<Network<S>> clone() const {
+    auto copy = std::make_shared<MultiExitNetwork<S> >();
+    if(!this->cloneLayersTo(*copy)) return nullptr;
+    for(const Exit &exit : _exits) {
+      std::shared_ptr<Network<S>> head = exit.head->clone();
+      if(!head) return nullptr;
+      copy->addExit(exit.afterLayer, head, exit.weight);
+    }
+    copy->_exitThreshold = _exitThreshold;
+    return copy;
+  }
+
+  bool canClone() const {
+    return Network<S>::canClone() && std::all_of(_exits.begin(), _exits.end(), [](const Exit &exit) {return exit.head->canClone();});
+  }
+
+  void setExitThreshold(S threshold) {
+    _exitThreshold = threshold;
+  }
+
+  const ExitStats &getStats() const {
+    return _stats;
+  }
+
+  void resetStats() {
+    _stats.counts.assign(_exits.size() + 1, 0);
+    _stats.sumFlops = 0;
+    _stats.numRequests = 0;
+  }
+
+  double fullFlops() const {
+    double flops = 0;
+    for(auto &layer : this->_layers) flops += layerFlops(*layer);
+    return flops;
+  }
+
+  TensorView<const S> forward(TensorView<const uint8_t> input, S scale) {
+    return forwardFrom(this->_layers[0]->forward(input, scale));
+  }
+
+  TensorView<const S> forward(TensorView<const S> input) {
+    return forwardFrom(this->_layers[0]->forward(input));
+  }
+
+  /* buffer is the output of layer 0 */
+  TensorView<const S> forwardFrom(TensorView<const S> buffer) {
+    double flops = layerFlops(*this->_layers[0]);
+    size_t e = 0;
+    for(size_t l = 0; ; l++) {
+      for(; e < _exits.size() && _exits[e].afterLayer == l; e++) {
+	Network<S> &head = *_exits[e].head;
+	TensorView<const S> out = head.forward(buffer);
+	for(size_t h = 0; h < head.getNumLayers(); h++) flops += layerFlops(*head.getLayer(h));
+	if(_exitThreshold > 0 && *std::max_element(out.begin(), out.end()) >= _exitThreshold) {
+	  recordExit(e, flops);
+	  return out;
+	}
+      }
+      if(l + 1 == this->_layers.size()) break;
+      buffer = this->_layers[l + 1]->forward(buffer);
+      flops += layerFlops(*this->_layers[l + 1]);
+    }
+    if(_exitThreshold > 0) recordExit(_exits.size(), flops);
+    return buffer;
+  }
+
+  void recordExit(size_t e, double flops) {
+    _stats.counts[e]++;
+    _stats.sumFlops += flops;
+    _stats.numRequests++;
+  }
+
+  /*
+   * trains head on target and returns its weighted error w.r.t. its input if
+   * toInput, or nothing if not or if head has frozen layers, which block it
+   */
+  std::vector<S> backwardHead(Network<S> &head, const std::vector<S> &target, S weight, bool toInput) {
+    std::vector<S> delta = head.backwardRange(head.outputDelta(target, weight), head.getNumLayers() - 1, 0);
+    if(!toInput || head.getNumFrozen() > 0) return {};
+    return head.getLayer(0)->backpropagate(delta);
+  }
+
+  /* Network::backward segment by segment between exits, adding the heads' errors where they attach */
+  void backward(const std::vector<S> &target, S weight = static_cast<S>(1)) {
+    const size_t numFrozen = this->getNumFrozen();
+    std::vector<S> delta = this->outputDelta(target, weight);
+    size_t last = this->_layers.size() - 1;
+    int e = static_cast<int>(_exits.size()) - 1;
+    while(e >= 0 && _exits[e].afterLayer >= numFrozen) {
+      const size_t afterLayer = _exits[e].afterLayer;
+      std::vector<S> propagated = this->_layers[afterLayer + 1]->backpropagate(this->backwardRange(delta, last, afterLayer + 1));
+      for(; e >= 0 && _exits[e].afterLayer == afterLayer; e--) {
+	std::vector<S> fromHead = backwardHead(*_exits[e].head, target, weight * _exits[e].weight, true);
+	if(!fromHead.empty()) vec(propagated) += vec(fromHead);
+      }
+      delta = this->_layers[afterLayer]->calcDelta(propagated);
+      last = afterLayer;
+    }
+    this->backwardRange(delta, last, 0);
+    /* heads on frozen layers still train, but their error goes no further */
+    for(; e >= 0; e--) {
+      backwardHead(*_exits[e].head, target, weight * _exits[e].weight, false);
+    }
+  }
+
+  /* joint loss; the final output's loss alone is Network<S>::calcLoss */
+  S calcLoss(const std::vector<S> &target) {
+    S loss = Network<S>::calcLoss(target);
+    for(const Exit &exit : _exits) {
+      loss += exit.weight * exit.head->calcLoss(target);
+    }
+    return loss;
+  }
+
+  void updateParam(S learningRate = static_cast<S>(0.1)) {
+    Network<S>::updateParam(learningRate);
+    for(const Exit &exit : _exits) {
+      exit.head->updateParam(learningRate);
+    }
+  }
+};
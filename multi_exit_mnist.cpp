@@ -0,0 +1,59 @@
+#include <utility>
+#include <iostream>
+#include <iomanip>
+#include <random>
+
+#include "trainer.cpp"
+#include "quantize.cpp"
+#include "multi_exit.cpp"
+
+std::shared_ptr<Network<float>> makeHead(int inSize) {
+  auto head = std::make_shared<Network<float> >();
+  head->addLayer(inSize, 10, Layer<float>::ActivationType::SOFTMAX);
+  return head;
+}
+
+/* the default positive initialization does not train deeper ReLU stacks; use symmetric He-uniform weights and zero biases */
+void initHeUniform(Network<float> &net) {
+  std::mt19937 mt(1);
+  for(int l = 0; l < net.getNumLayers(); l++) {
+    std::shared_ptr<Layer<float>> layer = std::dynamic_pointer_cast<Layer<float>>(net.getLayer(l));
+    const float bound = std::sqrt(6.0f / (layer->_inSize - 1));
+    std::uniform_real_distribution<float> dist(-bound, bound);
+    for(int i = 0; i < layer->_inSize; i++) {
+      for(float &w : layer->_w[i]) w = i < layer->_inSize - 1 ? dist(mt) : 0;
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  int numEpochs = argc > 1 ? std::atoi(argv[1]) : 5;
+
+  MNistDataSet trainSet("mnist/train-images-idx3-ubyte", "mnist/train-labels-idx1-ubyte");
+  MNistDataSet testSet("mnist/t10k-images-idx3-ubyte", "mnist/t10k-labels-idx1-ubyte");
+
+  MultiExitNetwork<float> net;
+  net.addLayer(trainSet.getNumRows() * trainSet.getNumColumns(), 300, Layer<float>::ActivationType::RELU);
+  net.addLayer(300, 300, Layer<float>::ActivationType::RELU);
+  net.addLayer(300, 100, Layer<float>::ActivationType::RELU);
+  net.addLayer(100, 10, Layer<float>::ActivationType::SOFTMAX);
+  initHeUniform(net);
+  auto head0 = makeHead(300), head1 = makeHead(300);
+  initHeUniform(*head0);
+  initHeUniform(*head1);
+  net.addExit(0, head0);
+  net.addExit(1, head1);
+  for(int epoch = 0; epoch < numEpochs; epoch++) {
+    auto result = runEpoch(net, trainSet, true, 0.1);
+    std::cout << std::endl << "epoch " << epoch << ": joint loss " << result.first << ", train error " << result.second << std::endl;
+  }
+
+  std::cout << "no early exit: test error " << calcErrorRate(net, testSet, testSet.getNumImages()) << std::endl;
+  for(float threshold : {0.5f, 0.7f, 0.9f, 0.95f, 0.99f, 0.999f}) {
+    net.setExitThreshold(threshold);
+    net.resetStats();
+    double error = calcErrorRate(net, testSet, testSet.getNumImages());
+    std::cout << "threshold " << std::setprecision(3) << threshold << ": test error " << std::setprecision(4) << error << ", ";
+    net.getStats().report(std::cout, net.fullFlops());
+  }
+}
@@ -1,30 +1,30 @@
+#pragma once
+
 #include <vector>
 #include <random>
 #include <algorithm>
 #include <iostream>
 #include <complex>
+#include <memory>
+#include <numeric>
+
+#include "scheduler.cpp"
+#include "tensor_view.cpp"
 
 template <class S>
 class RandomGenerator {
-public:
-  RandomGenerator(S amplitude);
-  S rand();
-};
-
-template <>
-class RandomGenerator<double> {
   std::random_device rnd;
   std::mt19937 mt;
-  std::uniform_real_distribution<> dist;
+  std::uniform_real_distribution<S> dist;
 public:
-  RandomGenerator(double lb, double ub) :
+  RandomGenerator(S lb, S ub) :
     rnd(),
     mt(this->rnd()),
     dist(lb, ub)
   {
   }
 
-  double rand() {
+  S rand() {
     return dist(mt);
   }
 };
@@ -32,21 +32,39 @@ public:
 template <class S>
 class Activation {
 public:
-  virtual std::vector<S> activation(std::vector<S> input) = 0;
-  virtual std::vector<S> gradient(std::vector<S> input) = 0;
+  /* output may be input itself */
+  virtual void activation(TensorView<const S> input, TensorView<S> output) = 0;
+  virtual void gradient(TensorView<const S> input, TensorView<S> output) = 0;
+
+  /* delta = propagated * gradient(u); overridden with one fused loop */
+  virtual void multiplyGradient(TensorView<const S> u, TensorView<const S> propagated, TensorView<S> delta) {
+    std::vector<S> grad(u.size());
+    gradient(u, grad);
+    vec(delta) = vec(propagated) * vec(grad);
+  }
 };
 
 template <class S>
 class ReLuActivation : public Activation<S> {
 public:
-  std::vector<S> activation(std::vector<S> input) {
-    std::for_each(input.begin(), input.end(), [](S &x) {x = x > 0 ? x : 0;});
-    return input;
+  static S relu(S x) {
+    return x > 0 ? x : static_cast<S>(0);
   }
 
-  std::vector<S> gradient(std::vector<S> input) {
-    std::for_each(input.begin(), input.end(), [](S &x) {x = x > 0 ? 1 : 0;});
-    return input;
+  static S reluGradient(S x) {
+    return x > 0 ? static_cast<S>(1) : static_cast<S>(0);
+  }
+
+  void activation(TensorView<const S> input, TensorView<S> output) {
+    vec(output) = map(vec(input), [](S x) {return relu(x);});
+  }
+
+  void gradient(TensorView<const S> input, TensorView<S> output) {
+    vec(output) = map(vec(input), [](S x) {return reluGradient(x);});
+  }
+
+  void multiplyGradient(TensorView<const S> u, TensorView<const S> propagated, TensorView<S> delta) {
+    vec(delta) = vec(propagated) * map(vec(u), [](S x) {return reluGradient(x);});
   }
 };
 
@@ -54,17 +72,24 @@ template <class S>
 class SigmoidActivation : public Activation<S> {
 public:
   static S sigmoid(S x) {
-    return static_cast<S>(1.0) / (static_cast<S>(1.0) + std::exp(x));
+    using std::exp;
+    return static_cast<S>(1.0) / (static_cast<S>(1.0) + exp(x));
   }
 
-  std::vector<S> activation(std::vector<S> input) {
-    std::for_each(input.begin(), input.end(), [](S &x) {x = sigmoid(x);});
-    return input;
+  static S sigmoidGradient(S x) {
+    return sigmoid(x) / (static_cast<S>(1.0) - sigmoid(x));
   }
 
-  std::vector<S> gradient(std::vector<S> input) {
-    std::for_each(input.begin(), input.end(), [](S &x) {x = sigmoid(x) / (static_cast<S>(1.0) - sigmoid(x));});
-    return input;
+  void activation(TensorView<const S> input, TensorView<S> output) {
+    vec(output) = map(vec(input), [](S x) {return sigmoid(x);});
+  }
+
+  void gradient(TensorView<const S> input, TensorView<S> output) {
+    vec(output) = map(vec(input), [](S x) {return sigmoidGradient(x);});
+  }
+
+  void multiplyGradient(TensorView<const S> u, TensorView<const S> propagated, TensorView<S> delta) {
+    vec(delta) = vec(propagated) * map(vec(u), [](S x) {return sigmoidGradient(x);});
   }
 };
 
@@ -72,7 +97,8 @@ template <class S>
 class SwishActivation : public Activation<S> {
 public:
   static S sigmoid(S x) {
-    return static_cast<S>(1.0) / (static_cast<S>(1.0) + std::exp(x));
+    using std::exp;
+    return static_cast<S>(1.0) / (static_cast<S>(1.0) + exp(x));
   }
 
   static S swish (S x) {
@@ -82,67 +108,124 @@ public:
     return swish(x) + sigmoid(x) * (1 - swish(x));
   }
 
-  std::vector<S> activation(std::vector<S> input) {
-    std::for_each(input.begin(), input.end(), [](S &x) {x = swish(x);});
-    return input;
+  void activation(TensorView<const S> input, TensorView<S> output) {
+    vec(output) = map(vec(input), [](S x) {return swish(x);});
   }
 
-  std::vector<S> gradient(std::vector<S> input) {
-    std::for_each(input.begin(), input.end(), [](S &x) {x = swishGradient(x);});
-    return input;
+  void gradient(TensorView<const S> input, TensorView<S> output) {
+    vec(output) = map(vec(input), [](S x) {return swishGradient(x);});
+  }
+
+  void multiplyGradient(TensorView<const S> u, TensorView<const S> propagated, TensorView<S> delta) {
+    vec(delta) = vec(propagated) * map(vec(u), [](S x) {return swishGradient(x);});
+  }
+};
+
+/* binarizes to +1/-1; the gradient is the straight-through estimator clipped to |x| <= 1 */
+template <class S>
+class SignActivation : public Activation<S> {
+public:
+  static S sign(S x) {
+    return x >= 0 ? static_cast<S>(1) : static_cast<S>(-1);
+  }
+
+  static S signGradient(S x) {
+    return (x >= -1 && x <= 1) ? static_cast<S>(1) : static_cast<S>(0);
+  }
+
+  void activation(TensorView<const S> input, TensorView<S> output) {
+    vec(output) = map(vec(input), [](S x) {return sign(x);});
+  }
+
+  void gradient(TensorView<const S> input, TensorView<S> output) {
+    vec(output) = map(vec(input), [](S x) {return signGradient(x);});
+  }
+
+  void multiplyGradient(TensorView<const S> u, TensorView<const S> propagated, TensorView<S> delta) {
+    vec(delta) = vec(propagated) * map(vec(u), [](S x) {return signGradient(x);});
   }
 };
 
 template <class S>
 class SoftmaxActivation : public Activation <S>{
 public:
-  std::vector<S> activation(std::vector<S> input) {
-    std::for_each(input.begin(), input.end(), [](S &x) {x = std::exp(x);});
-    S sum = std::accumulate(input.begin(), input.end(), static_cast<S>(0));
-    std::for_each(input.begin(), input.end(), [sum](S &x) {x /= sum;});
-    return input;
+  void activation(TensorView<const S> input, TensorView<S> output) {
+    using std::exp;
+    S max = *std::max_element(input.begin(), input.end());
+    vec(output) = map(vec(input) - max, [](S x) {return exp(x);});
+    S sum = std::accumulate(output.begin(), output.end(), static_cast<S>(0));
+    vec(output) = vec(output) / sum;
   }
 
-  std::vector<S> gradient(std::vector<S> input) {
-    return input; // dummy
+  void gradient(TensorView<const S> input, TensorView<S> output) {
+    std::copy(input.begin(), input.end(), output.begin()); // dummy
   }
 };
 
+/* bytes held by each subsystem, see memory_stats.cpp */
+struct MemoryStats {
+  size_t weights;
+  size_t gradients;
+  size_t optimizerState;
+  size_t activations;
+  size_t dataset;
+  size_t caches;
+
+  MemoryStats() :
+    weights(0),
+    gradients(0),
+    optimizerState(0),
+    activations(0),
+    dataset(0),
+    caches(0)
+  {
+  }
+
+  size_t total() const {
+    return weights + gradients + optimizerState + activations + dataset + caches;
+  }
+};
+
+template <class T>
+size_t vectorBytes(const std::vector<T> &v) {
+  return v.capacity() * sizeof(T);
+}
+
+template <class T>
+size_t vectorBytes(const std::vector<std::vector<T> > &v) {
+  size_t bytes = v.capacity() * sizeof(std::vector<T>);
+  for(const auto &row : v) bytes += vectorBytes(row);
+  return bytes;
+}
+
 template <class S>
-struct Layer {
+struct LayerBase {
   size_t _inSize, _outSize;
   size_t _sampleCount;
-  std::vector<std::vector<S> > _w, _w_grad;
-  std::vector<S> _input; /* size: inSize */
+  std::vector<S> _input; /* bias-appended copy of the input, size: inSize; Layer keeps a view instead */
   std::vector<S> _u; /* size: outSize */
   std::vector<S> _output; /* size: outSize */
   std::shared_ptr<Activation<S>> _activation;
+  bool _frozen; /* no gradients or parameter updates */
 public:
   enum class ActivationType {
     RELU,
     SIGMOID,
     SWISH,
-    SOFTMAX
+    SOFTMAX,
+    SIGN
   };
+  ActivationType _activationType;
 
-  Layer(size_t inSize, size_t outSize, ActivationType activationType) :
+  LayerBase(size_t inSize, size_t outSize, ActivationType activationType) :
     _inSize(inSize + 1),
     _outSize(outSize),
-    _input(_inSize, 0),
     _u(_outSize, 0),
     _sampleCount(0),
-    _output(_outSize, 0)
+    _output(_outSize, 0),
+    _frozen(false),
+    _activationType(activationType)
   {
-    RandomGenerator<S> rg(0.0, 1.0);
-    for(int i = 0; i < this->_inSize; i++) {
-      std::vector<S> row(_outSize);
-      for(int j = 0; j < this->_outSize; j++) {
-	row[j] = rg.rand() / this->_inSize;
-      }
-      _w.push_back(row);
-      _w_grad.push_back(std::vector<S>(_outSize, 0));
-    }
-
     switch(activationType) {
     case ActivationType::RELU:
       _activation = std::make_shared<ReLuActivation<S> >();
@@ -156,114 +239,370 @@ public:
     case ActivationType::SOFTMAX:
       _activation = std::make_shared<SoftmaxActivation<S> >();
       break;
+    case ActivationType::SIGN:
+      _activation = std::make_shared<SignActivation<S> >();
+      break;
     }
   }
 
-  std::vector<S> forward(const std::vector<S> &input) {
-    _input = input;
-    _input.push_back(static_cast<S>(1));
-    std::fill(_u.begin(), _u.end(), 0);
+  virtual ~LayerBase() {}
+
+  /* the returned view is this layer's output buffer, valid until the next forward */
+  virtual TensorView<const S> forward(TensorView<const S> input) = 0;
+
+  /* raw byte input, each element multiplied by scale */
+  virtual TensorView<const S> forward(TensorView<const uint8_t> input, S scale) {
+    std::vector<S> converted(input.size());
+    for(size_t i = 0; i < input.size(); i++) {
+      converted[i] = static_cast<S>(input[i]) * scale;
+    }
+    return forward(converted);
+  }
+
+  /* error w.r.t. this layer's input (bias excluded), size: inSize - 1 */
+  virtual std::vector<S> backpropagate(const std::vector<S> &delta) = 0;
+
+  virtual void updateGrad(const std::vector<S> &delta) = 0;
+
+  virtual void updateParam(S learningRate) = 0;
+
+  /* independent copy for use on another thread, nullptr if the layer type cannot be copied */
+  virtual std::shared_ptr<LayerBase<S>> clone() const {
+    return nullptr;
+  }
+
+  /* whether clone returns a copy, without making one */
+  virtual bool canClone() const {
+    return false;
+  }
+
+  /* adds this layer's buffers to stats; the base counts the per-sample vectors as activations */
+  virtual void addMemory(MemoryStats &stats) const {
+    stats.activations += vectorBytes(_input) + vectorBytes(_u) + vectorBytes(_output);
+  }
+
+  std::vector<S> calcDelta(const std::vector<S> &propagated) {
+    std::vector<S> delta(this->_outSize);
+    _activation->multiplyGradient(_u, propagated, delta);
+    return delta;
+  }
+};
+
+template <class S>
+struct Layer : public LayerBase<S> {
+  std::vector<std::vector<S> > _w, _w_grad;
+  bool _byteInput;
+  /* views of the last input, size: inSize - 1; the caller keeps them valid until updateGrad */
+  TensorView<const S> _inputView; /* valid unless _byteInput */
+  TensorView<const uint8_t> _inputBytes; /* valid if _byteInput */
+  S _inputScale;
+public:
+  using typename LayerBase<S>::ActivationType;
+
+  /*
+   * Kernels are split into tasks of this many output columns (forward) or
+   * input rows (the rest) on the default scheduler. Each output element is
+   * accumulated in the same order as sequentially, so results do not depend
+   * on the number of workers.
+   */
+  static const size_t taskGrain = 64;
+
+  Layer(size_t inSize, size_t outSize, ActivationType activationType) :
+    LayerBase<S>(inSize, outSize, activationType),
+    _byteInput(false),
+    _inputScale(1)
+  {
+    RandomGenerator<S> rg(0.0, 1.0);
     for(int i = 0; i < this->_inSize; i++) {
+      std::vector<S> row(this->_outSize);
       for(int j = 0; j < this->_outSize; j++) {
-	_u[j] += _input[i] * _w[i][j];
+	row[j] = rg.rand() / this->_inSize;
       }
+      _w.push_back(row);
+      _w_grad.push_back(std::vector<S>(this->_outSize, 0));
     }
-    _output = _activation->activation(_u);
-    return _output;
   }
 
-  std::vector<S> calcDelta(const std::vector<S> &nextDelta, const std::vector<std::vector<S> > &nextW) {
-    std::vector<S> delta(this->_outSize, 0);
-    std::vector<S> grad = _activation->gradient(_u);
-    for(int j = 0; j < this->_outSize; j++) {
-      for(int k = 0; k < nextW[j].size(); k++) {
-	delta[j] += nextDelta[k] * nextW[j][k] * grad[j];
+  /* with given weights instead of random ones: inSize + 1 rows of outSize, bias row last */
+  Layer(std::vector<std::vector<S> > w, ActivationType activationType) :
+    LayerBase<S>(w.size() - 1, w[0].size(), activationType),
+    _w(std::move(w)),
+    _w_grad(_w.size(), std::vector<S>(_w[0].size(), 0)),
+    _byteInput(false),
+    _inputScale(1)
+  {
+  }
+
+  TensorView<const S> forward(TensorView<const S> input) {
+    _byteInput = false;
+    _inputView = input;
+    std::fill(this->_u.begin(), this->_u.end(), 0);
+    defaultScheduler().parallelFor(0, this->_outSize, taskGrain, [this](size_t j0, size_t j1) {
+      S *u = this->_u.data();
+      for(int i = 0; i < this->_inSize - 1; i++) {
+	vec(u + j0, j1 - j0) += _inputView[i] * vec(_w[i].data() + j0, j1 - j0);
       }
-    }
-    return delta;
+      vec(u + j0, j1 - j0) += vec(_w[this->_inSize - 1].data() + j0, j1 - j0);
+    });
+    this->_activation->activation(this->_u, this->_output);
+    return this->_output;
   }
 
-  void updateGrad(const std::vector<S> &delta) {
-    for(int i = 0; i < this->_inSize; i++) {
-      for(int j = 0; j < this->_outSize; j++) {
-	_w_grad[i][j] += _input[i] * delta[j];
+  /* accumulates the unscaled bytes (zero pixels skipped) and applies scale and bias in the epilogue */
+  TensorView<const S> forward(TensorView<const uint8_t> input, S scale) {
+    _byteInput = true;
+    _inputBytes = input;
+    _inputScale = scale;
+    std::fill(this->_u.begin(), this->_u.end(), 0);
+    defaultScheduler().parallelFor(0, this->_outSize, taskGrain, [this](size_t j0, size_t j1) {
+      S *u = this->_u.data();
+      for(int i = 0; i < this->_inSize - 1; i++) {
+	const uint8_t x = _inputBytes[i];
+	if(x == 0) continue;
+	const S xs = static_cast<S>(x);
+	vec(u + j0, j1 - j0) += xs * vec(_w[i].data() + j0, j1 - j0);
       }
+    });
+    vec(this->_u) = vec(this->_u) * scale + vec(_w[this->_inSize - 1]);
+    this->_activation->activation(this->_u, this->_output);
+    return this->_output;
+  }
+
+  std::vector<S> backpropagate(const std::vector<S> &delta) {
+    std::vector<S> propagated(this->_inSize - 1, 0);
+    defaultScheduler().parallelFor(0, this->_inSize - 1, taskGrain, [&](size_t i0, size_t i1) {
+      for(size_t i = i0; i < i1; i++) {
+	for(int j = 0; j < this->_outSize; j++) {
+	  propagated[i] += delta[j] * _w[i][j];
+	}
+      }
+    });
+    return propagated;
+  }
+
+  void updateGrad(const std::vector<S> &delta) {
+    if(_byteInput) {
+      updateGradBytes(delta);
+      return;
     }
-    _sampleCount++;
+    defaultScheduler().parallelFor(0, this->_inSize - 1, taskGrain, [&](size_t i0, size_t i1) {
+      for(size_t i = i0; i < i1; i++) {
+	const S x = _inputView[i];
+	if(x == 0) continue;
+	vec(_w_grad[i]) += x * vec(delta);
+      }
+    });
+    vec(_w_grad[this->_inSize - 1]) += vec(delta);
+    this->_sampleCount++;
+  }
+
+  void updateGradBytes(const std::vector<S> &delta) {
+    defaultScheduler().parallelFor(0, this->_inSize - 1, taskGrain, [&](size_t i0, size_t i1) {
+      for(size_t i = i0; i < i1; i++) {
+	const uint8_t x = _inputBytes[i];
+	if(x == 0) continue;
+	const S xs = static_cast<S>(x) * _inputScale;
+	vec(_w_grad[i]) += xs * vec(delta);
+      }
+    });
+    vec(_w_grad[this->_inSize - 1]) += vec(delta);
+    this->_sampleCount++;
   }
 
   void updateParam(S learningRate) {
-    if(_sampleCount == 0) return;
-    for(int i = 0; i < this->_inSize; i++) {
-      for(int j = 0; j < this->_outSize; j++) {
-	_w[i][j] -= _w_grad[i][j] * learningRate / _sampleCount;
-	_w_grad[i][j] = 0;
+    if(this->_sampleCount == 0) return;
+    const S rate = learningRate / static_cast<S>(this->_sampleCount);
+    defaultScheduler().parallelFor(0, this->_inSize, taskGrain, [&](size_t i0, size_t i1) {
+      for(size_t i = i0; i < i1; i++) {
+	vec(_w[i]) -= rate * vec(_w_grad[i]);
+	vec(_w_grad[i]) = static_cast<S>(0);
       }
-    }
-    _sampleCount = 0;
+    });
+    this->_sampleCount = 0;
+  }
+
+  std::shared_ptr<LayerBase<S>> clone() const {
+    return std::make_shared<Layer<S> >(*this);
+  }
+
+  bool canClone() const {
+    return true;
+  }
+
+  void addMemory(MemoryStats &stats) const {
+    LayerBase<S>::addMemory(stats);
+    stats.weights += vectorBytes(_w);
+    stats.gradients += vectorBytes(_w_grad);
+  }
+
+  /* weights and gradients of a dense layer before it is allocated */
+  static size_t estimateBytes(size_t inSize, size_t outSize) {
+    return 2 * ((inSize + 1) * (sizeof(std::vector<S>) + outSize * sizeof(S)));
   }
 };
 
 template<class S>
 class Network {
+protected:
   bool _verbose;
-  std::vector<Layer<S>> _layers;
+  std::vector<std::shared_ptr<LayerBase<S>>> _layers;
 public:
   Network(bool verbose = false) :
     _verbose(verbose)
   {
   }
 
+  virtual ~Network() {}
+
   void addLayer(int inSize, int outSize, typename Layer<S>::ActivationType activationType) {
-    Layer<S> layer(inSize, outSize, activationType);
+    _layers.push_back(std::make_shared<Layer<S> >(inSize, outSize, activationType));
+  }
+
+  void addLayer(std::shared_ptr<LayerBase<S>> layer) {
     _layers.push_back(layer);
   }
 
-  std::vector<S> forward(const std::vector<S> &input) {
-    std::vector<S> buffer = input;
+  size_t getNumLayers() const {
+    return _layers.size();
+  }
+
+  std::shared_ptr<LayerBase<S>> getLayer(size_t l) const {
+    return _layers[l];
+  }
+
+  void setLayer(size_t l, std::shared_ptr<LayerBase<S>> layer) {
+    _layers[l] = layer;
+  }
+
+  /* deep copy of the layers, nullptr if one of them cannot be cloned; subclasses with state of their own override it */
+  virtual std::shared_ptr<Network<S>> clone() const {
+    auto copy = std::make_shared<Network<S> >();
+    if(!cloneLayersTo(*copy)) return nullptr;
+    return copy;
+  }
+
+  virtual bool canClone() const {
+    return std::all_of(_layers.begin(), _layers.end(), [](const std::shared_ptr<LayerBase<S>> &layer) {return layer->canClone();});
+  }
+
+  /* appends copies of the layers to copy, false if one of them cannot be cloned */
+  bool cloneLayersTo(Network<S> &copy) const {
+    copy._verbose = _verbose;
     for(auto &layer : _layers) {
-      std::vector<S> output = layer.forward(buffer);
-      buffer = output;
+      std::shared_ptr<LayerBase<S>> cloned = layer->clone();
+      if(!cloned) return false;
+      copy.addLayer(cloned);
     }
-    return buffer;
+    return true;
   }
 
-  void backward(const std::vector<S> &target) {
-    Layer<S> &lastLayer = _layers[_layers.size() - 1];
-    const std::vector<S> &y = lastLayer._output;
-    std::vector<S> delta(target.size());
-    for(int i = 0; i < y.size(); i++) {
-      delta[i] = y[i] - target[i];
+  void addMemory(MemoryStats &stats) const {
+    for(auto &layer : _layers) {
+      layer->addMemory(stats);
+    }
+  }
+
+  /* freezes layers [0, numLayers) and unfreezes the rest */
+  void freeze(size_t numLayers) {
+    for(size_t l = 0; l < _layers.size(); l++) {
+      _layers[l]->_frozen = l < numLayers;
     }
+  }
+
+  /* number of leading frozen layers, which backward does not reach */
+  size_t getNumFrozen() const {
+    size_t l = 0;
+    while(l < _layers.size() && _layers[l]->_frozen) l++;
+    return l;
+  }
+
+  /*
+   * The returned view is the output buffer of the last layer run, valid
+   * until the next forward. Layers keep views of their inputs for backward,
+   * so input must stay valid until then; dataset images do.
+   */
+  virtual TensorView<const S> forward(TensorView<const uint8_t> input, S scale) {
+    return forward(input, scale, _layers.size());
+  }
+
+  /* runs layers [0, end) on raw bytes */
+  TensorView<const S> forward(TensorView<const uint8_t> input, S scale, size_t end) {
+    return forward(_layers[0]->forward(input, scale), 1, end);
+  }
+
+  virtual TensorView<const S> forward(TensorView<const S> input) {
+    return forward(input, 0, _layers.size());
+  }
+
+  /* runs layers [begin, end), each reading the previous one's output buffer in place */
+  TensorView<const S> forward(TensorView<const S> input, size_t begin, size_t end) {
+    for(size_t l = begin; l < end; l++) {
+      input = _layers[l]->forward(input);
+    }
+    return input;
+  }
+
+  /* weight scales this sample's gradient, e.g. for importance sampling */
+  virtual void backward(const std::vector<S> &target, S weight = static_cast<S>(1)) {
+    backwardFrom(target, weight, 0);
+  }
+
+  /*
+   * backward through layers [first, end) only, for a caller that runs the
+   * layers before first itself (e.g. ModelBundle). Returns the error w.r.t.
+   * the output of layer first - 1, or nothing if first is 0 or layer
+   * first - 1 is frozen.
+   */
+  std::vector<S> backwardFrom(const std::vector<S> &target, S weight, size_t first) {
+    std::vector<S> delta = backwardRange(outputDelta(target, weight), _layers.size() - 1, first);
+    if(first == 0 || _layers[first - 1]->_frozen) return {};
+    return _layers[first]->backpropagate(delta);
+  }
+
+  /* weighted error of the last layer's output w.r.t. target */
+  std::vector<S> outputDelta(const std::vector<S> &target, S weight) const {
+    std::vector<S> delta(target.size());
+    vec(delta) = weight * (vec(_layers[_layers.size() - 1]->_output) - vec(target));
+    return delta;
+  }
+
+  /*
+   * backward from delta, the error of layer last, through the unfrozen
+   * layers of [first, last], for a caller that adds errors of its own between
+   * layers (e.g. MultiExitNetwork). Returns the delta of the lowest layer
+   * reached.
+   */
+  std::vector<S> backwardRange(std::vector<S> delta, size_t last, size_t first) {
     if(_verbose) {
-      std::cout << "delta of layer " << _layers.size() - 1 << ": ";
+      std::cout << "delta of layer " << last << ": ";
       std::for_each(delta.begin(), delta.end(), [](const auto &x) {std::cout << " " << x;});
       std::cout << std::endl;
     }
-    lastLayer.updateGrad(delta);
-    for(int l = _layers.size() - 2; l >= 0; l--) {
-      delta = _layers[l].calcDelta(delta, _layers[l+1]._w);
-      _layers[l].updateGrad(delta);
+    if(!_layers[last]->_frozen) _layers[last]->updateGrad(delta);
+    for(int l = static_cast<int>(last) - 1; l >= static_cast<int>(std::max(first, getNumFrozen())); l--) {
+      delta = _layers[l]->calcDelta(_layers[l+1]->backpropagate(delta));
+      if(!_layers[l]->_frozen) _layers[l]->updateGrad(delta);
       if(_verbose) {
 	std::cout << "delta of layer " << l << ": ";
 	std::for_each(delta.begin(), delta.end(), [](const auto &x) {std::cout << " " << x;});
 	std::cout << std::endl;
       }
     }
+    return delta;
   }
   
-  S calcLoss(const std::vector<S> &target) {
+  virtual S calcLoss(const std::vector<S> &target) {
+    using std::log;
     S loss = 0;
     for(int i = 0; i < target.size(); i++) {
-      loss -= target[i] * std::log(_layers[_layers.size() - 1]._output[i]);
+      loss -= target[i] * log(_layers[_layers.size() - 1]->_output[i]);
     }
     return loss;
   }
 
-  void updateParam(S learningRate = static_cast<S>(0.1)) {
+  virtual void updateParam(S learningRate = static_cast<S>(0.1)) {
     for(auto & layer : _layers) {
-      layer.updateParam(learningRate);
+      if(!layer->_frozen) layer->updateParam(learningRate);
     }
   }
 };
-
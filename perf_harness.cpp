@@ -0,0 +1,226 @@
+#include <utility>
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <string>
+#include <cstring>
+#include <thread>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "trainer.cpp"
+#include "fixed_point.cpp"
+#include "synthetic_mnist.cpp"
+#include "json.cpp"
+
+/*
+ * Time-to-accuracy regression harness. Runs a fixed set of training
+ * configurations, each in its own process so that peak RSS is per
+ * configuration, and compares samples/sec, epochs and seconds to the target
+ * test error and peak RSS with a stored JSON baseline within the tolerances
+ * kept in the same file. Exits with 1 on a regression.
+ *
+ * The engine has one optimizer (plain SGD), so every configuration records
+ * optimizer "sgd". numThreads sizes the child's default scheduler, which
+ * runs the layer kernels: numThreads - 1 workers and the training thread.
+ * Configurations with more threads than the machine has cores are skipped,
+ * both when recording and when comparing, as their timings would only
+ * measure oversubscription.
+ */
+struct PerfConfig {
+  std::string name;
+  std::string type; /* float, double or fixed16 */
+  std::vector<int> hiddenSizes;
+  int batchSize;
+  double learningRate;
+  std::string optimizer;
+  int numThreads;
+};
+
+struct PerfResult {
+  double samplesPerSec;
+  double epochsToTarget; /* maxEpochs + 1 if not reached */
+  double secondsToTarget; /* total training time if not reached */
+  double peakRssKb;
+};
+
+const double targetError = 0.05;
+const int maxEpochs = 10;
+
+std::vector<PerfConfig> perfConfigs() {
+  return {
+    {"float_300_b100", "float", {300}, 100, 0.2, "sgd", 1},
+    {"float_300_b20", "float", {300}, 20, 0.1, "sgd", 1},
+    {"float_1000_b100", "float", {1000}, 100, 0.2, "sgd", 1},
+    {"float_1000_b100_t4", "float", {1000}, 100, 0.2, "sgd", 4},
+    {"double_300_b100", "double", {300}, 100, 0.2, "sgd", 1},
+    {"fixed16_300_b100", "fixed16", {300}, 100, 0.2, "sgd", 1},
+  };
+}
+
+template <class S>
+PerfResult runConfig(const PerfConfig &config, MNistDataSet &trainSet, MNistDataSet &testSet) {
+  Network<S> net;
+  int inSize = trainSet.getNumRows() * trainSet.getNumColumns();
+  for(int hiddenSize : config.hiddenSizes) {
+    net.addLayer(inSize, hiddenSize, Layer<S>::ActivationType::RELU);
+    inSize = hiddenSize;
+  }
+  net.addLayer(inSize, 10, Layer<S>::ActivationType::SOFTMAX);
+  PerfResult result = {0, maxEpochs + 1.0, 0, 0};
+  double seconds = 0;
+  int epoch;
+  for(epoch = 0; epoch < maxEpochs; epoch++) {
+    auto start = std::chrono::steady_clock::now();
+    runEpoch(net, trainSet, true, config.learningRate, config.batchSize);
+    seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if(runEpoch(net, testSet, false).second <= targetError) {
+      result.epochsToTarget = epoch + 1;
+      epoch++;
+      break;
+    }
+  }
+  result.samplesPerSec = static_cast<double>(trainSet.getNumImages()) * epoch / seconds;
+  result.secondsToTarget = seconds;
+  result.peakRssKb = readProcStatusKb("VmHWM");
+  return result;
+}
+
+/* runs the configuration in a child process and receives the result through a pipe */
+bool runIsolated(const PerfConfig &config, MNistDataSet &trainSet, MNistDataSet &testSet, PerfResult &result) {
+  int fds[2];
+  if(pipe(fds) != 0) return false;
+  pid_t pid = fork();
+  if(pid == 0) {
+    close(fds[0]);
+    std::cout.setstate(std::ios::failbit); /* silence runEpoch's progress line */
+    defaultSchedulerPointer().release(); /* its worker threads were not forked */
+    resetDefaultScheduler(std::max(1, config.numThreads) - 1);
+    PerfResult r;
+    if(config.type == "double") {
+      r = runConfig<double>(config, trainSet, testSet);
+    }else if(config.type == "fixed16") {
+      r = runConfig<Fixed16>(config, trainSet, testSet);
+    }else {
+      r = runConfig<float>(config, trainSet, testSet);
+    }
+    ssize_t written = write(fds[1], &r, sizeof(r));
+    _exit(written == sizeof(r) ? 0 : 1);
+  }
+  close(fds[1]);
+  ssize_t got = pid > 0 ? read(fds[0], &result, sizeof(result)) : -1;
+  close(fds[0]);
+  int status = 0;
+  if(pid > 0) waitpid(pid, &status, 0);
+  return got == sizeof(result) && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+JsonValue toJson(const PerfConfig &config, const PerfResult &result) {
+  JsonValue value;
+  value["type"] = JsonValue(config.type);
+  value["batch_size"] = JsonValue(config.batchSize);
+  value["optimizer"] = JsonValue(config.optimizer);
+  value["threads"] = JsonValue(config.numThreads);
+  value["samples_per_sec"] = JsonValue(result.samplesPerSec);
+  value["epochs_to_target"] = JsonValue(result.epochsToTarget);
+  value["seconds_to_target"] = JsonValue(result.secondsToTarget);
+  value["peak_rss_kb"] = JsonValue(result.peakRssKb);
+  return value;
+}
+
+JsonValue defaultTolerances() {
+  JsonValue tolerances;
+  tolerances["samples_per_sec"] = JsonValue(0.15); /* relative */
+  tolerances["seconds_to_target"] = JsonValue(0.25); /* relative */
+  tolerances["epochs_to_target"] = JsonValue(1.0); /* absolute */
+  tolerances["peak_rss_kb"] = JsonValue(0.2); /* relative */
+  return tolerances;
+}
+
+/* prints one line per metric and returns false if any is outside its tolerance */
+bool compareWithBaseline(const std::string &name, const JsonValue &current, const JsonValue &baseline, const JsonValue &tolerances) {
+  bool ok = true;
+  auto check = [&](const std::string &metric, bool higherIsBetter, bool relative) {
+    const double now = current[metric]._number, base = baseline[metric]._number, tol = tolerances[metric]._number;
+    const double limit = relative ? (higherIsBetter ? base * (1 - tol) : base * (1 + tol)) : (higherIsBetter ? base - tol : base + tol);
+    const bool pass = higherIsBetter ? now >= limit : now <= limit;
+    std::cout << std::setw(20) << name << std::setw(20) << metric << std::setw(14) << base << std::setw(14) << now
+	      << (pass ? "   ok" : "   REGRESSION") << std::endl;
+    ok = ok && pass;
+  };
+  check("samples_per_sec", true, true);
+  check("epochs_to_target", false, false);
+  check("seconds_to_target", false, true);
+  check("peak_rss_kb", false, true);
+  return ok;
+}
+
+int main(int argc, char **argv) {
+  bool update = argc > 1 && std::string(argv[1]) == "--update";
+  std::string baselinePath = argc > 1 + update ? argv[1 + update] : "perf_baseline.json";
+  std::string mnistDirectory = argc > 2 + update ? argv[2 + update] : "";
+
+  std::string dataName = mnistDirectory.empty() ? "synthetic 6000/1000" : "mnist";
+  MNistDataSet trainSet = mnistDirectory.empty() ? makeSyntheticMNist(6000, 2)
+    : MNistDataSet(mnistDirectory + "/train-images-idx3-ubyte", mnistDirectory + "/train-labels-idx1-ubyte");
+  MNistDataSet testSet = mnistDirectory.empty() ? makeSyntheticMNist(1000, 3)
+    : MNistDataSet(mnistDirectory + "/t10k-images-idx3-ubyte", mnistDirectory + "/t10k-labels-idx1-ubyte");
+
+  JsonValue baseline;
+  std::ifstream ifs(baselinePath);
+  if(ifs) {
+    std::stringstream text;
+    text << ifs.rdbuf();
+    if(!JsonParser(text.str()).parse(baseline)) return 1;
+  }else if(!update) {
+    std::cerr << "no baseline " << baselinePath << ", run with --update to create it" << std::endl;
+    return 1;
+  }
+  if(!update && baseline.has("data") && baseline["data"]._string != dataName) {
+    std::cerr << "baseline was recorded on " << baseline["data"]._string << " data, not " << dataName << std::endl;
+    return 1;
+  }
+  if(!baseline.has("tolerances")) baseline["tolerances"] = defaultTolerances();
+  if(!baseline.has("configs")) baseline["configs"] = JsonValue();
+
+  std::cout << std::fixed << std::setprecision(1);
+  if(!update) {
+    std::cout << std::setw(20) << "config" << std::setw(20) << "metric" << std::setw(14) << "baseline" << std::setw(14) << "current" << std::endl;
+  }
+  bool ok = true;
+  const int numCores = std::max(1u, std::thread::hardware_concurrency());
+  for(const PerfConfig &config : perfConfigs()) {
+    if(config.numThreads > numCores) {
+      std::cout << std::setw(20) << config.name << ": skipped, needs " << config.numThreads << " threads, " << numCores << " cores" << std::endl;
+      continue;
+    }
+    PerfResult result;
+    if(!runIsolated(config, trainSet, testSet, result)) {
+      std::cerr << config.name << " failed" << std::endl;
+      ok = false;
+      continue;
+    }
+    JsonValue current = toJson(config, result);
+    if(update) {
+      baseline["configs"][config.name] = current;
+      std::cout << std::setw(20) << config.name << ": " << result.samplesPerSec << " samples/sec, "
+		<< result.epochsToTarget << " epochs, " << result.secondsToTarget << " sec, "
+		<< result.peakRssKb << " KB" << std::endl;
+    }else if(!baseline["configs"].has(config.name)) {
+      std::cout << std::setw(20) << config.name << ": not in baseline" << std::endl;
+    }else {
+      ok = compareWithBaseline(config.name, current, baseline["configs"][config.name], baseline["tolerances"]) && ok;
+    }
+  }
+  if(update) {
+    baseline["data"] = JsonValue(dataName);
+    baseline["target_error"] = JsonValue(targetError);
+    std::ofstream ofs(baselinePath);
+    baseline.write(ofs);
+    ofs << std::endl;
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,53 @@
+#include <utility>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+
+#include "coroutine_pipeline.cpp"
+#include "model_file.cpp"
+
+int main(int argc, char **argv) {
+  size_t depth = argc > 1 ? std::atoi(argv[1]) : 64;
+  int numWorkers = argc > 2 ? std::atoi(argv[2]) : std::max(1u, std::thread::hardware_concurrency()) - 1;
+  int numEpochs = argc > 3 ? std::atoi(argv[3]) : 3;
+
+  resetDefaultScheduler(numWorkers);
+  /* mapped, so the pipeline's load stage is the one reading the training images */
+  MNistDataSet trainSet("mnist/train-images-idx3-ubyte", "mnist/train-labels-idx1-ubyte", true);
+  MNistDataSet testSet("mnist/t10k-images-idx3-ubyte", "mnist/t10k-labels-idx1-ubyte");
+
+  Network<float> net;
+  net.addLayer(trainSet.getNumRows() * trainSet.getNumColumns(), 1000, Layer<float>::ActivationType::RELU);
+  net.addLayer(1000, 10, Layer<float>::ActivationType::SOFTMAX);
+  std::shared_ptr<Network<float>> reference = net.clone();
+
+  PipelineOptions<float> options;
+  options.depth = depth;
+  options.learningRate = 0.2;
+  options.checkpointInterval = 100;
+  options.checkpoint = [](int batchId, const Network<float> &snapshot) {
+    saveCompactModel(snapshot, "pipeline_checkpoint.bin");
+  };
+  for(int epoch = 0; epoch < numEpochs; epoch++) {
+    PipelineMetrics metrics;
+    auto start = std::chrono::steady_clock::now();
+    std::pair<double, double> train = runPipelinedEpoch(net, trainSet, options, metrics);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << std::endl << "epoch " << epoch << ": train loss " << train.first << ", train error " << train.second
+	      << ", test error " << evaluateErrorRate(net, testSet) << ", " << seconds << " sec" << std::endl;
+    metrics.report(std::cout);
+  }
+
+  /* the pipeline keeps runEpoch's sample order and update points */
+  for(int epoch = 0; epoch < numEpochs; epoch++) {
+    runEpoch(*reference, trainSet, true, 0.2);
+  }
+  float maxDiff = 0;
+  for(int l = 0; l < net.getNumLayers(); l++) {
+    auto a = std::dynamic_pointer_cast<Layer<float>>(net.getLayer(l)), b = std::dynamic_pointer_cast<Layer<float>>(reference->getLayer(l));
+    for(int i = 0; i < a->_inSize; i++) {
+      for(int j = 0; j < a->_outSize; j++) maxDiff = std::max(maxDiff, std::abs(a->_w[i][j] - b->_w[i][j]));
+    }
+  }
+  std::cout << std::endl << "max weight difference to runEpoch: " << maxDiff << std::endl;
+}
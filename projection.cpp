@@ -0,0 +1,342 @@
+#pragma once
+
+#include <vector>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <cmath>
+#include <numeric>
+#include <algorithm>
+
+#include "trainer.cpp"
+
+struct PcaOptions {
+  size_t maxSamples = 0; /* images the covariance is computed from, 0: all */
+  size_t oversampling = 10; /* extra vectors in the subspace iteration, which speed up convergence */
+  int iterations = 30;
+  uint32_t seed = 1;
+};
+
+/*
+ * Affine map from scaled image pixels to dim features, stored like a
+ * dense Layer's weights: row i (< inSize) is added x_i * scale times, the
+ * last row is the bias. fitPca uses the leading principal components
+ * (the bias centers the data), fitSparseRandom a very sparse random
+ * projection. A network trained on the projected features can be fused
+ * with the projection into one that reads raw images again.
+ */
+template <class S>
+class Projection {
+  size_t _inSize, _dim;
+  S _inputScale;
+  std::vector<std::vector<S> > _w; /* size: (inSize + 1) x dim */
+  double _explainedVariance; /* by the PCA components, 0 for random projections */
+
+public:
+  Projection() :
+    _inSize(0),
+    _dim(0),
+    _inputScale(1),
+    _explainedVariance(0)
+  {
+  }
+
+  size_t getInSize() const {
+    return _inSize;
+  }
+
+  size_t getDim() const {
+    return _dim;
+  }
+
+  S getInputScale() const {
+    return _inputScale;
+  }
+
+  /* fraction of the total variance kept, 0 unless fitted by PCA */
+  double getExplainedVariance() const {
+    return _explainedVariance;
+  }
+
+  /*
+   * PCA of set's images scaled by scale. The covariance is accumulated
+   * row-parallel on the default scheduler, skipping zero pixels; the
+   * leading eigenvectors come from a subspace iteration with a Jacobi
+   * eigen-solver for the small Rayleigh-Ritz problem.
+   */
+  bool fitPca(MNistDataSet &set, size_t dim, S scale, const PcaOptions &options = PcaOptions()) {
+    const size_t n = set.getNumRows() * set.getNumColumns();
+    const size_t m = std::min(n, dim + options.oversampling);
+    if(dim == 0 || dim > n) {
+      std::cerr << "Projection: cannot take " << dim << " components of " << n << " inputs" << std::endl;
+      return false;
+    }
+    const size_t numSamples = options.maxSamples > 0 ? std::min<size_t>(options.maxSamples, set.getNumImages()) : set.getNumImages();
+    TensorView<const uint8_t> images = set.getImages().slice(0, 0, numSamples);
+
+    /* covariance of the raw bytes, E[x x^T] - E[x] E[x]^T; the upper triangle, then mirrored */
+    std::vector<double> mean(n, 0), covariance(n * n, 0);
+    for(size_t s = 0; s < numSamples; s++) {
+      TensorView<const uint8_t> image = images.select(0, s);
+      for(size_t i = 0; i < n; i++) mean[i] += image[i];
+    }
+    for(double &x : mean) x /= numSamples;
+    defaultScheduler().parallelFor(0, n, 16, [&](size_t i0, size_t i1) {
+      for(size_t s = 0; s < numSamples; s++) {
+	const uint8_t *x = images.select(0, s).data();
+	for(size_t i = i0; i < i1; i++) {
+	  if(x[i] == 0) continue;
+	  double *row = covariance.data() + i * n;
+	  const double xi = x[i];
+	  for(size_t j = i; j < n; j++) row[j] += xi * x[j];
+	}
+      }
+      for(size_t i = i0; i < i1; i++) {
+	for(size_t j = i; j < n; j++) covariance[i * n + j] = covariance[i * n + j] / numSamples - mean[i] * mean[j];
+      }
+    });
+    for(size_t i = 0; i < n; i++) {
+      for(size_t j = 0; j < i; j++) covariance[i * n + j] = covariance[j * n + i];
+    }
+
+    /* subspace iteration: q <- orthonormalized C q, from random vectors */
+    std::mt19937 mt(options.seed);
+    std::normal_distribution<double> normal(0, 1);
+    std::vector<std::vector<double> > q(m, std::vector<double>(n));
+    for(auto &v : q) {
+      for(double &x : v) x = normal(mt);
+    }
+    orthonormalize(q);
+    for(int iteration = 0; iteration < options.iterations; iteration++) {
+      q = multiply(covariance, q);
+      orthonormalize(q);
+    }
+
+    /* Rayleigh-Ritz: eigenvectors of q^T C q rotate q into the components */
+    std::vector<std::vector<double> > cq = multiply(covariance, q);
+    std::vector<double> t(m * m), vectors;
+    for(size_t a = 0; a < m; a++) {
+      for(size_t b = 0; b < m; b++) t[a * m + b] = std::inner_product(q[a].begin(), q[a].end(), cq[b].begin(), 0.0);
+    }
+    std::vector<double> values = jacobiEigen(t, m, vectors);
+    std::vector<size_t> order(m);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {return values[a] > values[b];});
+
+    double trace = 0, kept = 0;
+    for(size_t i = 0; i < n; i++) trace += covariance[i * n + i];
+    _inSize = n;
+    _dim = dim;
+    _inputScale = scale;
+    _w.assign(n + 1, std::vector<S>(dim, 0));
+    for(size_t k = 0; k < dim; k++) {
+      kept += values[order[k]];
+      double bias = 0;
+      for(size_t i = 0; i < n; i++) {
+	double component = 0;
+	for(size_t a = 0; a < m; a++) component += q[a][i] * vectors[a * m + order[k]];
+	_w[i][k] = static_cast<S>(component);
+	bias -= component * mean[i] * scale;
+      }
+      _w[n][k] = static_cast<S>(bias);
+    }
+    _explainedVariance = trace > 0 ? kept / trace : 0;
+    return true;
+  }
+
+  /*
+   * Very sparse random projection: each weight is +-sqrt(s / dim) with
+   * probability 1 / (2 s) and 0 otherwise, s = sqrt(inSize), which keeps
+   * distances in expectation without looking at the data.
+   */
+  void fitSparseRandom(size_t inSize, size_t dim, S scale, uint32_t seed = 1) {
+    const double s = std::sqrt(static_cast<double>(inSize));
+    std::mt19937 mt(seed);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    _inSize = inSize;
+    _dim = dim;
+    _inputScale = scale;
+    _explainedVariance = 0;
+    _w.assign(inSize + 1, std::vector<S>(dim, 0));
+    for(size_t i = 0; i < inSize; i++) {
+      for(size_t k = 0; k < dim; k++) {
+	const double r = uniform(mt);
+	if(r < 0.5 / s) {
+	  _w[i][k] = static_cast<S>(std::sqrt(s / dim));
+	}else if(r < 1 / s) {
+	  _w[i][k] = static_cast<S>(-std::sqrt(s / dim));
+	}
+      }
+    }
+  }
+
+  /* features of one raw image, size of out: dim */
+  void project(TensorView<const uint8_t> image, TensorView<S> out) const {
+    vec(out) = static_cast<S>(0);
+    for(size_t i = 0; i < _inSize; i++) {
+      if(image[i] == 0) continue;
+      vec(out) += static_cast<S>(image[i]) * vec(_w[i]);
+    }
+    vec(out) = vec(out) * _inputScale + vec(_w[_inSize]);
+  }
+
+  /*
+   * first, a dense layer on the projected features, composed with the
+   * projection into a dense layer on the raw pixels; Layer::forward with
+   * the projection's input scale then computes the same pre-activations
+   */
+  std::shared_ptr<Layer<S>> fuse(const Layer<S> &first) const {
+    if(first._inSize != _dim + 1) {
+      std::cerr << "Projection: layer has " << first._inSize - 1 << " inputs, projection " << _dim << " features" << std::endl;
+      return nullptr;
+    }
+    auto fused = std::make_shared<Layer<S> >(_inSize, first._outSize, first._activationType);
+    defaultScheduler().parallelFor(0, _inSize + 1, Layer<S>::taskGrain, [&](size_t i0, size_t i1) {
+      std::vector<double> row(first._outSize);
+      for(size_t i = i0; i < i1; i++) {
+	if(i == _inSize) {
+	  std::copy(first._w[_dim].begin(), first._w[_dim].end(), row.begin());
+	}else {
+	  std::fill(row.begin(), row.end(), 0.0);
+	}
+	for(size_t k = 0; k < _dim; k++) {
+	  const double p = _w[i][k];
+	  if(p == 0) continue;
+	  for(size_t j = 0; j < first._outSize; j++) row[j] += p * first._w[k][j];
+	}
+	std::copy(row.begin(), row.end(), fused->_w[i].begin());
+      }
+    });
+    return fused;
+  }
+
+  /* copy of net with its first layer fused, nullptr if that layer is not dense or the rest cannot be cloned */
+  std::shared_ptr<Network<S>> fuse(const Network<S> &net) const {
+    std::shared_ptr<Layer<S>> first = std::dynamic_pointer_cast<Layer<S>>(net.getLayer(0));
+    std::shared_ptr<Layer<S>> fused = first ? fuse(*first) : nullptr;
+    if(!fused) return nullptr;
+    auto copy = std::make_shared<Network<S> >();
+    copy->addLayer(fused);
+    for(size_t l = 1; l < net.getNumLayers(); l++) {
+      std::shared_ptr<LayerBase<S>> cloned = net.getLayer(l)->clone();
+      if(!cloned) return nullptr;
+      copy->addLayer(cloned);
+    }
+    return copy;
+  }
+
+  size_t getMemoryBytes() const {
+    return vectorBytes(_w);
+  }
+
+private:
+  /* y = C q for each vector of q, rows of C in parallel as axpys over the vectors' elements side by side */
+  static std::vector<std::vector<double> > multiply(const std::vector<double> &c, const std::vector<std::vector<double> > &q) {
+    const size_t n = q[0].size(), m = q.size();
+    std::vector<double> qt(n * m);
+    for(size_t a = 0; a < m; a++) {
+      for(size_t j = 0; j < n; j++) qt[j * m + a] = q[a][j];
+    }
+    std::vector<std::vector<double> > y(m, std::vector<double>(n));
+    defaultScheduler().parallelFor(0, n, 16, [&](size_t i0, size_t i1) {
+      std::vector<double> row(m);
+      for(size_t i = i0; i < i1; i++) {
+	vec(row) = 0.0;
+	for(size_t j = 0; j < n; j++) vec(row) += c[i * n + j] * vec(qt.data() + j * m, m);
+	for(size_t a = 0; a < m; a++) y[a][i] = row[a];
+      }
+    });
+    return y;
+  }
+
+  /* modified Gram-Schmidt */
+  static void orthonormalize(std::vector<std::vector<double> > &q) {
+    for(size_t a = 0; a < q.size(); a++) {
+      for(size_t b = 0; b < a; b++) {
+	const double d = std::inner_product(q[a].begin(), q[a].end(), q[b].begin(), 0.0);
+	vec(q[a]) -= d * vec(q[b]);
+      }
+      const double norm = std::sqrt(std::inner_product(q[a].begin(), q[a].end(), q[a].begin(), 0.0));
+      if(norm > 0) vec(q[a]) = vec(q[a]) / norm;
+    }
+  }
+
+  /* cyclic Jacobi for the symmetric m x m matrix a; returns the eigenvalues, eigenvector k in column k of vectors */
+  static std::vector<double> jacobiEigen(std::vector<double> a, size_t m, std::vector<double> &vectors) {
+    vectors.assign(m * m, 0);
+    for(size_t i = 0; i < m; i++) vectors[i * m + i] = 1;
+    for(int sweep = 0; sweep < 50; sweep++) {
+      double off = 0, diagonal = 0;
+      for(size_t p = 0; p < m; p++) {
+	diagonal += a[p * m + p] * a[p * m + p];
+	for(size_t r = p + 1; r < m; r++) off += a[p * m + r] * a[p * m + r];
+      }
+      if(off <= 1e-24 * diagonal) break;
+      for(size_t p = 0; p < m; p++) {
+	for(size_t r = p + 1; r < m; r++) {
+	  if(a[p * m + r] == 0) continue;
+	  const double theta = (a[r * m + r] - a[p * m + p]) / (2 * a[p * m + r]);
+	  const double t = (theta >= 0 ? 1 : -1) / (std::abs(theta) + std::sqrt(theta * theta + 1));
+	  const double c = 1 / std::sqrt(t * t + 1), s = t * c;
+	  for(size_t k = 0; k < m; k++) {
+	    const double akp = a[k * m + p], akr = a[k * m + r];
+	    a[k * m + p] = c * akp - s * akr;
+	    a[k * m + r] = s * akp + c * akr;
+	  }
+	  for(size_t k = 0; k < m; k++) {
+	    const double apk = a[p * m + k], ark = a[r * m + k];
+	    a[p * m + k] = c * apk - s * ark;
+	    a[r * m + k] = s * apk + c * ark;
+	  }
+	  for(size_t k = 0; k < m; k++) {
+	    const double vkp = vectors[k * m + p], vkr = vectors[k * m + r];
+	    vectors[k * m + p] = c * vkp - s * vkr;
+	    vectors[k * m + r] = s * vkp + c * vkr;
+	  }
+	}
+      }
+    }
+    std::vector<double> values(m);
+    for(size_t i = 0; i < m; i++) values[i] = a[i * m + i];
+    return values;
+  }
+};
+
+/* every image of a data set projected once, so that epochs read dim features instead of the pixels */
+template <class S>
+class ProjectedDataSet {
+  size_t _dim;
+  std::vector<S> _features; /* numImages x dim */
+public:
+  ProjectedDataSet(const Projection<S> &projection, MNistDataSet &set) :
+    _dim(projection.getDim()),
+    _features(set.getNumImages() * projection.getDim())
+  {
+    defaultScheduler().parallelFor(0, set.getNumImages(), 256, [&](size_t begin, size_t end) {
+      for(size_t sample = begin; sample < end; sample++) {
+	projection.project(set.getImage(sample), TensorView<S>(_features.data() + sample * _dim, _dim));
+      }
+    });
+  }
+
+  size_t getDim() const {
+    return _dim;
+  }
+
+  TensorView<const S> getFeatures(size_t sample) const {
+    return TensorView<const S>(_features.data() + sample * _dim, _dim);
+  }
+
+  size_t getMemoryBytes() const {
+    return vectorBytes(_features);
+  }
+};
+
+/* runEpoch on the cached features of set; labels still come from set */
+template <class S>
+std::pair<double, double> runEpoch(Network<S> &net, MNistDataSet &set, const ProjectedDataSet<S> &projected, bool train, double learningRate = 0.1, int batchSize = 100) {
+  ForwardFunctionT<S> forward = [&projected](Network<S> &net, MNistDataSet &set, uint32_t sample) {
+    return net.forward(projected.getFeatures(sample));
+  };
+  return runEpoch(net, set, forward, train, learningRate, batchSize);
+}
@@ -0,0 +1,62 @@
+#include <utility>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <chrono>
+
+#include "projection.cpp"
+
+int main(int argc, char **argv) {
+  const std::string method = argc > 1 ? argv[1] : "pca";
+  size_t dim = argc > 2 ? std::atoi(argv[2]) : 64;
+  int numEpochs = argc > 3 ? std::atoi(argv[3]) : 3;
+
+  MNistDataSet trainSet("mnist/train-images-idx3-ubyte", "mnist/train-labels-idx1-ubyte");
+  MNistDataSet testSet("mnist/t10k-images-idx3-ubyte", "mnist/t10k-labels-idx1-ubyte");
+  const size_t inSize = trainSet.getNumRows() * trainSet.getNumColumns();
+  const float scale = 1.0 / 256;
+  progressEnabled() = false;
+
+  auto start = std::chrono::steady_clock::now();
+  Projection<float> projection;
+  if(method == "random") {
+    projection.fitSparseRandom(inSize, dim, scale);
+  }else if(!projection.fitPca(trainSet, dim, scale)) {
+    return 1;
+  }
+  ProjectedDataSet<float> projectedTrain(projection, trainSet), projectedTest(projection, testSet);
+  std::cout << std::fixed << std::setprecision(4) << method << " to " << dim << " features: "
+	    << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " sec to fit and project, explained variance "
+	    << projection.getExplainedVariance() << ", cached features " << (projectedTrain.getMemoryBytes() + projectedTest.getMemoryBytes()) / (1024.0 * 1024.0)
+	    << " MB" << std::endl;
+
+  /* the same network shape on the projected features and on the pixels */
+  Network<float> net, baseline;
+  net.addLayer(dim, 300, Layer<float>::ActivationType::RELU);
+  net.addLayer(300, 10, Layer<float>::ActivationType::SOFTMAX);
+  baseline.addLayer(inSize, 300, Layer<float>::ActivationType::RELU);
+  baseline.addLayer(300, 10, Layer<float>::ActivationType::SOFTMAX);
+  double seconds = 0, baselineSeconds = 0;
+  for(int epoch = 0; epoch < numEpochs; epoch++) {
+    start = std::chrono::steady_clock::now();
+    runEpoch(net, trainSet, projectedTrain, true, 0.1);
+    seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    start = std::chrono::steady_clock::now();
+    runEpoch(baseline, trainSet, true, 0.1);
+    baselineSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "epoch " << epoch << ": test error " << runEpoch(net, testSet, projectedTest, false).second << " on " << dim << " features, "
+	      << runEpoch(baseline, testSet, false).second << " on " << inSize << " pixels" << std::endl;
+  }
+  std::cout << "sec/epoch: " << seconds / numEpochs << " on " << dim << " features, " << baselineSeconds / numEpochs << " on " << inSize << " pixels" << std::endl;
+
+  /* the projection folded into the first layer reads raw images again */
+  std::shared_ptr<Network<float>> fused = projection.fuse(net);
+  if(!fused) return 1;
+  float maxDiff = 0;
+  for(uint32_t sample = 0; sample < testSet.getNumImages(); sample++) {
+    std::vector<float> out = net.forward(projectedTest.getFeatures(sample)).toVector();
+    TensorView<const float> fusedOut = fused->forward(testSet.getImage(sample), scale);
+    for(size_t j = 0; j < out.size(); j++) maxDiff = std::max(maxDiff, std::abs(out[j] - fusedOut[j]));
+  }
+  std::cout << "fused first layer: test error " << evaluateErrorRate(*fused, testSet) << ", max output difference to projecting first " << maxDiff << std::endl;
+}
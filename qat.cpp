@@ -0,0 +1,197 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+
+#include "neural_net.cpp"
+#include "mnist.cpp"
+#include "quantize.cpp"
+
+/*
+ * Dense layer trained with fake int8 quantization of its weights (per column,
+ * scale max|w| / 127) and of its input (scale tracked as an EMA of max|x| / 127).
+ * The fake-quantized weights are cached and refreshed once per updateParam, and
+ * the input is quantized inside forward, so QAT costs one extra pass over the
+ * input. Gradients go straight through to the latent weights; inputs clipped
+ * by the quantizer get no gradient.
+ */
+template <class S>
+struct QatLayer : public Layer<S> {
+  std::vector<std::vector<S> > _wq; /* fake-quantized _w */
+  std::vector<S> _wScale; /* size: outSize */
+  S _inputScale;
+  S _momentum;
+  S _lastInputMax;
+  bool _calibrated;
+  std::vector<uint8_t> _clipped; /* size: inSize - 1 */
+public:
+  using typename LayerBase<S>::ActivationType;
+
+  QatLayer(size_t inSize, size_t outSize, ActivationType activationType, S momentum = 0.99) :
+    Layer<S>(inSize, outSize, activationType),
+    _momentum(momentum)
+  {
+    init();
+  }
+
+  QatLayer(const Layer<S> &layer, S momentum = 0.99) :
+    Layer<S>(layer),
+    _momentum(momentum)
+  {
+    init();
+  }
+
+  void init() {
+    _wq = this->_w;
+    _wScale.assign(this->_outSize, 1);
+    _inputScale = 0;
+    _lastInputMax = 0;
+    _calibrated = false;
+    _clipped.assign(this->_inSize - 1, 0);
+    refreshWeights();
+  }
+
+  void refreshWeights() {
+    for(int j = 0; j < this->_outSize; j++) {
+      S maxAbs = 0;
+      for(int i = 0; i < this->_inSize; i++) {
+	maxAbs = std::max(maxAbs, std::abs(this->_w[i][j]));
+      }
+      _wScale[j] = maxAbs > 0 ? maxAbs / 127 : 1;
+    }
+    for(int i = 0; i < this->_inSize; i++) {
+      const S *w = this->_w[i].data();
+      S *wq = _wq[i].data();
+      for(int j = 0; j < this->_outSize; j++) {
+	wq[j] = std::nearbyint(w[j] / _wScale[j]) * _wScale[j];
+      }
+    }
+  }
+
+  TensorView<const S> forward(TensorView<const S> input) {
+    this->_byteInput = false;
+    const size_t inSize = this->_inSize - 1;
+    S maxAbs = 0;
+    for(int i = 0; i < inSize; i++) {
+      maxAbs = std::max(maxAbs, std::abs(input[i]));
+    }
+    _lastInputMax = maxAbs;
+    const S scale = _calibrated ? _inputScale : std::max(maxAbs, static_cast<S>(1e-6)) / 127;
+    const S invScale = 1 / scale;
+    this->_input.resize(this->_inSize);
+    for(int i = 0; i < inSize; i++) {
+      S q = std::nearbyint(input[i] * invScale);
+      _clipped[i] = q > 127 || q < -127;
+      this->_input[i] = std::max(static_cast<S>(-127), std::min(static_cast<S>(127), q)) * scale;
+    }
+    this->_input[inSize] = 1;
+    this->_inputView = TensorView<const S>(this->_input.data(), inSize); /* what Layer<S>::updateGrad reads */
+    std::fill(this->_u.begin(), this->_u.end(), 0);
+    for(int i = 0; i < this->_inSize; i++) {
+      const S x = this->_input[i];
+      if(x == 0) continue;
+      const S *wq = _wq[i].data();
+      for(int j = 0; j < this->_outSize; j++) {
+	this->_u[j] += x * wq[j];
+      }
+    }
+    this->_activation->activation(this->_u, this->_output);
+    return this->_output;
+  }
+
+  TensorView<const S> forward(TensorView<const uint8_t> input, S scale) {
+    return LayerBase<S>::forward(input, scale);
+  }
+
+  std::vector<S> backpropagate(const std::vector<S> &delta) {
+    std::vector<S> propagated(this->_inSize - 1, 0);
+    for(int i = 0; i < this->_inSize - 1; i++) {
+      if(_clipped[i]) continue;
+      S sum = 0;
+      for(int j = 0; j < this->_outSize; j++) {
+	sum += delta[j] * _wq[i][j];
+      }
+      propagated[i] = sum;
+    }
+    return propagated;
+  }
+
+  /* called for training samples only, so the input range EMA is updated here */
+  void updateGrad(const std::vector<S> &delta) {
+    const S observed = std::max(_lastInputMax, static_cast<S>(1e-6)) / 127;
+    _inputScale = _calibrated ? _momentum * _inputScale + (1 - _momentum) * observed : observed;
+    _calibrated = true;
+    Layer<S>::updateGrad(delta);
+  }
+
+  void updateParam(S learningRate) {
+    Layer<S>::updateParam(learningRate);
+    refreshWeights();
+  }
+
+  /* Layer<S>::clone would copy the dense part only */
+  std::shared_ptr<LayerBase<S>> clone() const {
+    return std::make_shared<QatLayer<S> >(*this);
+  }
+
+  void addMemory(MemoryStats &stats) const {
+    Layer<S>::addMemory(stats);
+    stats.weights += vectorBytes(_wq) + vectorBytes(_wScale);
+    stats.activations += vectorBytes(_clipped);
+  }
+
+  std::shared_ptr<QuantizedLayer<S>> exportInt8() const {
+    return std::make_shared<QuantizedLayer<S> >(*this, Precision::INT8, _inputScale);
+  }
+};
+
+/* replaces the dense layers by QatLayers starting from their current weights */
+template <class S>
+Network<S> toQat(const Network<S> &net) {
+  Network<S> qat;
+  for(int l = 0; l < net.getNumLayers(); l++) {
+    std::shared_ptr<Layer<S>> dense = std::dynamic_pointer_cast<Layer<S>>(net.getLayer(l));
+    qat.addLayer(dense ? std::make_shared<QatLayer<S> >(*dense) : net.getLayer(l));
+  }
+  return qat;
+}
+
+/* int8 inference network using the scales learned during QAT */
+template <class S>
+Network<S> exportInt8(const Network<S> &net) {
+  Network<S> int8;
+  for(int l = 0; l < net.getNumLayers(); l++) {
+    std::shared_ptr<QatLayer<S>> qat = std::dynamic_pointer_cast<QatLayer<S>>(net.getLayer(l));
+    int8.addLayer(qat ? qat->exportInt8() : net.getLayer(l));
+  }
+  return int8;
+}
+
+/* post-training int8 baseline: input scales from the max |input| seen on numSamples calibration samples */
+template <class S>
+Network<S> calibrateInt8(Network<S> &net, MNistDataSet &calibration, uint32_t numSamples) {
+  std::vector<S> maxAbs(net.getNumLayers(), 0);
+  numSamples = std::min(numSamples, calibration.getNumImages());
+  for(uint32_t sample = 0; sample < numSamples; sample++) {
+    net.forward(calibration.getImage(sample), static_cast<S>(1.0 / 256));
+    for(int l = 0; l < net.getNumLayers(); l++) {
+      std::shared_ptr<Layer<S>> dense = std::dynamic_pointer_cast<Layer<S>>(net.getLayer(l));
+      if(!dense) continue;
+      if(dense->_byteInput) {
+	for(uint8_t x : dense->_inputBytes) maxAbs[l] = std::max(maxAbs[l], x * dense->_inputScale);
+      }else {
+	for(int i = 0; i < dense->_inSize - 1; i++) maxAbs[l] = std::max(maxAbs[l], std::abs(dense->_inputView[i]));
+      }
+    }
+  }
+  Network<S> int8;
+  for(int l = 0; l < net.getNumLayers(); l++) {
+    std::shared_ptr<Layer<S>> dense = std::dynamic_pointer_cast<Layer<S>>(net.getLayer(l));
+    if(dense) {
+      int8.addLayer(std::make_shared<QuantizedLayer<S> >(*dense, Precision::INT8, std::max(maxAbs[l], static_cast<S>(1e-6)) / 127));
+    }else {
+      int8.addLayer(net.getLayer(l));
+    }
+  }
+  return int8;
+}
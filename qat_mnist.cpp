@@ -0,0 +1,45 @@
+#include <utility>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+
+#include "trainer.cpp"
+#include "qat.cpp"
+
+template <class S>
+double timedEpoch(Network<S> &net, MNistDataSet &trainSet, double learningRate) {
+  auto start = std::chrono::steady_clock::now();
+  runEpoch(net, trainSet, true, learningRate);
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char **argv) {
+  int numEpochs = argc > 1 ? std::atoi(argv[1]) : 5;
+  int numQatEpochs = argc > 2 ? std::atoi(argv[2]) : 2;
+
+  MNistDataSet trainSet("mnist/train-images-idx3-ubyte", "mnist/train-labels-idx1-ubyte");
+  MNistDataSet testSet("mnist/t10k-images-idx3-ubyte", "mnist/t10k-labels-idx1-ubyte");
+
+  Network<float> net;
+  net.addLayer(trainSet.getNumRows() * trainSet.getNumColumns(), 300, Layer<float>::ActivationType::RELU);
+  net.addLayer(300, 10, Layer<float>::ActivationType::SOFTMAX);
+  double floatSeconds = 0;
+  for(int epoch = 0; epoch < numEpochs; epoch++) {
+    floatSeconds = timedEpoch(net, trainSet, 0.2);
+  }
+  std::cout << std::endl << "float: test error " << calcErrorRate(net, testSet, testSet.getNumImages())
+	    << ", " << floatSeconds << " sec/epoch" << std::endl;
+
+  Network<float> ptq = calibrateInt8(net, trainSet, 2000);
+  std::cout << "post-training int8: test error " << calcErrorRate(ptq, testSet, testSet.getNumImages()) << std::endl;
+
+  Network<float> qat = toQat(net);
+  double qatSeconds = 0;
+  for(int epoch = 0; epoch < numQatEpochs; epoch++) {
+    qatSeconds = timedEpoch(qat, trainSet, 0.05);
+  }
+  std::cout << std::endl << "QAT fake-quant: test error " << calcErrorRate(qat, testSet, testSet.getNumImages())
+	    << ", " << qatSeconds << " sec/epoch" << std::endl;
+  Network<float> int8 = exportInt8(qat);
+  std::cout << "QAT exported int8: test error " << calcErrorRate(int8, testSet, testSet.getNumImages()) << std::endl;
+}
@@ -0,0 +1,334 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+
+#include "neural_net.cpp"
+#include "mnist.cpp"
+
+enum class Precision {
+  NATIVE,
+  BF16,
+  INT8,
+  INT4
+};
+
+const char *precisionName(Precision precision) {
+  switch(precision) {
+  case Precision::NATIVE: return "native";
+  case Precision::BF16: return "bf16";
+  case Precision::INT8: return "int8";
+  case Precision::INT4: return "int4";
+  }
+  return "";
+}
+
+template <class S>
+size_t weightBytes(Precision precision, size_t inSize, size_t outSize) {
+  switch(precision) {
+  case Precision::NATIVE: return inSize * outSize * sizeof(S);
+  case Precision::BF16: return inSize * outSize * 2;
+  case Precision::INT8: return inSize * outSize + outSize * sizeof(S);
+  case Precision::INT4: return inSize * ((outSize + 1) / 2) + outSize * sizeof(S);
+  }
+  return 0;
+}
+
+/* round to nearest even on the float bit pattern */
+uint16_t toBf16(float x) {
+  uint32_t bits;
+  std::memcpy(&bits, &x, 4);
+  bits += 0x7fff + ((bits >> 16) & 1);
+  return static_cast<uint16_t>(bits >> 16);
+}
+
+float fromBf16(uint16_t x) {
+  uint32_t bits = static_cast<uint32_t>(x) << 16;
+  float f;
+  std::memcpy(&f, &bits, 4);
+  return f;
+}
+
+/*
+ * Inference-only copy of a dense Layer with its weights stored in bf16, or
+ * symmetric int8/int4 with one scale per output column. The kernels widen
+ * the stored weights in-register and apply the column scale in the epilogue.
+ * An int8 layer given an input scale also quantizes its input to int8 and
+ * accumulates int8 x int8 products in int32.
+ */
+template <class S>
+struct QuantizedLayer : public LayerBase<S> {
+  Precision _precision;
+  size_t _rowBytes; /* int4: bytes per input row */
+  std::vector<uint16_t> _wBf16;
+  std::vector<int8_t> _wInt8;
+  std::vector<uint8_t> _wInt4; /* two columns per byte, even column in the low nibble */
+  std::vector<S> _scale; /* size: outSize */
+  std::vector<S> _acc; /* size: outSize */
+  S _inputScale; /* int8 only, 0: float input */
+  std::vector<int8_t> _xq; /* size: inSize */
+  std::vector<int32_t> _accInt; /* size: outSize */
+public:
+  QuantizedLayer(const Layer<S> &layer, Precision precision, S inputScale = 0) :
+    LayerBase<S>(layer._inSize - 1, layer._outSize, layer._activationType),
+    _precision(precision),
+    _rowBytes((layer._outSize + 1) / 2),
+    _scale(layer._outSize, 1),
+    _acc(layer._outSize),
+    _inputScale(precision == Precision::INT8 ? inputScale : 0),
+    _xq(layer._inSize),
+    _accInt(layer._outSize)
+  {
+    const size_t inSize = this->_inSize, outSize = this->_outSize;
+    if(precision == Precision::BF16) {
+      _wBf16.resize(inSize * outSize);
+      for(int i = 0; i < inSize; i++) {
+	for(int j = 0; j < outSize; j++) {
+	  _wBf16[i * outSize + j] = toBf16(static_cast<float>(layer._w[i][j]));
+	}
+      }
+      return;
+    }
+    const int maxLevel = precision == Precision::INT8 ? 127 : 7;
+    for(int j = 0; j < outSize; j++) {
+      S maxAbs = 0;
+      for(int i = 0; i < inSize; i++) {
+	maxAbs = std::max(maxAbs, std::abs(layer._w[i][j]));
+      }
+      _scale[j] = maxAbs > 0 ? maxAbs / maxLevel : 1;
+    }
+    if(precision == Precision::INT8) {
+      _wInt8.resize(inSize * outSize);
+    }else {
+      _wInt4.resize(inSize * _rowBytes, 0);
+    }
+    for(int i = 0; i < inSize; i++) {
+      for(int j = 0; j < outSize; j++) {
+	int q = static_cast<int>(std::lround(layer._w[i][j] / _scale[j]));
+	q = std::max(-maxLevel, std::min(maxLevel, q));
+	if(precision == Precision::INT8) {
+	  _wInt8[i * outSize + j] = static_cast<int8_t>(q);
+	}else {
+	  _wInt4[i * _rowBytes + j / 2] |= static_cast<uint8_t>((q & 0xf) << (4 * (j % 2)));
+	}
+      }
+    }
+  }
+
+  TensorView<const S> forwardInt8(TensorView<const S> input) {
+    const size_t outSize = this->_outSize;
+    const S invScale = 1 / _inputScale;
+    for(int i = 0; i < this->_inSize - 1; i++) {
+      S q = std::nearbyint(input[i] * invScale);
+      _xq[i] = static_cast<int8_t>(std::max(static_cast<S>(-127), std::min(static_cast<S>(127), q)));
+    }
+    std::fill(_accInt.begin(), _accInt.end(), 0);
+    for(int i = 0; i < this->_inSize - 1; i++) {
+      const int32_t x = _xq[i];
+      if(x == 0) continue;
+      const int8_t *w = &_wInt8[i * outSize];
+      int32_t *acc = _accInt.data();
+      for(int j = 0; j < outSize; j++) {
+	acc[j] += x * w[j];
+      }
+    }
+    const int8_t *bias = &_wInt8[(this->_inSize - 1) * outSize];
+    for(int j = 0; j < outSize; j++) {
+      this->_u[j] = (_accInt[j] * _inputScale + bias[j]) * _scale[j];
+    }
+    this->_activation->activation(this->_u, this->_output);
+    return this->_output;
+  }
+
+  TensorView<const S> forward(TensorView<const S> input) {
+    if(_inputScale > 0) {
+      return forwardInt8(input);
+    }
+    this->_input.assign(input.begin(), input.end());
+    this->_input.push_back(static_cast<S>(1));
+    const size_t outSize = this->_outSize;
+    std::fill(_acc.begin(), _acc.end(), 0);
+    for(int i = 0; i < this->_inSize; i++) {
+      const S x = this->_input[i];
+      if(x == 0) continue;
+      S *acc = _acc.data();
+      switch(_precision) {
+      case Precision::BF16: {
+	const uint16_t *w = &_wBf16[i * outSize];
+	for(int j = 0; j < outSize; j++) {
+	  acc[j] += x * fromBf16(w[j]);
+	}
+	break;
+      }
+      case Precision::INT8: {
+	const int8_t *w = &_wInt8[i * outSize];
+	for(int j = 0; j < outSize; j++) {
+	  acc[j] += x * w[j];
+	}
+	break;
+      }
+      default: {
+	const uint8_t *w = &_wInt4[i * _rowBytes];
+	for(int b = 0; b < outSize / 2; b++) {
+	  const int8_t packed = static_cast<int8_t>(w[b]);
+	  acc[2 * b] += x * (static_cast<int8_t>(packed << 4) >> 4);
+	  acc[2 * b + 1] += x * (packed >> 4);
+	}
+	if(outSize % 2) {
+	  acc[outSize - 1] += x * (static_cast<int8_t>(w[outSize / 2] << 4) >> 4);
+	}
+	break;
+      }
+      }
+    }
+    for(int j = 0; j < outSize; j++) {
+      this->_u[j] = _acc[j] * _scale[j];
+    }
+    this->_activation->activation(this->_u, this->_output);
+    return this->_output;
+  }
+
+  /* inference only */
+  std::vector<S> backpropagate(const std::vector<S> &delta) {
+    return std::vector<S>(this->_inSize - 1, 0);
+  }
+
+  void updateGrad(const std::vector<S> &delta) {
+  }
+
+  void updateParam(S learningRate) {
+  }
+
+  void addMemory(MemoryStats &stats) const {
+    LayerBase<S>::addMemory(stats);
+    stats.weights += vectorBytes(_wBf16) + vectorBytes(_wInt8) + vectorBytes(_wInt4) + vectorBytes(_scale);
+    stats.activations += vectorBytes(_acc) + vectorBytes(_xq) + vectorBytes(_accInt);
+  }
+};
+
+/* per layer precisions; layers that are not dense Layers always stay native */
+template <class S>
+class PrecisionPlan {
+  std::vector<Precision> _precisions;
+public:
+  PrecisionPlan(size_t numLayers) :
+    _precisions(numLayers, Precision::NATIVE)
+  {
+  }
+
+  Precision &operator[](size_t l) {
+    return _precisions[l];
+  }
+
+  size_t size() const {
+    return _precisions.size();
+  }
+
+  static std::shared_ptr<LayerBase<S>> quantizeLayer(std::shared_ptr<LayerBase<S>> layer, Precision precision) {
+    std::shared_ptr<Layer<S>> dense = std::dynamic_pointer_cast<Layer<S>>(layer);
+    if(!dense || precision == Precision::NATIVE) return layer;
+    return std::make_shared<QuantizedLayer<S> >(*dense, precision);
+  }
+
+  /* the returned network shares the native layers with net */
+  Network<S> apply(const Network<S> &net) const {
+    Network<S> quantized;
+    for(int l = 0; l < net.getNumLayers(); l++) {
+      quantized.addLayer(quantizeLayer(net.getLayer(l), _precisions[l]));
+    }
+    return quantized;
+  }
+
+  size_t weightBytes(const Network<S> &net) const {
+    size_t bytes = 0;
+    for(int l = 0; l < net.getNumLayers(); l++) {
+      std::shared_ptr<LayerBase<S>> layer = net.getLayer(l);
+      bytes += ::weightBytes<S>(_precisions[l], layer->_inSize, layer->_outSize);
+    }
+    return bytes;
+  }
+
+  std::string toString(const Network<S> &net) const {
+    std::ostringstream os;
+    for(int l = 0; l < net.getNumLayers(); l++) {
+      std::shared_ptr<LayerBase<S>> layer = net.getLayer(l);
+      os << "layer " << l << " (" << layer->_inSize - 1 << "->" << layer->_outSize << "): " << precisionName(_precisions[l])
+	 << ", " << ::weightBytes<S>(_precisions[l], layer->_inSize, layer->_outSize) << " bytes" << std::endl;
+    }
+    return os.str();
+  }
+};
+
+template <class S>
+double calcErrorRate(Network<S> &net, MNistDataSet &set, uint32_t numSamples) {
+  numSamples = std::min(numSamples, set.getNumImages());
+  int numWrong = 0;
+  for(uint32_t sample = 0; sample < numSamples; sample++) {
+    TensorView<const S> out = net.forward(set.getImage(sample), static_cast<S>(1.0 / 256));
+    numWrong += std::distance(out.begin(), std::max_element(out.begin(), out.end())) != set.getLabel(sample);
+  }
+  return static_cast<double>(numWrong) / numSamples;
+}
+
+/*
+ * Measures the error increase on the calibration set when each layer alone
+ * drops to bf16, int8 or int4, then starts from the cheapest precision for
+ * every layer and upgrades the layer with the best sensitivity reduction per
+ * byte until the mixed network is within errorBudget of the native one.
+ */
+template <class S>
+PrecisionPlan<S> selectPrecisions(Network<S> &net, MNistDataSet &calibration, double errorBudget, uint32_t numSamples = 1000, bool verbose = true) {
+  const Precision candidates[] = {Precision::INT4, Precision::INT8, Precision::BF16, Precision::NATIVE};
+  const size_t numLayers = net.getNumLayers();
+  double baseError = calcErrorRate(net, calibration, numSamples);
+  if(verbose) {
+    std::cout << "native calibration error: " << baseError << std::endl;
+  }
+
+  std::vector<std::vector<double> > sensitivity(numLayers, std::vector<double>(4, 0));
+  PrecisionPlan<S> plan(numLayers);
+  for(int l = 0; l < numLayers; l++) {
+    std::shared_ptr<LayerBase<S>> original = net.getLayer(l);
+    if(!std::dynamic_pointer_cast<Layer<S>>(original)) continue;
+    for(int c = 0; c < 3; c++) {
+      net.setLayer(l, PrecisionPlan<S>::quantizeLayer(original, candidates[c]));
+      sensitivity[l][c] = calcErrorRate(net, calibration, numSamples) - baseError;
+      if(verbose) {
+	std::cout << "layer " << l << " " << precisionName(candidates[c]) << ": error change " << sensitivity[l][c] << std::endl;
+      }
+    }
+    net.setLayer(l, original);
+    plan[l] = candidates[0];
+  }
+
+  std::vector<int> level(numLayers, 0);
+  while(true) {
+    Network<S> mixed = plan.apply(net);
+    double loss = calcErrorRate(mixed, calibration, numSamples) - baseError;
+    if(verbose) {
+      std::cout << "plan " << plan.weightBytes(net) << " bytes: error change " << loss << std::endl;
+    }
+    if(loss <= errorBudget) break;
+    int best = -1;
+    double bestGain = -1;
+    for(int l = 0; l < numLayers; l++) {
+      if(plan[l] == Precision::NATIVE) continue;
+      std::shared_ptr<LayerBase<S>> layer = net.getLayer(l);
+      double extraBytes = weightBytes<S>(candidates[level[l] + 1], layer->_inSize, layer->_outSize)
+	- weightBytes<S>(candidates[level[l]], layer->_inSize, layer->_outSize);
+      double gain = (sensitivity[l][level[l]] - sensitivity[l][level[l] + 1] + 1e-9) / extraBytes;
+      if(gain > bestGain) {
+	bestGain = gain;
+	best = l;
+      }
+    }
+    if(best < 0) break;
+    plan[best] = candidates[++level[best]];
+  }
+  return plan;
+}
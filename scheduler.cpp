@@ -0,0 +1,287 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+
+enum class TaskPriority {
+  HIGH, /* training kernels */
+  LOW /* background work such as evaluation */
+};
+
+const int numTaskPriorities = 2;
+
+/* counts the unfinished tasks submitted with it */
+struct TaskGroup {
+  std::atomic<int> _pending;
+
+  TaskGroup() :
+    _pending(0)
+  {
+  }
+
+  bool done() const {
+    return _pending == 0;
+  }
+};
+
+struct Task {
+  std::function<void()> _fn;
+  TaskPriority _priority;
+  TaskGroup *_group;
+};
+
+/*
+ * Chase-Lev work-stealing deque with a fixed capacity: the owner pushes and
+ * pops at the bottom, thieves take from the top.
+ */
+class WorkDeque {
+  static const int64_t capacity = 4096;
+  std::atomic<int64_t> _top, _bottom;
+  std::vector<std::atomic<Task *> > _buffer;
+public:
+  WorkDeque() :
+    _top(0),
+    _bottom(0),
+    _buffer(capacity)
+  {
+  }
+
+  /* owner only; false if full */
+  bool push(Task *task) {
+    const int64_t b = _bottom.load(std::memory_order_relaxed);
+    const int64_t t = _top.load(std::memory_order_acquire);
+    if(b - t >= capacity) return false;
+    _buffer[b & (capacity - 1)].store(task, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    _bottom.store(b + 1, std::memory_order_relaxed);
+    return true;
+  }
+
+  /* owner only */
+  Task *pop() {
+    const int64_t b = _bottom.load(std::memory_order_relaxed) - 1;
+    _bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = _top.load(std::memory_order_relaxed);
+    if(t > b) {
+      _bottom.store(b + 1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    Task *task = _buffer[b & (capacity - 1)].load(std::memory_order_relaxed);
+    if(t == b) {
+      if(!_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) task = nullptr;
+      _bottom.store(b + 1, std::memory_order_relaxed);
+    }
+    return task;
+  }
+
+  /* any thread */
+  Task *steal() {
+    int64_t t = _top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const int64_t b = _bottom.load(std::memory_order_acquire);
+    if(t >= b) return nullptr;
+    Task *task = _buffer[t & (capacity - 1)].load(std::memory_order_relaxed);
+    if(!_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) return nullptr;
+    return task;
+  }
+};
+
+/*
+ * Work-stealing scheduler shared by the layer kernels and evaluation. Every
+ * worker owns one deque per priority; tasks submitted from other threads go
+ * to a locked injection queue. A thread looking for work takes any HIGH
+ * task (its own, stolen, injected) before any LOW one, so training kernels
+ * overtake background work at task boundaries. A running task's priority is
+ * the thread's current priority, which submit, wait and parallelFor default
+ * to, so kernels called from LOW work stay LOW. Threads waiting for a group
+ * run tasks meanwhile. With zero workers everything runs inline on the
+ * calling thread.
+ */
+class TaskScheduler {
+  struct Worker {
+    WorkDeque deques[numTaskPriorities];
+  };
+  std::vector<std::unique_ptr<Worker> > _workers;
+  std::vector<std::thread> _threads;
+  std::mutex _injectionMutex;
+  std::deque<Task *> _injected[numTaskPriorities];
+  std::mutex _sleepMutex;
+  std::condition_variable _wake;
+  std::atomic<int> _numQueued;
+  std::atomic<bool> _stop;
+
+  static int &currentWorker() {
+    static thread_local int worker = -1;
+    return worker;
+  }
+
+  Task *takeInjected(int priority) {
+    std::lock_guard<std::mutex> lock(_injectionMutex);
+    if(_injected[priority].empty()) return nullptr;
+    Task *task = _injected[priority].front();
+    _injected[priority].pop_front();
+    return task;
+  }
+
+  Task *find(int maxPriority) {
+    const int self = currentWorker();
+    for(int priority = 0; priority <= maxPriority; priority++) {
+      Task *task = nullptr;
+      if(self >= 0) task = _workers[self]->deques[priority].pop();
+      for(size_t k = 1; !task && k <= _workers.size(); k++) {
+	task = _workers[(self + k) % _workers.size()]->deques[priority].steal();
+      }
+      if(!task) task = takeInjected(priority);
+      if(task) {
+	_numQueued--;
+	return task;
+      }
+    }
+    return nullptr;
+  }
+
+  void run(Task *task) {
+    TaskPriority &current = currentPriority();
+    const TaskPriority outer = current;
+    current = task->_priority;
+    task->_fn();
+    current = outer;
+    if(task->_group) task->_group->_pending--;
+    delete task;
+  }
+
+  void workerLoop(int index) {
+    currentWorker() = index;
+    while(!_stop) {
+      Task *task = find(numTaskPriorities - 1);
+      if(task) {
+	run(task);
+	continue;
+      }
+      std::unique_lock<std::mutex> lock(_sleepMutex);
+      _wake.wait_for(lock, std::chrono::milliseconds(1), [this]() {return _stop || _numQueued > 0;});
+    }
+  }
+public:
+  TaskScheduler(int numWorkers) :
+    _numQueued(0),
+    _stop(false)
+  {
+    for(int w = 0; w < numWorkers; w++) {
+      _workers.push_back(std::unique_ptr<Worker>(new Worker()));
+    }
+    for(int w = 0; w < numWorkers; w++) {
+      _threads.push_back(std::thread([this, w]() {workerLoop(w);}));
+    }
+  }
+
+  TaskScheduler(const TaskScheduler &) = delete;
+
+  ~TaskScheduler() {
+    _stop = true;
+    _wake.notify_all();
+    for(auto &thread : _threads) {
+      thread.join();
+    }
+  }
+
+  size_t getNumWorkers() const {
+    return _workers.size();
+  }
+
+  /* priority of the task running on this thread, HIGH outside tasks */
+  static TaskPriority &currentPriority() {
+    static thread_local TaskPriority priority = TaskPriority::HIGH;
+    return priority;
+  }
+
+  void submit(std::function<void()> fn, TaskPriority priority = currentPriority(), TaskGroup *group = nullptr) {
+    if(group) group->_pending++;
+    Task *task = new Task{std::move(fn), priority, group};
+    if(_workers.empty()) {
+      run(task);
+      return;
+    }
+    const int p = static_cast<int>(priority), self = currentWorker();
+    if(self >= 0) {
+      if(!_workers[self]->deques[p].push(task)) {
+	run(task);
+	return;
+      }
+    }else {
+      std::lock_guard<std::mutex> lock(_injectionMutex);
+      _injected[p].push_back(task);
+    }
+    _numQueued++;
+    _wake.notify_one();
+  }
+
+  /* runs tasks until group is done; a HIGH waiter only helps with HIGH tasks */
+  void wait(TaskGroup &group, TaskPriority priority = currentPriority()) {
+    while(!group.done()) {
+      Task *task = find(static_cast<int>(priority));
+      if(task) {
+	run(task);
+      }else {
+	std::this_thread::yield();
+      }
+    }
+  }
+
+  /* fn(chunkBegin, chunkEnd) over [begin, end) in chunks of grain, the first chunk on the calling thread */
+  template <class Function>
+  void parallelFor(size_t begin, size_t end, size_t grain, const Function &fn, TaskPriority priority = currentPriority()) {
+    grain = std::max<size_t>(1, grain);
+    if(_workers.empty() || end - begin <= grain) {
+      if(begin < end) fn(begin, end);
+      return;
+    }
+    TaskGroup group;
+    for(size_t chunk = begin + grain; chunk < end; chunk += grain) {
+      const size_t chunkEnd = std::min(end, chunk + grain);
+      submit([&fn, chunk, chunkEnd]() {fn(chunk, chunkEnd);}, priority, &group);
+    }
+    fn(begin, begin + grain);
+    wait(group, priority);
+  }
+};
+
+std::unique_ptr<TaskScheduler> &defaultSchedulerPointer() {
+  static std::unique_ptr<TaskScheduler> scheduler(new TaskScheduler(std::max(1u, std::thread::hardware_concurrency()) - 1));
+  return scheduler;
+}
+
+/* hardware threads minus one workers, the caller being the last */
+TaskScheduler &defaultScheduler() {
+  return *defaultSchedulerPointer();
+}
+
+/* sets the calling thread's current priority for the scope's lifetime */
+class TaskPriorityScope {
+  TaskPriority _outer;
+public:
+  TaskPriorityScope(TaskPriority priority) :
+    _outer(TaskScheduler::currentPriority())
+  {
+    TaskScheduler::currentPriority() = priority;
+  }
+
+  TaskPriorityScope(const TaskPriorityScope &) = delete;
+
+  ~TaskPriorityScope() {
+    TaskScheduler::currentPriority() = _outer;
+  }
+};
+
+void resetDefaultScheduler(int numWorkers) {
+  defaultSchedulerPointer().reset(new TaskScheduler(numWorkers));
+}
@@ -0,0 +1,49 @@
+#include <utility>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+
+#include "trainer.cpp"
+
+int main(int argc, char **argv) {
+  int numWorkers = argc > 1 ? std::atoi(argv[1]) : std::max(1u, std::thread::hardware_concurrency()) - 1;
+  int numEpochs = argc > 2 ? std::atoi(argv[2]) : 3;
+
+  resetDefaultScheduler(numWorkers);
+  MNistDataSet trainSet("mnist/train-images-idx3-ubyte", "mnist/train-labels-idx1-ubyte");
+  MNistDataSet testSet("mnist/t10k-images-idx3-ubyte", "mnist/t10k-labels-idx1-ubyte");
+
+  Network<float> net;
+  net.addLayer(trainSet.getNumRows() * trainSet.getNumColumns(), 1000, Layer<float>::ActivationType::RELU);
+  net.addLayer(1000, 10, Layer<float>::ActivationType::SOFTMAX);
+  std::shared_ptr<Network<float>> reference = net.clone();
+
+  /* training kernels run as HIGH tasks while each epoch's snapshot is evaluated as LOW background work */
+  std::vector<double> errorRates(numEpochs, 0);
+  TaskGroup evaluations;
+  double seconds = 0;
+  for(int epoch = 0; epoch < numEpochs; epoch++) {
+    auto start = std::chrono::steady_clock::now();
+    runEpoch(net, trainSet, true, 0.2);
+    seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    evaluateInBackground(net, testSet, evaluations, errorRates[epoch]);
+  }
+  defaultScheduler().wait(evaluations, TaskPriority::LOW);
+  std::cout << std::endl << numWorkers << " workers: " << seconds / numEpochs << " sec/epoch, test error by epoch:";
+  for(double errorRate : errorRates) std::cout << " " << errorRate;
+  std::cout << std::endl;
+
+  /* the kernels accumulate in sequential order, so the same training without workers gives identical weights */
+  resetDefaultScheduler(0);
+  for(int epoch = 0; epoch < numEpochs; epoch++) {
+    runEpoch(*reference, trainSet, true, 0.2);
+  }
+  float maxDiff = 0;
+  for(int l = 0; l < net.getNumLayers(); l++) {
+    auto a = std::dynamic_pointer_cast<Layer<float>>(net.getLayer(l)), b = std::dynamic_pointer_cast<Layer<float>>(reference->getLayer(l));
+    for(int i = 0; i < a->_inSize; i++) {
+      for(int j = 0; j < a->_outSize; j++) maxDiff = std::max(maxDiff, std::abs(a->_w[i][j] - b->_w[i][j]));
+    }
+  }
+  std::cout << std::endl << "max weight difference to sequential training: " << maxDiff << std::endl;
+}
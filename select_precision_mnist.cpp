@@ -0,0 +1,40 @@
+#include <utility>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+
+#include "trainer.cpp"
+#include "quantize.cpp"
+
+template <class S>
+void evaluate(const std::string &name, Network<S> &net, MNistDataSet &testSet) {
+  auto start = std::chrono::steady_clock::now();
+  double errorRate = calcErrorRate(net, testSet, testSet.getNumImages());
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  std::cout << name << ": test error " << errorRate << ", " << testSet.getNumImages() / seconds << " images/sec" << std::endl;
+}
+
+int main(int argc, char **argv) {
+  double errorBudget = argc > 1 ? std::atof(argv[1]) : 0.005;
+  int numEpochs = argc > 2 ? std::atoi(argv[2]) : 5;
+
+  MNistDataSet trainSet("mnist/train-images-idx3-ubyte", "mnist/train-labels-idx1-ubyte");
+  MNistDataSet testSet("mnist/t10k-images-idx3-ubyte", "mnist/t10k-labels-idx1-ubyte");
+
+  Network<float> net;
+  net.addLayer(trainSet.getNumRows() * trainSet.getNumColumns(), 300, Layer<float>::ActivationType::RELU);
+  net.addLayer(300, 10, Layer<float>::ActivationType::SOFTMAX);
+  for(int epoch = 0; epoch < numEpochs; epoch++) {
+    runEpoch(net, trainSet, true, 0.2);
+  }
+  std::cout << std::endl;
+
+  /* calibrate on training samples, the test set is kept for the final evaluation */
+  PrecisionPlan<float> plan = selectPrecisions(net, trainSet, errorBudget, 2000);
+  std::cout << plan.toString(net);
+  std::cout << "native weights: " << PrecisionPlan<float>(net.getNumLayers()).weightBytes(net) << " bytes, plan: " << plan.weightBytes(net) << " bytes" << std::endl;
+
+  Network<float> mixed = plan.apply(net);
+  evaluate("native", net, testSet);
+  evaluate("mixed precision", mixed, testSet);
+}
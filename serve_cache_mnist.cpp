@@ -0,0 +1,99 @@
+#include <utility>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <thread>
+
+#include "trainer.cpp"
+#include "inference_cache.cpp"
+
+/* request stream with Zipf-distributed popularity over the test images */
+std::vector<uint32_t> makeRequests(uint32_t numImages, size_t numRequests, double exponent) {
+  std::vector<double> weights(numImages);
+  for(uint32_t i = 0; i < numImages; i++) {
+    weights[i] = 1.0 / std::pow(i + 1, exponent);
+  }
+  std::mt19937 mt(1);
+  std::discrete_distribution<uint32_t> dist(weights.begin(), weights.end());
+  std::vector<uint32_t> requests(numRequests);
+  for(auto &r : requests) r = dist(mt);
+  return requests;
+}
+
+int main(int argc, char **argv) {
+  int numThreads = argc > 1 ? std::atoi(argv[1]) : 4;
+  size_t capacity = argc > 2 ? std::atoi(argv[2]) : 1000;
+  size_t numRequests = argc > 3 ? std::atoi(argv[3]) : 50000;
+
+  MNistDataSet trainSet("mnist/train-images-idx3-ubyte", "mnist/train-labels-idx1-ubyte");
+  MNistDataSet testSet("mnist/t10k-images-idx3-ubyte", "mnist/t10k-labels-idx1-ubyte");
+
+  auto net = std::make_shared<Network<float> >();
+  net->addLayer(trainSet.getNumRows() * trainSet.getNumColumns(), 300, Layer<float>::ActivationType::RELU);
+  net->addLayer(300, 10, Layer<float>::ActivationType::SOFTMAX);
+  runEpoch(*net, trainSet, true, 0.2);
+  std::cout << std::endl;
+
+  std::vector<uint32_t> requests = makeRequests(testSet.getNumImages(), numRequests, 1.0);
+  std::vector<float> expected;
+  for(uint32_t r : requests) {
+    TensorView<const float> out = net->forward(testSet.getImage(r), 1.0f / 256);
+    expected.insert(expected.end(), out.begin(), out.end());
+  }
+
+  /* serves the requests from numThreads threads, returns requests per second */
+  auto serve = [&](const std::function<std::vector<float>(uint32_t)> &handle, size_t &numMismatches) {
+    std::atomic<size_t> next(0), mismatches(0);
+    auto worker = [&]() {
+      for(size_t k = next++; k < requests.size(); k = next++) {
+	std::vector<float> out = handle(requests[k]);
+	if(!std::equal(out.begin(), out.end(), expected.begin() + 10 * k)) mismatches++;
+      }
+    };
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for(int t = 0; t < numThreads; t++) {
+      threads.push_back(std::thread(worker));
+    }
+    for(auto &thread : threads) {
+      thread.join();
+    }
+    numMismatches = mismatches;
+    return requests.size() / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  };
+
+  std::mutex netMutex;
+  size_t mismatches;
+  double uncached = serve([&](uint32_t r) {
+    std::lock_guard<std::mutex> lock(netMutex);
+    return net->forward(testSet.getImage(r), 1.0f / 256).toVector();
+  }, mismatches);
+  std::cout << "uncached: " << uncached << " requests/sec, " << mismatches << " mismatches" << std::endl;
+
+  InferenceCache<float> cache(net, capacity);
+  double cached = serve([&](uint32_t r) {
+    return cache.forward(testSet.getImage(r), 1.0f / 256);
+  }, mismatches);
+  std::cout << "cached: " << cached << " requests/sec, " << mismatches << " mismatches, " << cache.size() << " entries" << std::endl;
+  cache.getStats().report(std::cout);
+
+  /* hot-swap to a model trained for one more epoch: no answer from the old model may be served */
+  auto swapped = std::make_shared<Network<float> >(*net);
+  for(int l = 0; l < swapped->getNumLayers(); l++) {
+    swapped->setLayer(l, std::make_shared<Layer<float> >(*std::dynamic_pointer_cast<Layer<float>>(net->getLayer(l))));
+  }
+  runEpoch(*swapped, trainSet, true, 0.2);
+  std::cout << std::endl;
+  cache.setModel(swapped);
+  expected.clear();
+  for(uint32_t r : requests) {
+    TensorView<const float> out = swapped->forward(testSet.getImage(r), 1.0f / 256);
+    expected.insert(expected.end(), out.begin(), out.end());
+  }
+  serve([&](uint32_t r) {
+    return cache.forward(testSet.getImage(r), 1.0f / 256);
+  }, mismatches);
+  std::cout << "after hot-swap: " << mismatches << " mismatches" << std::endl;
+  cache.getStats().report(std::cout);
+}
@@ -0,0 +1,387 @@
+#pragma once
+
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <numeric>
+#include <memory>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "trainer.cpp"
+#include "model_bundle.cpp"
+
+/*
+ * Hyperparameter sweep with successive halving. Every trial trains its own
+ * two-layer Network on the same data sets (best mapped, see MNistDataSet),
+ * so an extra trial costs only its model. A rung trains the surviving
+ * trials up to the rung's epoch budget and ranks them by validation error
+ * and loss; the best 1 / eta go on to a budget eta times larger. Trials run
+ * as LOW tasks on the default scheduler, one per core with their kernels
+ * as HIGH tasks, each in a forked process of its own, or in lockstep as
+ * ModelBundles of the trials sharing a network shape and batch size.
+ */
+
+struct SweepConfig {
+  double learningRate;
+  int hiddenSize;
+  int batchSize;
+};
+
+/* every combination */
+std::vector<SweepConfig> sweepGrid(const std::vector<double> &learningRates, const std::vector<int> &hiddenSizes, const std::vector<int> &batchSizes) {
+  std::vector<SweepConfig> configs;
+  for(double learningRate : learningRates) {
+    for(int hiddenSize : hiddenSizes) {
+      for(int batchSize : batchSizes) {
+	configs.push_back({learningRate, hiddenSize, batchSize});
+      }
+    }
+  }
+  return configs;
+}
+
+struct SweepOptions {
+  int minEpochs = 1; /* budget of the first rung */
+  int maxEpochs = 8;
+  int eta = 2; /* each rung keeps 1 / eta of the trials and multiplies the budget by eta */
+  bool fork = false; /* one process per trial instead of tasks on the default scheduler */
+  bool bundle = false; /* one task per ModelBundle of trials with the same hidden and batch size; ignored with fork */
+  int numProcesses = 0; /* trial processes training at once, 0: one per hardware thread */
+};
+
+struct SweepTrial {
+  SweepConfig config;
+  int epochs; /* trained so far */
+  double loss; /* validation loss and error after the last rung it ran */
+  double errorRate;
+  size_t modelBytes;
+  bool stopped; /* dropped by a rung */
+};
+
+template <class S>
+std::shared_ptr<Network<S> > makeSweepNetwork(const SweepConfig &config, size_t inSize) {
+  auto net = std::make_shared<Network<S> >();
+  net->addLayer(inSize, config.hiddenSize, Layer<S>::ActivationType::RELU);
+  net->addLayer(config.hiddenSize, 10, Layer<S>::ActivationType::SOFTMAX);
+  return net;
+}
+
+/* trains net up to epochs and validates it */
+template <class S>
+void trainTrial(Network<S> &net, SweepTrial &trial, MNistDataSet &train, MNistDataSet &validation, int epochs) {
+  for(; trial.epochs < epochs; trial.epochs++) {
+    runEpoch(net, train, true, trial.config.learningRate, trial.config.batchSize);
+  }
+  std::pair<double, double> result = runEpoch(net, validation, false);
+  trial.loss = result.first;
+  trial.errorRate = result.second;
+  trial.modelBytes = collectMemory(net).total();
+}
+
+class TrialRunner {
+public:
+  virtual ~TrialRunner() {}
+
+  /* trains and validates trials[t] up to epochs for every t in active; false if a trial failed */
+  virtual bool run(std::vector<SweepTrial> &trials, const std::vector<size_t> &active, int epochs) = 0;
+
+  /* frees the model of trial t */
+  virtual void stop(size_t t) = 0;
+};
+
+template <class S>
+class TaskTrialRunner : public TrialRunner {
+  MNistDataSet &_train, &_validation;
+  std::vector<std::shared_ptr<Network<S> > > _nets;
+public:
+  TaskTrialRunner(size_t numTrials, MNistDataSet &train, MNistDataSet &validation) :
+    _train(train),
+    _validation(validation),
+    _nets(numTrials)
+  {
+  }
+
+  bool run(std::vector<SweepTrial> &trials, const std::vector<size_t> &active, int epochs) {
+    TaskGroup group;
+    for(size_t t : active) {
+      defaultScheduler().submit([this, &trials, t, epochs]() {
+	TaskPriorityScope kernels(TaskPriority::HIGH); /* a running trial's kernels go before starting another trial */
+	if(!_nets[t]) _nets[t] = makeSweepNetwork<S>(trials[t].config, _train.getNumRows() * _train.getNumColumns());
+	trainTrial(*_nets[t], trials[t], _train, _validation, epochs);
+      }, TaskPriority::LOW, &group);
+    }
+    defaultScheduler().wait(group, TaskPriority::LOW);
+    return true;
+  }
+
+  void stop(size_t t) {
+    _nets[t].reset();
+  }
+};
+
+/* trials that can share a bundle, i.e. train on the same batches with the same shape, run as one task */
+template <class S>
+class BundleTrialRunner : public TrialRunner {
+  MNistDataSet &_train, &_validation;
+  std::vector<std::shared_ptr<Network<S> > > _nets;
+public:
+  BundleTrialRunner(size_t numTrials, MNistDataSet &train, MNistDataSet &validation) :
+    _train(train),
+    _validation(validation),
+    _nets(numTrials)
+  {
+  }
+
+  bool run(std::vector<SweepTrial> &trials, const std::vector<size_t> &active, int epochs) {
+    std::vector<std::vector<size_t>> groups;
+    for(size_t t : active) {
+      auto sameGroup = [&](const std::vector<size_t> &group) {
+	const SweepTrial &other = trials[group[0]];
+	return other.config.hiddenSize == trials[t].config.hiddenSize && other.config.batchSize == trials[t].config.batchSize && other.epochs == trials[t].epochs;
+      };
+      auto group = std::find_if(groups.begin(), groups.end(), sameGroup);
+      if(group == groups.end()) {
+	groups.push_back({t});
+      }else {
+	group->push_back(t);
+      }
+    }
+    TaskGroup tasks;
+    std::atomic<bool> ok(true);
+    for(const std::vector<size_t> &group : groups) {
+      defaultScheduler().submit([this, &trials, &group, &ok, epochs]() {
+	TaskPriorityScope kernels(TaskPriority::HIGH);
+	std::vector<std::shared_ptr<Network<S> > > nets;
+	std::vector<double> learningRates;
+	for(size_t t : group) {
+	  if(!_nets[t]) _nets[t] = makeSweepNetwork<S>(trials[t].config, _train.getNumRows() * _train.getNumColumns());
+	  nets.push_back(_nets[t]);
+	  learningRates.push_back(trials[t].config.learningRate);
+	}
+	ModelBundle<S> bundle;
+	if(!bundle.pack(nets)) {
+	  ok = false;
+	  return;
+	}
+	for(int epoch = trials[group[0]].epochs; epoch < epochs; epoch++) {
+	  runBundleEpoch(bundle, _train, true, learningRates, trials[group[0]].config.batchSize);
+	}
+	std::vector<std::pair<double, double>> results = runBundleEpoch(bundle, _validation, false);
+	for(size_t k = 0; k < group.size(); k++) {
+	  SweepTrial &trial = trials[group[k]];
+	  trial.epochs = std::max(trial.epochs, epochs);
+	  trial.loss = results[k].first;
+	  trial.errorRate = results[k].second;
+	  trial.modelBytes = collectMemory(*_nets[group[k]]).total();
+	}
+      }, TaskPriority::LOW, &tasks);
+    }
+    defaultScheduler().wait(tasks, TaskPriority::LOW);
+    return ok;
+  }
+
+  void stop(size_t t) {
+    _nets[t].reset();
+  }
+};
+
+/*
+ * One child process per trial, started on its first rung and kept until
+ * the trial is stopped. The parent writes an epoch budget to the child's
+ * command pipe and reads back a TrialReport; at most numProcesses children
+ * train at once. Children share the parent's pages copy-on-write and the
+ * mapped data set pages, and allocate only their own model.
+ */
+template <class S>
+class ForkTrialRunner : public TrialRunner {
+  struct Child {
+    pid_t pid;
+    int command;
+    int report;
+  };
+
+  struct TrialReport {
+    double loss;
+    double errorRate;
+    uint64_t modelBytes;
+  };
+
+  MNistDataSet &_train, &_validation;
+  size_t _numProcesses;
+  std::vector<Child> _children; /* pid 0: not running */
+
+  void childMain(SweepTrial trial, int command, int report) {
+    std::shared_ptr<Network<S> > net = makeSweepNetwork<S>(trial.config, _train.getNumRows() * _train.getNumColumns());
+    int epochs;
+    while(read(command, &epochs, sizeof(epochs)) == sizeof(epochs) && epochs > 0) {
+      trainTrial(*net, trial, _train, _validation, epochs);
+      TrialReport result{trial.loss, trial.errorRate, trial.modelBytes};
+      if(write(report, &result, sizeof(result)) != sizeof(result)) break;
+    }
+  }
+
+  bool start(size_t t, const SweepTrial &trial) {
+    int command[2], report[2];
+    if(pipe(command) != 0) return false;
+    if(pipe(report) != 0) {
+      close(command[0]);
+      close(command[1]);
+      return false;
+    }
+    std::cout.flush();
+    pid_t pid = fork();
+    if(pid == 0) {
+      for(const Child &child : _children) {
+	if(child.pid == 0) continue;
+	close(child.command);
+	close(child.report);
+      }
+      close(command[1]);
+      close(report[0]);
+      defaultSchedulerPointer().release(); /* its worker threads were not forked */
+      resetDefaultScheduler(0);
+      childMain(trial, command[0], report[1]);
+      _exit(0);
+    }
+    close(command[0]);
+    close(report[1]);
+    if(pid < 0) {
+      close(command[1]);
+      close(report[0]);
+      return false;
+    }
+    _children[t] = Child{pid, command[1], report[0]};
+    return true;
+  }
+
+public:
+  ForkTrialRunner(size_t numTrials, MNistDataSet &train, MNistDataSet &validation, size_t numProcesses) :
+    _train(train),
+    _validation(validation),
+    _numProcesses(std::max<size_t>(1, numProcesses)),
+    _children(numTrials, Child{0, -1, -1})
+  {
+    signal(SIGPIPE, SIG_IGN); /* a dead child shows up as a short read instead */
+  }
+
+  ~ForkTrialRunner() {
+    for(size_t t = 0; t < _children.size(); t++) {
+      stop(t);
+    }
+  }
+
+  bool run(std::vector<SweepTrial> &trials, const std::vector<size_t> &active, int epochs) {
+    std::vector<size_t> pending(active.rbegin(), active.rend()), running;
+    while(!pending.empty() || !running.empty()) {
+      while(!pending.empty() && running.size() < _numProcesses) {
+	const size_t t = pending.back();
+	pending.pop_back();
+	if(_children[t].pid == 0 && !start(t, trials[t])) {
+	  std::cerr << "cannot start a process for trial " << t << std::endl;
+	  return false;
+	}
+	if(write(_children[t].command, &epochs, sizeof(epochs)) != sizeof(epochs)) {
+	  std::cerr << "trial " << t << " exited" << std::endl;
+	  return false;
+	}
+	running.push_back(t);
+      }
+      std::vector<pollfd> fds;
+      for(size_t t : running) {
+	fds.push_back(pollfd{_children[t].report, POLLIN, 0});
+      }
+      if(poll(fds.data(), fds.size(), -1) < 0) continue;
+      for(size_t i = fds.size(); i-- > 0; ) {
+	if(fds[i].revents == 0) continue;
+	const size_t t = running[i];
+	TrialReport result;
+	if(read(_children[t].report, &result, sizeof(result)) != sizeof(result)) {
+	  std::cerr << "trial " << t << " exited" << std::endl;
+	  return false;
+	}
+	trials[t].epochs = epochs;
+	trials[t].loss = result.loss;
+	trials[t].errorRate = result.errorRate;
+	trials[t].modelBytes = result.modelBytes;
+	running.erase(running.begin() + i);
+      }
+    }
+    return true;
+  }
+
+  void stop(size_t t) {
+    Child &child = _children[t];
+    if(child.pid == 0) return;
+    close(child.command); /* end of input, the child returns from childMain */
+    close(child.report);
+    waitpid(child.pid, nullptr, 0);
+    child = Child{0, -1, -1};
+  }
+};
+
+/*
+ * Successive halving over configs, ranked on validation, which must not be
+ * the test set; returns the trials, the ones that ran longest and did best
+ * first, or none if the options are invalid.
+ */
+template <class S>
+std::vector<SweepTrial> runSweep(const std::vector<SweepConfig> &configs, MNistDataSet &train, MNistDataSet &validation, const SweepOptions &options, std::ostream &log) {
+  if(options.minEpochs <= 0 || options.maxEpochs < options.minEpochs || options.eta <= 1) {
+    std::cerr << "runSweep: needs 0 < minEpochs <= maxEpochs and eta > 1" << std::endl;
+    return {};
+  }
+  std::vector<SweepTrial> trials;
+  for(const SweepConfig &config : configs) {
+    trials.push_back(SweepTrial{config, 0, 0, 1, 0, false});
+  }
+  std::unique_ptr<TrialRunner> runner;
+  if(options.fork) {
+    const size_t numProcesses = options.numProcesses > 0 ? options.numProcesses : std::max(1u, std::thread::hardware_concurrency());
+    runner.reset(new ForkTrialRunner<S>(trials.size(), train, validation, numProcesses));
+  }else if(options.bundle) {
+    runner.reset(new BundleTrialRunner<S>(trials.size(), train, validation));
+  }else {
+    runner.reset(new TaskTrialRunner<S>(trials.size(), train, validation));
+  }
+  auto better = [&trials](size_t a, size_t b) {
+    if(trials[a].errorRate != trials[b].errorRate) return trials[a].errorRate < trials[b].errorRate;
+    return trials[a].loss < trials[b].loss;
+  };
+  const bool progress = progressEnabled();
+  progressEnabled() = false;
+  std::vector<size_t> active(trials.size());
+  std::iota(active.begin(), active.end(), 0);
+  for(int epochs = options.minEpochs; !active.empty(); epochs = std::min(options.maxEpochs, epochs * options.eta)) {
+    auto start = std::chrono::steady_clock::now();
+    if(!runner->run(trials, active, epochs)) break;
+    std::sort(active.begin(), active.end(), better);
+    const SweepTrial &best = trials[active.front()];
+    log << std::fixed << std::setprecision(4) << active.size() << " trials at " << epochs << " epochs in "
+	<< std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " sec, best: learning rate " << best.config.learningRate
+	<< ", hidden " << best.config.hiddenSize << ", batch " << best.config.batchSize << ", error " << best.errorRate << ", loss " << best.loss << std::endl;
+    if(active.size() == 1 || epochs >= options.maxEpochs) break;
+    const size_t keep = std::max<size_t>(1, active.size() / options.eta);
+    for(size_t k = keep; k < active.size(); k++) {
+      runner->stop(active[k]);
+      trials[active[k]].stopped = true;
+    }
+    active.resize(keep);
+  }
+  progressEnabled() = progress;
+  std::vector<size_t> order(trials.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    if(trials[a].epochs != trials[b].epochs) return trials[a].epochs > trials[b].epochs;
+    return better(a, b);
+  });
+  std::vector<SweepTrial> ranked;
+  for(size_t t : order) ranked.push_back(trials[t]);
+  return ranked;
+}
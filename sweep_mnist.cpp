@@ -0,0 +1,51 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <chrono>
+
+#include "sweep.cpp"
+
+int main(int argc, char **argv) {
+  SweepOptions options;
+  const std::string mode = argc > 1 ? argv[1] : "threads";
+  options.fork = mode == "fork";
+  options.bundle = mode == "bundle";
+  options.maxEpochs = argc > 2 ? std::atoi(argv[2]) : 4;
+
+  /* mapped once; every trial (thread or forked process) reads the same pages */
+  MNistDataSet trainSet("mnist/train-images-idx3-ubyte", "mnist/train-labels-idx1-ubyte", true);
+  MNistDataSet testSet("mnist/t10k-images-idx3-ubyte", "mnist/t10k-labels-idx1-ubyte", true);
+  /* trials are ranked on the last sixth of the training set; the test set only scores the winner */
+  const uint32_t numFit = trainSet.getNumImages() - trainSet.getNumImages() / 6;
+  MNistDataSet fitSet(trainSet, 0, numFit), validationSet(trainSet, numFit, trainSet.getNumImages());
+
+  std::vector<SweepConfig> configs = sweepGrid({0.05, 0.1, 0.2, 0.4}, {32, 100, 300}, {50, 100});
+  auto start = std::chrono::steady_clock::now();
+  std::vector<SweepTrial> trials = runSweep<float>(configs, fitSet, validationSet, options, std::cout);
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  if(trials.empty()) return 1;
+
+  std::cout << std::endl << std::setw(8) << "rate" << std::setw(8) << "hidden" << std::setw(8) << "batch" << std::setw(8) << "epochs"
+	    << std::setw(12) << "val error" << std::setw(10) << "val loss" << std::setw(12) << "model MB" << std::endl;
+  size_t modelBytes = 0;
+  for(const SweepTrial &trial : trials) {
+    modelBytes += trial.modelBytes;
+    std::cout << std::fixed << std::setprecision(2) << std::setw(8) << trial.config.learningRate << std::setw(8) << trial.config.hiddenSize
+	      << std::setw(8) << trial.config.batchSize << std::setw(8) << trial.epochs << std::setprecision(4) << std::setw(12) << trial.errorRate
+	      << std::setw(10) << trial.loss << std::setprecision(2) << std::setw(12) << trial.modelBytes / (1024.0 * 1024.0) << std::endl;
+  }
+  const double datasetMb = (trainSet.getMemoryBytes() + testSet.getMemoryBytes()) / (1024.0 * 1024.0);
+  std::cout << trials.size() << " trials " << (options.fork ? "in forked processes" : options.bundle ? "bundled on the default scheduler" : "on the default scheduler") << " in " << seconds << " sec; "
+	    << "data sets " << datasetMb << " MB " << (trainSet.isMapped() ? "mapped once" : "in memory once")
+	    << ", models " << modelBytes / (1024.0 * 1024.0) << " MB in total instead of " << datasetMb * trials.size() << " MB more for a data set per trial" << std::endl;
+
+  /* the winner retrained on the whole training set for its epochs, the one test set evaluation of the sweep */
+  const SweepTrial &best = trials.front();
+  std::shared_ptr<Network<float> > winner = makeSweepNetwork<float>(best.config, trainSet.getNumRows() * trainSet.getNumColumns());
+  progressEnabled() = false;
+  for(int epoch = 0; epoch < best.epochs; epoch++) {
+    runEpoch(*winner, trainSet, true, best.config.learningRate, best.config.batchSize);
+  }
+  std::cout << std::setprecision(4) << "winner (rate " << best.config.learningRate << ", hidden " << best.config.hiddenSize << ", batch " << best.config.batchSize
+	    << ", " << best.epochs << " epochs) retrained on all " << trainSet.getNumImages() << " training images: test error " << evaluateErrorRate(*winner, testSet) << std::endl;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <vector>
+#include <random>
+
+#include "mnist.cpp"
+
+/*
+ * MNIST-shaped data set without the files: each class is a random sparse
+ * 28x28 prototype, and each image is its class prototype shifted by up to
+ * maxShift pixels with a fraction flipProbability of the pixels flipped and
+ * random intensities. Sets built with the same prototypeSeed share classes.
+ */
+MNistDataSet makeSyntheticMNist(uint32_t numImages, uint32_t sampleSeed, uint32_t prototypeSeed = 1, double flipProbability = 0.1, int maxShift = 2) {
+  const int numRows = 28, numColumns = 28, numClasses = 10;
+  std::mt19937 prototypeMt(prototypeSeed);
+  std::bernoulli_distribution ink(0.2);
+  std::vector<std::vector<uint8_t> > prototypes(numClasses, std::vector<uint8_t>(numRows * numColumns));
+  for(auto &prototype : prototypes) {
+    for(auto &p : prototype) p = ink(prototypeMt);
+  }
+  std::mt19937 mt(sampleSeed);
+  std::uniform_int_distribution<int> label(0, numClasses - 1), shift(-maxShift, maxShift), intensity(128, 255);
+  std::bernoulli_distribution flip(flipProbability);
+  std::vector<std::vector<uint8_t> > images(numImages, std::vector<uint8_t>(numRows * numColumns));
+  std::vector<uint8_t> labels(numImages);
+  for(uint32_t n = 0; n < numImages; n++) {
+    labels[n] = label(mt);
+    const int dy = shift(mt), dx = shift(mt);
+    for(int y = 0; y < numRows; y++) {
+      for(int x = 0; x < numColumns; x++) {
+	const int sy = y - dy, sx = x - dx;
+	bool on = sy >= 0 && sy < numRows && sx >= 0 && sx < numColumns && prototypes[labels[n]][sy * numColumns + sx];
+	if(flip(mt)) on = !on;
+	images[n][y * numColumns + x] = on ? intensity(mt) : 0;
+      }
+    }
+  }
+  return MNistDataSet(numRows, numColumns, images, labels);
+}
@@ -0,0 +1,222 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <algorithm>
+#include <iostream>
+#include <type_traits>
+#include <initializer_list>
+#include <cassert>
+
+#include "expression.cpp"
+
+/*
+ * Non-owning view of up to maxRank dimensions: a pointer, a shape and a
+ * stride (in elements) per dimension. slice, select and transpose return
+ * views of the same elements, so batching and slicing never copy. The
+ * viewed storage must outlive the view.
+ */
+template <class S>
+class TensorView {
+public:
+  typedef typename std::remove_const<S>::type value_type;
+  static const size_t maxRank = 4;
+
+private:
+  S *_data;
+  size_t _rank;
+  size_t _shape[maxRank];
+  size_t _strides[maxRank];
+
+public:
+  TensorView() :
+    TensorView(nullptr, 0)
+  {
+  }
+
+  TensorView(S *data, size_t size) :
+    _data(data),
+    _rank(1)
+  {
+    _shape[0] = size;
+    _strides[0] = 1;
+  }
+
+  /* row-major */
+  TensorView(S *data, size_t rows, size_t columns) :
+    _data(data),
+    _rank(2)
+  {
+    _shape[0] = rows;
+    _shape[1] = columns;
+    _strides[0] = columns;
+    _strides[1] = 1;
+  }
+
+  /* row-major, at most maxRank dimensions */
+  TensorView(S *data, std::initializer_list<size_t> shape) :
+    _data(data),
+    _rank(shape.size() < maxRank ? shape.size() : maxRank)
+  {
+    std::copy(shape.begin(), shape.begin() + _rank, _shape);
+    size_t stride = 1;
+    for(size_t d = _rank; d-- > 0; ) {
+      _strides[d] = stride;
+      stride *= _shape[d];
+    }
+  }
+
+  TensorView(std::vector<value_type> &v) :
+    TensorView(v.data(), v.size())
+  {
+  }
+
+  /* only for views of const elements */
+  TensorView(const std::vector<value_type> &v) :
+    TensorView(v.data(), v.size())
+  {
+  }
+
+  /* a view of a temporary would dangle as soon as the statement ends */
+  TensorView(std::vector<value_type> &&v) = delete;
+
+  /* a view of T elements as a view of S = const T elements */
+  template <class T, class = typename std::enable_if<std::is_convertible<T *, S *>::value>::type>
+  TensorView(const TensorView<T> &other) :
+    _data(other.data()),
+    _rank(other.rank())
+  {
+    for(size_t d = 0; d < _rank; d++) {
+      _shape[d] = other.shape(d);
+      _strides[d] = other.stride(d);
+    }
+  }
+
+  S *data() const {
+    return _data;
+  }
+
+  size_t rank() const {
+    return _rank;
+  }
+
+  size_t shape(size_t d) const {
+    return _shape[d];
+  }
+
+  size_t stride(size_t d) const {
+    return _strides[d];
+  }
+
+  /* number of elements */
+  size_t size() const {
+    size_t size = 1;
+    for(size_t d = 0; d < _rank; d++) size *= _shape[d];
+    return size;
+  }
+
+  bool empty() const {
+    return size() == 0;
+  }
+
+  /* row-major without gaps, so data() .. data() + size() holds exactly the elements */
+  bool isContiguous() const {
+    size_t stride = 1;
+    for(size_t d = _rank; d-- > 0; ) {
+      if(_shape[d] != 1 && _strides[d] != stride) return false;
+      stride *= _shape[d];
+    }
+    return true;
+  }
+
+  /* element i of a rank-1 view */
+  S &operator[](size_t i) const {
+    return _data[i * _strides[0]];
+  }
+
+  /* element (i, j) of a rank-2 view */
+  S &operator()(size_t i, size_t j) const {
+    return _data[i * _strides[0] + j * _strides[1]];
+  }
+
+  /* iterators for contiguous views; a strided view must go through operator[] or toVector */
+  S *begin() const {
+    assert(isContiguous());
+    return _data;
+  }
+
+  S *end() const {
+    assert(isContiguous());
+    return _data + size();
+  }
+
+  /* indices [begin, end) of dimension d */
+  TensorView slice(size_t d, size_t begin, size_t end) const {
+    TensorView view = *this;
+    view._data += begin * _strides[d];
+    view._shape[d] = end - begin;
+    return view;
+  }
+
+  /* index i of dimension d, which is dropped; e.g. one image of a batch */
+  TensorView select(size_t d, size_t i) const {
+    TensorView view = *this;
+    view._data += i * _strides[d];
+    for(size_t e = d; e + 1 < _rank; e++) {
+      view._shape[e] = _shape[e + 1];
+      view._strides[e] = _strides[e + 1];
+    }
+    view._rank--;
+    return view;
+  }
+
+  /* swaps dimensions d0 and d1 by swapping their strides */
+  TensorView transpose(size_t d0 = 0, size_t d1 = 1) const {
+    TensorView view = *this;
+    std::swap(view._shape[d0], view._shape[d1]);
+    std::swap(view._strides[d0], view._strides[d1]);
+    return view;
+  }
+
+  /* same elements with another row-major shape; an empty view if this one is not contiguous or the sizes differ */
+  TensorView reshape(std::initializer_list<size_t> shape) const {
+    TensorView view(_data, shape);
+    if(!isContiguous() || view.size() != size()) {
+      std::cerr << "TensorView: cannot reshape" << std::endl;
+      return TensorView();
+    }
+    return view;
+  }
+
+  /* the only way to copy: the elements in row-major order */
+  std::vector<value_type> toVector() const {
+    std::vector<value_type> out;
+    out.reserve(size());
+    copyTo(0, _data, out);
+    return out;
+  }
+
+private:
+  void copyTo(size_t d, const S *data, std::vector<value_type> &out) const {
+    if(d == _rank) {
+      out.push_back(*data);
+      return;
+    }
+    for(size_t i = 0; i < _shape[d]; i++) {
+      copyTo(d + 1, data + i * _strides[d], out);
+    }
+  }
+};
+
+/* elementwise expressions over a contiguous view, see expression.cpp */
+template <class S>
+VectorRef<S> vec(const TensorView<S> &v) {
+  assert(v.isContiguous());
+  return VectorRef<S>(v.data(), v.size());
+}
+
+template <class S>
+VectorExpr<S> vec(const TensorView<const S> &v) {
+  assert(v.isContiguous());
+  return VectorExpr<S>(v.data(), v.size());
+}
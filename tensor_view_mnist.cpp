@@ -0,0 +1,49 @@
+#include <iostream>
+#include <vector>
+
+#include "mnist.cpp"
+
+/* counts elements of view that differ from expected(i, j) */
+template <class S, class Expected>
+int countMismatches(TensorView<S> view, const Expected &expected) {
+  int mismatches = 0;
+  for(size_t i = 0; i < view.shape(0); i++) {
+    for(size_t j = 0; j < view.shape(1); j++) {
+      mismatches += view(i, j) != expected(i, j);
+    }
+  }
+  return mismatches;
+}
+
+int main() {
+  MNistDataSet set("mnist/t10k-images-idx3-ubyte", "mnist/t10k-labels-idx1-ubyte");
+  const size_t rows = set.getNumRows(), columns = set.getNumColumns(), imageSize = rows * columns;
+  const std::vector<uint8_t> all = set.getImages().toVector();
+  auto pixel = [&](size_t image, size_t r, size_t c) {
+    return all[image * imageSize + r * columns + c];
+  };
+
+  /* views of images 10 .. 18 against the flat copy, element by element */
+  TensorView<const uint8_t> batch = set.getBatch(10, 18);
+  TensorView<const uint8_t> image = batch.select(0, 3).reshape({rows, columns});
+  TensorView<const uint8_t> transposed = image.transpose();
+  TensorView<const uint8_t> window = transposed.slice(0, 5, 20).slice(1, 7, 12);
+  TensorView<const uint8_t> column = transposed.select(0, 14);
+  int mismatches = countMismatches(batch, [&](size_t i, size_t j) {return all[(10 + i) * imageSize + j];});
+  mismatches += countMismatches(image, [&](size_t r, size_t c) {return pixel(13, r, c);});
+  mismatches += countMismatches(transposed, [&](size_t c, size_t r) {return pixel(13, r, c);});
+  mismatches += countMismatches(window, [&](size_t c, size_t r) {return pixel(13, 7 + r, 5 + c);});
+  for(size_t r = 0; r < rows; r++) {
+    mismatches += column[r] != pixel(13, r, 14);
+  }
+
+  /* toVector walks strides, so copying a transposed view gives its row-major order */
+  const std::vector<uint8_t> copy = window.toVector();
+  for(size_t k = 0; k < copy.size(); k++) {
+    mismatches += copy[k] != pixel(13, 7 + k % 5, 5 + k / 5);
+  }
+
+  const bool contiguity = batch.isContiguous() && image.isContiguous() && !transposed.isContiguous() && !window.isContiguous() && !column.isContiguous();
+  std::cout << "slice, select, transpose, reshape and toVector: " << mismatches << " mismatches; contiguity " << (contiguity ? "as expected" : "WRONG") << std::endl;
+  return mismatches == 0 && contiguity ? 0 : 1;
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <utility>
+#include <iostream>
+#include <iomanip>
+#include <functional>
+#include <mutex>
+
+#include "neural_net.cpp"
+#include "mnist.cpp"
+#include "memory_stats.cpp"
+
+typedef std::function<std::vector<double>(MNistDataSet &, uint32_t)> InputFunction;
+/* returns a view of the network's output buffer */
+template <class S>
+using ForwardFunctionT = std::function<TensorView<const S>(Network<S> &, MNistDataSet &, uint32_t)>;
+typedef ForwardFunctionT<double> ForwardFunction;
+
+/* batch loss progress from runEpoch, on by default; off e.g. while epochs run concurrently */
+bool &progressEnabled() {
+  static bool enabled = true;
+  return enabled;
+}
+
+template <class S>
+std::pair<double, double> runEpoch(Network<S> &net, MNistDataSet &set, const ForwardFunctionT<S> &forward, bool train, double learningRate = 0.1, int batchSize = 100) {
+  int numCorrect = 0;
+  int numWrong = 0;
+  double sumLoss = 0;
+  double batchLoss = 0;
+  int batchId = 0;
+  for(uint32_t sample = 0; sample < set.getNumImages(); sample++) {
+    TensorView<const S> out = forward(net, set, sample);
+    uint8_t estimatedLabel = std::distance(out.begin(), std::max_element(out.begin(), out.end()));
+    bool isCorrect = estimatedLabel == set.getLabel(sample) ? true : false;
+    if(isCorrect) {
+      numCorrect++;
+    }else {
+      numWrong++;
+    }
+    std::vector<double> labelDouble = set.getLabelDouble(sample);
+    std::vector<S> labelOneHot(labelDouble.begin(), labelDouble.end());
+    double sampleLoss = static_cast<double>(net.calcLoss(labelOneHot));
+    sumLoss += sampleLoss;
+    batchLoss += sampleLoss;
+    if(train) {
+      net.backward(labelOneHot);
+      if(sample % batchSize == 0 || sample == set.getNumImages() - 1) {
+	if(progressEnabled()) {
+	  std::cout << std::fixed << std::setprecision(4) << "\rbatch loss[" << batchId << "]: " << batchLoss / batchSize;
+	  std::cout.flush();
+	}
+	batchLoss = 0;
+	batchId++;
+	net.updateParam(static_cast<S>(learningRate));
+      }
+    }
+  }
+  if(train && memoryReportEnabled()) {
+    std::cout << std::endl;
+    printMemoryReport(collectMemory(net, &set), std::cout);
+  }
+  double meanLoss = sumLoss / (numCorrect + numWrong);
+  double errorRate = (double)numWrong / (numCorrect + numWrong);
+  return std::make_pair(meanLoss, errorRate);
+}
+
+std::pair<double, double> runEpoch(Network<double> &net, MNistDataSet &set, const InputFunction &getInput, bool train, double learningRate = 0.1, int batchSize = 100) {
+  /* the first layer reads input in place until backward */
+  std::vector<double> input;
+  ForwardFunction forward = [&getInput, &input](Network<double> &net, MNistDataSet &set, uint32_t sample) {
+    input = getInput(set, sample);
+    return net.forward(input);
+  };
+  return runEpoch(net, set, forward, train, learningRate, batchSize);
+}
+
+/* feeds the raw image bytes to the first layer, the 1/256 scaling is folded into its epilogue */
+template <class S>
+std::pair<double, double> runEpoch(Network<S> &net, MNistDataSet &set, bool train, double learningRate = 0.1, int batchSize = 100) {
+  ForwardFunctionT<S> forward = [](Network<S> &net, MNistDataSet &set, uint32_t sample) {
+    return net.forward(set.getImage(sample), static_cast<S>(1.0 / 256));
+  };
+  return runEpoch(net, set, forward, train, learningRate, batchSize);
+}
+
+/*
+ * error rate on set, evaluated in chunks on the default scheduler. A chunk
+ * borrows a copy of net from a pool, which grows only while every copy is in
+ * use, so there are about as many copies as threads taking part.
+ */
+template <class S>
+double evaluateErrorRate(Network<S> &net, MNistDataSet &set, TaskPriority priority = TaskScheduler::currentPriority(), size_t grain = 256) {
+  std::atomic<uint32_t> numWrong(0);
+  auto evaluateChunk = [&](Network<S> &copy, size_t begin, size_t end) {
+    uint32_t wrong = 0;
+    TensorView<const uint8_t> batch = set.getBatch(begin, end);
+    for(size_t sample = begin; sample < end; sample++) {
+      TensorView<const S> out = copy.forward(batch.select(0, sample - begin), static_cast<S>(1.0 / 256));
+      wrong += std::distance(out.begin(), std::max_element(out.begin(), out.end())) != set.getLabel(sample);
+    }
+    numWrong += wrong;
+  };
+  if(!net.canClone()) {
+    evaluateChunk(net, 0, set.getNumImages());
+  }else {
+    std::mutex mutex;
+    std::vector<std::shared_ptr<Network<S>>> idle;
+    defaultScheduler().parallelFor(0, set.getNumImages(), grain, [&](size_t begin, size_t end) {
+      std::shared_ptr<Network<S>> copy;
+      {
+	std::lock_guard<std::mutex> lock(mutex);
+	if(!idle.empty()) {
+	  copy = idle.back();
+	  idle.pop_back();
+	}
+      }
+      if(!copy) copy = net.clone();
+      evaluateChunk(*copy, begin, end);
+      std::lock_guard<std::mutex> lock(mutex);
+      idle.push_back(copy);
+    }, priority);
+  }
+  return static_cast<double>(numWrong) / set.getNumImages();
+}
+
+/* evaluates a snapshot of net as background work; errorRate is valid once group is done */
+template <class S>
+bool evaluateInBackground(const Network<S> &net, MNistDataSet &set, TaskGroup &group, double &errorRate) {
+  std::shared_ptr<Network<S>> snapshot = net.clone();
+  if(!snapshot) return false;
+  defaultScheduler().submit([snapshot, &set, &errorRate]() {
+    errorRate = evaluateErrorRate(*snapshot, set, TaskPriority::LOW);
+  }, TaskPriority::LOW, &group);
+  return true;
+}